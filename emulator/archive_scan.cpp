@@ -0,0 +1,162 @@
+//  icl1501-scan: disassembles the programs of a directory of tapes
+//  usage: icl1501-scan [-j THREADS] DIR OUTDIR
+//
+//  Each tape of DIR (text or image, see TapeFormat.md, with its journal) is indexed
+//  (record_index.hpp), each program on it is reassembled from its records
+//  and written as OUTDIR/TAPE.PID.lst, TAPE being the whole file name of
+//  the tape, so that tapes with the same stem do not collide
+//
+//  Tapes are shared between the threads through an atomic counter. A
+//  thread holds one tape (mapped, or parsed for text tapes), its index
+//  and one program image at a time, and streams the listings to disk
+
+#include "tape.hpp"
+#include "record_index.hpp"
+#include "disassembler.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+struct scan_result_t
+{
+    size_t bytes = 0;
+    size_t records = 0;
+    size_t programs = 0;
+    std::string error;
+};
+
+//  A PID usable in a file name: letters and digits as they are, other bytes in octal
+static std::string file_name(std::string_view pid)
+{
+    std::string result;
+    for (unsigned char c : pid)
+        if ((c >= '0' && c <= '9') || (c >= 'A' && c <= 'Z') || (c >= 'a' && c <= 'z'))
+            result += c;
+        else
+            result += "_" + to_octal(c);
+    return result;
+}
+
+static void write_program(const std::filesystem::path &path, const std::string &tape, std::string_view pid,
+                          const record_index_t::image_t &image, const disassembler_t &disassembler)
+{
+    FILE *file = fopen(path.c_str(), "w");
+    if (!file)
+        throw std::runtime_error("Cannot write " + path.string());
+    fprintf(file, "; %s, program %s, %zu records\n", tape.c_str(), file_name(pid).c_str(), image.records);
+    auto sink = [&](std::string_view text)
+    { fwrite(text.data(), 1, text.size(), file); };
+    for (size_t page = 0; page != record_index_t::image_t::kPages; page++)
+        for (int upper = 0; upper != 2; upper++)
+            if (image.loaded(page, upper))
+            {
+                auto location = upper * record_index_t::image_t::kHalfPage;
+                disassembler.listing(addrs_t(page, location),
+                                     std::span<const uint8_t>(image.bytes + page * 256 + location, record_index_t::image_t::kHalfPage),
+                                     sink);
+            }
+    if (fclose(file) != 0)
+        throw std::runtime_error("Cannot write " + path.string());
+}
+
+static void scan(const std::filesystem::path &tape_path, const std::filesystem::path &out, scan_result_t &result)
+{
+    disassembler_t disassembler;
+    auto image = std::make_unique<record_index_t::image_t>();
+    try
+    {
+        auto tape = tape_t::load(tape_path);
+        tape->open_journal(tape_journal_t::path_of(tape_path.string()));
+        record_index_t index(*tape);
+        result.bytes = tape->size();
+        result.records = index.size();
+        auto name = tape_path.filename().string();
+        for (auto &pid : index.pids())
+        {
+            index.assemble(pid, *image);
+            if (!image->halves) //  Labels alone (end of file)
+                continue;
+            write_program(out / (name + "." + file_name(pid) + ".lst"), name, pid, *image, disassembler);
+            result.programs++;
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        result.error = e.what();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+    int arg = 1;
+    if (argc == 5 && std::string(argv[1]) == "-j")
+    {
+        threads = std::max(1, atoi(argv[2]));
+        arg = 3;
+    }
+    if (argc - arg != 2)
+    {
+        fprintf(stderr, "usage: %s [-j THREADS] DIR OUTDIR\n", argv[0]);
+        return 2;
+    }
+    std::filesystem::path out(argv[arg + 1]);
+
+    std::vector<std::filesystem::path> tapes;
+    try
+    {
+        for (auto &entry : std::filesystem::directory_iterator(argv[arg]))
+            if (entry.is_regular_file() && entry.path().extension() != ".journal")
+                tapes.push_back(entry.path());
+        std::filesystem::create_directories(out);
+    }
+    catch (const std::filesystem::filesystem_error &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    std::sort(tapes.begin(), tapes.end());
+
+    //  One result per tape, each written by the thread that scanned it
+    std::vector<scan_result_t> results(tapes.size());
+    std::atomic<size_t> next{0};
+    auto start = std::chrono::steady_clock::now();
+    auto worker = [&]()
+    {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < tapes.size();)
+            scan(tapes[i], out, results[i]);
+    };
+    std::vector<std::thread> pool;
+    for (unsigned i = 1; i < threads; i++)
+        pool.emplace_back(worker);
+    worker();
+    for (auto &thread : pool)
+        thread.join();
+    auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+    scan_result_t total;
+    size_t failed = 0;
+    for (size_t i = 0; i != tapes.size(); i++)
+    {
+        if (!results[i].error.empty())
+        {
+            fprintf(stderr, "%s: %s\n", tapes[i].c_str(), results[i].error.c_str());
+            failed++;
+        }
+        total.bytes += results[i].bytes;
+        total.records += results[i].records;
+        total.programs += results[i].programs;
+    }
+    printf("%zu tapes (%zu failed), %zu bytes, %zu records, %zu programs in %.3f s with %u threads\n",
+           tapes.size(), failed, total.bytes, total.records, total.programs, seconds, threads);
+    return failed ? 1 : 0;
+}
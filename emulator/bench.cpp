@@ -0,0 +1,466 @@
+//  icl1501-bench: throughput measurements
+//  usage: icl1501-bench [--repeat N] [--filter TEXT] [--json FILE] [--csv FILE]
+//
+//  Each benchmark runs once to warm up, then N times (11 by default).
+//  The table on stdout gives the median rate and a 95% confidence interval
+//  of the mean; --json and --csv write every statistic, to compare versions.
+
+#include "addrs.hpp"
+#include "iw.hpp"
+#include "memory.hpp"
+#include "disassembler.hpp"
+#include "cfg.hpp"
+#include "cpu.hpp"
+#include "sampler.hpp"
+#include "snapshot.hpp"
+#include "io.hpp"
+#include "tape.hpp"
+#include "tape_reader.hpp"
+#include "tape_decoder.hpp"
+#include "tape_encoder.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <vector>
+
+namespace
+{
+    //  What one run of a benchmark processed
+    struct work_t
+    {
+        uint64_t items;
+        uint64_t bytes;
+    };
+
+    struct benchmark_t
+    {
+        std::string group;         //  "cpu", "decode"...
+        std::string name;
+        std::string unit;          //  What items are: "instr", "words", "bytes"...
+        std::function<work_t()> run;
+    };
+
+    //  Statistics over the runs, rates in units per second
+    struct result_t
+    {
+        const benchmark_t *benchmark;
+        size_t repeats;
+        uint64_t items;            //  Per run
+        uint64_t bytes;
+        double median;
+        double mean;
+        double min;
+        double max;
+        double stddev;
+        double ci95;               //  Half width of the interval of the mean
+        double bytes_per_second;   //  At the median rate
+    };
+
+    double seconds_since(std::chrono::steady_clock::time_point start)
+    {
+        return std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    //  Two-sided 95% Student t quantile, for n - 1 degrees of freedom
+    double student_t95(size_t n)
+    {
+        static const double table[] = {0, 12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262,
+                                       2.228, 2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093,
+                                       2.086, 2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045};
+        if (n < 2)
+            return 0;
+        if (n - 1 < sizeof(table) / sizeof(table[0]))
+            return table[n - 1];
+        return 1.960;
+    }
+
+    result_t measure(const benchmark_t &benchmark, size_t repeats)
+    {
+        benchmark.run(); //  Warm up caches, the decode cache, the JIT...
+
+        std::vector<double> rates;
+        work_t work{};
+        for (size_t i = 0; i != repeats; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            work = benchmark.run();
+            rates.push_back(work.items / seconds_since(start));
+        }
+
+        result_t result{&benchmark, repeats, work.items, work.bytes};
+        std::sort(rates.begin(), rates.end());
+        auto n = rates.size();
+        result.median = n % 2 ? rates[n / 2] : (rates[n / 2 - 1] + rates[n / 2]) / 2;
+        result.min = rates.front();
+        result.max = rates.back();
+        double sum = 0;
+        for (auto rate : rates)
+            sum += rate;
+        result.mean = sum / n;
+        double squares = 0;
+        for (auto rate : rates)
+            squares += (rate - result.mean) * (rate - result.mean);
+        result.stddev = n > 1 ? std::sqrt(squares / (n - 1)) : 0;
+        result.ci95 = student_t95(n) * result.stddev / std::sqrt((double)n);
+        result.bytes_per_second = work.items ? result.median * work.bytes / work.items : 0;
+        return result;
+    }
+
+    //  A 16KB image that decodes to a bit of everything
+    memory_t &mixed_image()
+    {
+        static memory_t memory;
+        static bool filled = false;
+        if (!filled)
+        {
+            for (size_t i = 0; i != 16384; i++)
+                memory[i] = (i * 37 + (i >> 7)) & 0xff;
+            filled = true;
+        }
+        return memory;
+    }
+
+    //  DPL-1 kernels, endless loops at P01-000 using implemented instructions only
+    struct kernel_t
+    {
+        const char *name;
+        const char *code;
+    };
+
+    const kernel_t kernels[] = {
+        //  The bootstrap loop without the tape: fill P00-030..P00-227, again and again
+        {"store_loop", "201-030 231-002 341-230 111-003 101-000"},
+        //  Only taken branches
+        {"branch_chain", "101-002 101-004 101-006 101-010 101-012 101-014 101-016 101-000"},
+        //  Straight line of register loads and compares
+        {"register_ops", "201-001 202-002 203-003 204-004 341-001 342-002 343-003 344-004 "
+                         "205-005 206-006 207-007 345-005 346-006 347-007 101-000"},
+    };
+
+    const uint64_t kKernelInstructions = 10000000;
+
+    //  sampling: sampler_t interval in guest cycles, 0 for none
+    work_t run_kernel(const std::vector<uint8_t> &code, cpu_t::eCore core, uint64_t sampling = 0)
+    {
+        memory_t memory;
+        memory.copy(addrs_t("P01-000"), code);
+        static io_t io; //  Unused by the kernels: shared, so the tape is mounted once
+        cpu_t cpu(memory, io);
+        cpu.set_core(core);
+        cpu.reset();
+        sampler_t sampler(cpu, memory, io.scheduler(), 1 << 16);
+        if (sampling)
+            sampler.start(sampler_t::kGuestCycles, sampling, cpu.cycles());
+        uint64_t executed;
+        cpu.run(kKernelInstructions, executed);
+        return {executed, executed * 2};
+    }
+
+    std::vector<benchmark_t> benchmarks()
+    {
+        std::vector<benchmark_t> result;
+
+        //  Interpreter and translator MIPS
+        const std::pair<cpu_t::eCore, const char *> cores[] = {
+            {cpu_t::kCoreSwitch, "switch"},
+            {cpu_t::kCoreThreaded, "threaded"},
+            {cpu_t::kCoreJIT, "jit"},
+        };
+        for (auto &kernel : kernels)
+        {
+            auto code = vector_from_octal_pairs(kernel.code);
+            for (auto &[core, core_name] : cores)
+                result.push_back({"cpu", std::string(kernel.name) + "/" + core_name, "instr",
+                                  [code, core = core] { return run_kernel(code, core); }});
+        }
+
+        //  Sampling profiler overhead, on the fastest paths
+        auto store_loop = vector_from_octal_pairs(kernels[0].code);
+        for (auto &[core, core_name] : cores)
+            if (core != cpu_t::kCoreSwitch)
+                result.push_back({"cpu", std::string("store_loop/") + core_name + "+sampling", "instr",
+                                  [store_loop, core = core] { return run_kernel(store_loop, core, 10000); }});
+
+        //  The 65536 instruction words through instr_map()
+        result.push_back({"decode", "instr_map", "words", []
+                          {
+                              const int kPasses = 200;
+                              auto map = iw_t::instr_map();
+                              uint32_t histogram[iw_t::kInstructionTypeCount] = {};
+                              for (int pass = 0; pass != kPasses; pass++)
+                                  for (uint32_t word = 0; word != 65536; word++)
+                                      histogram[map[(word * 40503u + pass) & 0xffff]]++;
+                              if (histogram[iw_t::kIOC] == 0)
+                                  printf("  instr_map: no IOC decoded\n");
+                              return work_t{kPasses * 65536ull, kPasses * 65536ull * 2};
+                          }});
+        result.push_back({"decode", "decoded_iw_t", "words", []
+                          {
+                              const int kPasses = 20;
+                              uint32_t cycles = 0;
+                              for (int pass = 0; pass != kPasses; pass++)
+                                  for (uint32_t word = 0; word != 65536; word++)
+                                      cycles += decoded_iw_t(iw_t(word >> 8, word & 0xff)).cycles;
+                              if (cycles == 0)
+                                  printf("  decoded_iw_t: no cycles\n");
+                              return work_t{kPasses * 65536ull, kPasses * 65536ull * 2};
+                          }});
+
+        //  Listing of a full memory image
+        result.push_back({"disassembler", "disassemble_strings", "instr", []
+                          {
+                              auto &memory = mixed_image();
+                              disassembler_t disassembler;
+                              std::string text;
+                              addrs_t adrs(0, 0);
+                              for (size_t i = 0; i != 8192; i++)
+                              {
+                                  iw_t w = memory.get_instruction(adrs);
+                                  text += adrs.as_string() + ": " + w.as_octal() + "      " + disassembler.disassemble(w) + "\n";
+                                  adrs = adrs.next_instruction();
+                              }
+                              return work_t{8192, text.size()};
+                          }});
+        result.push_back({"disassembler", "listing_streaming", "instr", []
+                          {
+                              const int kImages = 10;
+                              disassembler_t disassembler;
+                              uint64_t bytes = 0;
+                              for (int image = 0; image != kImages; image++)
+                                  disassembler.listing(mixed_image(), addrs_t(0, 0), 8192, [&](std::string_view chunk)
+                                                       { bytes += chunk.size(); });
+                              return work_t{kImages * 8192ull, bytes};
+                          }});
+
+        //  Control flow analysis of a full memory image
+        for (unsigned threads : {1u, 0u})
+            result.push_back({"cfg", threads == 1 ? "analyse_1_thread" : "analyse_all_cores", "instr", [threads]
+                              {
+                                  const int kImages = 10;
+                                  uint64_t instructions = 0;
+                                  for (int image = 0; image != kImages; image++)
+                                      instructions += cfg_t(mixed_image(), cfg_t::default_entries(), threads).instructions();
+                                  return work_t{instructions, kImages * 16384ull};
+                              }});
+
+        //  Program text, as given on the command line
+        result.push_back({"parse", "vector_from_octal_pairs", "bytes", []
+                          {
+                              static std::string text;
+                              if (text.empty())
+                                  for (size_t i = 0; i != 8192; i++)
+                                      text += to_octal((i * 37) & 0xff) + "-" + to_octal((i * 11) & 0xff) + " ";
+                              auto data = vector_from_octal_pairs(text);
+                              return work_t{data.size(), text.size()};
+                          }});
+
+        //  Machine snapshots: a fan out of runs from a booted machine
+        result.push_back({"snapshot", "capture_restore", "snapshots", []
+                          {
+                              const int kRuns = 10000;
+                              static memory_t memory;
+                              static io_t io;
+                              static cpu_t cpu(memory, io);
+                              static snapshot_t boot(memory, cpu, io);
+                              for (int run = 0; run != kRuns; run++)
+                              {
+                                  boot.restore(memory, cpu, io);
+                                  memory[run & 0x3fff] = run; //  What a run would change
+                                  snapshot_t child(memory, cpu, io, &boot);
+                              }
+                              return work_t{kRuns, kRuns * 16384ull};
+                          }});
+
+        //  A full 100 ft capture in the text format (3.5 MB)
+        result.push_back({"tape", "parse_text", "bytes", []
+                          {
+                              static std::string text = []
+                              {
+                                  std::string text = "# Full tape\n";
+                                  char line[32];
+                                  for (size_t i = 0; i != (1200 - 30) * 200; i++)
+                                  {
+                                      snprintf(line, sizeof(line), "%09.4f: %03o\n", 30 + i * 0.005, (unsigned)(i * 7 & 0377));
+                                      text += line;
+                                  }
+                                  return text;
+                              }();
+                              auto tape = tape_t::parse(text);
+                              return work_t{tape->size(), text.size()};
+                          }});
+
+        //  Characters through tape_reader_t, delivered by scheduler events
+        result.push_back({"tape", "tape_reader_transfer", "bytes", []
+                          {
+                              static tape_t tape([]
+                                                 {
+                                                     std::vector<uint8_t> data(65536);
+                                                     for (size_t i = 0; i != data.size(); i++)
+                                                         data[i] = i * 7;
+                                                     return data;
+                                                 }());
+                              scheduler_t scheduler;
+                              tape_reader_t reader(&tape, scheduler);
+                              reader.start(0);
+                              uint64_t count = 0;
+                              uint8_t value;
+                              while (count != tape.size())
+                              {
+                                  while (!reader.transfer(value))
+                                      scheduler.run_until(scheduler.next_cycle());
+                                  count++;
+                              }
+                              return work_t{count, count};
+                          }});
+
+        //  A full 100 ft tape of 256-byte records, rendered at 96 kHz
+        static auto records = []
+        {
+            auto tape = std::make_unique<tape_t>();
+            uint32_t seed = 3;
+            for (uint32_t cell = 30 * BPI; cell + 300 * tape_t::kCellsPerByte < 1190 * BPI; cell += BPI / 2)
+                for (int i = 0; i != 256; i++, cell += tape_t::kCellsPerByte)
+                {
+                    seed = seed * 1103515245 + 12345;
+                    tape->append_cell(cell, seed >> 16);
+                }
+            return tape;
+        }();
+        result.push_back({"tape", "capture_encode", "samples", []
+                          {
+                              static std::vector<float> samples(65536);
+                              tape_encoder_t encoder(*records);
+                              uint64_t count = 0;
+                              for (size_t n; (n = encoder.render(samples.data(), samples.size()));)
+                                  count += n;
+                              return work_t{count, count * sizeof(float)};
+                          }});
+
+        //  10 s of it
+        static auto capture = []
+        {
+            tape_encoder_t encoder(*records);
+            std::vector<float> samples(960000);
+            encoder.render(samples.data(), samples.size());
+            return samples;
+        }();
+        for (auto kernel : {tape_decoder_t::kKernelScalar, tape_decoder_t::kKernelSSE2, tape_decoder_t::kKernelAVX2})
+            if (tape_decoder_t::supported(kernel))
+                result.push_back({"tape", std::string("capture_slice_") + tape_decoder_t::name(kernel), "samples", [kernel]
+                                  {
+                                      auto words = (capture.size() + 63) / 64;
+                                      static std::vector<uint64_t> above(words), below(words);
+                                      tape_decoder_t::slice(kernel, capture.data(), capture.size(), true, 0.24f, 0, words,
+                                                            above.data(), below.data());
+                                      return work_t{capture.size(), capture.size() * sizeof(float)};
+                                  }});
+        result.push_back({"tape", "capture_decode", "samples", []
+                          {
+                              auto tape = tape_decoder_t::decode(capture.data(), capture.size(), 96000);
+                              return work_t{capture.size(), capture.size() * sizeof(float)};
+                          }});
+
+        return result;
+    }
+
+    void print_table(const std::vector<result_t> &results)
+    {
+        printf("%-14s %-28s %12s %10s %8s %10s\n", "group", "benchmark", "median", "unit/s", "+/-95%", "MB/s");
+        for (auto &r : results)
+        {
+            auto &b = *r.benchmark;
+            printf("%-14s %-28s %10.2f M %10s %7.1f%% %10.1f\n", b.group.c_str(), b.name.c_str(),
+                   r.median / 1e6, b.unit.c_str(), r.mean ? 100 * r.ci95 / r.mean : 0, r.bytes_per_second / 1e6);
+        }
+    }
+
+    void write_json(FILE *file, const std::vector<result_t> &results)
+    {
+        fprintf(file, "{\n  \"version\": 1,\n  \"benchmarks\": [\n");
+        for (size_t i = 0; i != results.size(); i++)
+        {
+            auto &r = results[i];
+            auto &b = *r.benchmark;
+            fprintf(file,
+                    "    {\"group\": \"%s\", \"name\": \"%s\", \"unit\": \"%s\", \"repeats\": %zu, "
+                    "\"items\": %llu, \"bytes\": %llu, "
+                    "\"median\": %.6g, \"mean\": %.6g, \"min\": %.6g, \"max\": %.6g, "
+                    "\"stddev\": %.6g, \"ci95\": %.6g, \"bytes_per_second\": %.6g}%s\n",
+                    b.group.c_str(), b.name.c_str(), b.unit.c_str(), r.repeats,
+                    (unsigned long long)r.items, (unsigned long long)r.bytes,
+                    r.median, r.mean, r.min, r.max, r.stddev, r.ci95, r.bytes_per_second,
+                    i + 1 != results.size() ? "," : "");
+        }
+        fprintf(file, "  ]\n}\n");
+    }
+
+    void write_csv(FILE *file, const std::vector<result_t> &results)
+    {
+        fprintf(file, "group,name,unit,repeats,items,bytes,median,mean,min,max,stddev,ci95,bytes_per_second\n");
+        for (auto &r : results)
+        {
+            auto &b = *r.benchmark;
+            fprintf(file, "%s,%s,%s,%zu,%llu,%llu,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g,%.6g\n",
+                    b.group.c_str(), b.name.c_str(), b.unit.c_str(), r.repeats,
+                    (unsigned long long)r.items, (unsigned long long)r.bytes,
+                    r.median, r.mean, r.min, r.max, r.stddev, r.ci95, r.bytes_per_second);
+        }
+    }
+
+    bool write_file(const char *path, const std::vector<result_t> &results, void (*writer)(FILE *, const std::vector<result_t> &))
+    {
+        FILE *file = fopen(path, "w");
+        if (!file)
+        {
+            fprintf(stderr, "Cannot write %s\n", path);
+            return false;
+        }
+        writer(file, results);
+        fclose(file);
+        return true;
+    }
+}
+
+int main(int argc, char **argv)
+{
+    size_t repeats = 11;
+    const char *filter = "";
+    const char *json_path = nullptr;
+    const char *csv_path = nullptr;
+
+    for (int i = 1; i < argc; i++)
+    {
+        if (!strcmp(argv[i], "--repeat") && i + 1 < argc)
+            repeats = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+            filter = argv[++i];
+        else if (!strcmp(argv[i], "--json") && i + 1 < argc)
+            json_path = argv[++i];
+        else if (!strcmp(argv[i], "--csv") && i + 1 < argc)
+            csv_path = argv[++i];
+        else
+        {
+            fprintf(stderr, "usage: %s [--repeat N] [--filter TEXT] [--json FILE] [--csv FILE]\n", argv[0]);
+            return 2;
+        }
+    }
+
+    auto all = benchmarks();
+    std::vector<result_t> results;
+    for (auto &benchmark : all)
+        if ((benchmark.group + "/" + benchmark.name).find(filter) != std::string::npos)
+            results.push_back(measure(benchmark, repeats));
+
+    print_table(results);
+    if (json_path && !write_file(json_path, results, write_json))
+        return 1;
+    if (csv_path && !write_file(csv_path, results, write_csv))
+        return 1;
+    return 0;
+}
@@ -0,0 +1,394 @@
+#include "cfg.hpp"
+#include "io.hpp"
+#include "utils.hpp"
+
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <memory>
+#include <stdexcept>
+#include <cassert>
+
+namespace
+{
+    uint16_t next_linear(uint16_t linear, int offset = 2)
+    {
+        return (linear + offset) & 0x3fff;
+    }
+
+    //  Addresses to trace, shared by the threads
+    class worklist_t
+    {
+        std::mutex mutex_;
+        std::condition_variable cv_;
+        std::vector<uint16_t> pending_;
+        unsigned busy_ = 0; //  Threads tracing, that may add work
+
+    public:
+        explicit worklist_t(std::span<const uint16_t> entries) : pending_(entries.begin(), entries.end()) {}
+
+        //  false once everything is traced
+        bool pop(uint16_t &linear)
+        {
+            std::unique_lock lock(mutex_);
+            cv_.wait(lock, [&] { return !pending_.empty() || busy_ == 0; });
+            if (pending_.empty())
+                return false;
+            linear = pending_.back();
+            pending_.pop_back();
+            busy_++;
+            return true;
+        }
+
+        //  After a pop(), with the targets found
+        void done(const std::vector<uint16_t> &targets)
+        {
+            {
+                std::lock_guard lock(mutex_);
+                pending_.insert(pending_.end(), targets.begin(), targets.end());
+                busy_--;
+            }
+            cv_.notify_all();
+        }
+    };
+}
+
+bool cfg_t::ends_block(const iw_t &iw)
+{
+    switch (iw_t::instr_map()[iw.as_word()])
+    {
+    case iw_t::kTLJ:
+    case iw_t::kTMJ:
+    case iw_t::kTLX:
+    case iw_t::kTMX:
+    case iw_t::kBRU:
+    case iw_t::kBRE:
+    case iw_t::kBRH:
+    case iw_t::kBRL:
+    case iw_t::kSBU:
+    case iw_t::kSBE:
+    case iw_t::kSBH:
+    case iw_t::kSBL:
+    case iw_t::kEXB:
+    case iw_t::kEXU:
+    case iw_t::kUnknown:
+        return true;
+    case iw_t::kIOC:
+        return iw.ioc_function_code() == io_t::kTapeTransferByteSkip;
+    default:
+        return false;
+    }
+}
+
+size_t cfg_t::successors(addrs_t pc, const iw_t &iw, edge_t result[2], bool &exits)
+{
+    auto linear = pc.linear();
+    auto next = next_linear(linear);
+
+    //  Same section, like the CPU
+    auto target = [&]()
+    {
+        addrs_t t = iw.address();
+        t.set_section(pc.section());
+        return t.linear();
+    };
+
+    exits = false;
+    switch (iw_t::instr_map()[iw.as_word()])
+    {
+    case iw_t::kUnknown:
+        return 0;
+    case iw_t::kTLJ:
+    case iw_t::kTMJ:
+        //  Counted in bytes from the next instruction
+        result[0] = {next_linear(next, iw.signed_jump_count()), kEdgeBranch};
+        result[1] = {next, kEdgeFallthrough};
+        return 2;
+    case iw_t::kTLX:
+    case iw_t::kTMX:
+        exits = true;
+        result[0] = {next, kEdgeFallthrough};
+        return 1;
+    case iw_t::kBRU:
+    case iw_t::kEXB:
+        result[0] = {target(), kEdgeBranch};
+        return 1;
+    case iw_t::kBRE:
+    case iw_t::kBRH:
+    case iw_t::kBRL:
+        result[0] = {target(), kEdgeBranch};
+        result[1] = {next, kEdgeFallthrough};
+        return 2;
+    case iw_t::kSBU:
+        result[0] = {target(), kEdgeCall};
+        result[1] = {next, kEdgeReturn};
+        return 2;
+    case iw_t::kSBE:
+    case iw_t::kSBH:
+    case iw_t::kSBL:
+        result[0] = {target(), kEdgeCall};
+        result[1] = {next, kEdgeFallthrough};
+        return 2;
+    case iw_t::kEXU:
+        exits = true;
+        return 0;
+    case iw_t::kIOC:
+        result[0] = {next, kEdgeFallthrough};
+        if (iw.ioc_function_code() != io_t::kTapeTransferByteSkip)
+            return 1;
+        result[1] = {next_linear(next), kEdgeSkip};
+        return 2;
+    default:
+        result[0] = {next, kEdgeFallthrough};
+        return 1;
+    }
+}
+
+cfg_t::cfg_t(std::span<const uint8_t> image, const std::vector<addrs_t> &entries, unsigned threads)
+    : bytes_(image.begin(), image.end()), kind_(16384), leader_(16384)
+{
+    if (bytes_.size() != 16384)
+        throw std::runtime_error("Control flow analysis needs a 16KB image, not " + std::to_string(bytes_.size()) + " bytes");
+
+    for (auto &entry : entries)
+    {
+        entries_.push_back(entry.linear());
+        leader_[entry.linear()] |= 0x80;
+    }
+
+    if (threads == 0)
+        threads = std::max(1u, std::thread::hardware_concurrency());
+    trace(entries_, threads);
+    build_blocks();
+}
+
+void cfg_t::trace(std::span<const uint16_t> entries, unsigned threads)
+{
+    //  Written by all the threads
+    std::unique_ptr<std::atomic<uint8_t>[]> claimed(new std::atomic<uint8_t>[16384]);
+    std::unique_ptr<std::atomic<uint8_t>[]> leaders(new std::atomic<uint8_t>[16384]);
+    for (size_t i = 0; i != 16384; i++)
+    {
+        claimed[i].store(0, std::memory_order_relaxed);
+        leaders[i].store(0, std::memory_order_relaxed);
+    }
+
+    worklist_t worklist(entries);
+
+    //  Follows straight runs of instructions, queues the other targets
+    auto worker = [&]()
+    {
+        std::vector<uint16_t> targets;
+        uint16_t linear;
+        while (worklist.pop(linear))
+        {
+            targets.clear();
+            while (claimed[linear].exchange(1, std::memory_order_relaxed) == 0)
+            {
+                iw_t iw(bytes_[linear], bytes_[next_linear(linear, 1)]);
+                edge_t edges[2];
+                bool exits;
+                auto count = successors(addrs_t(linear), iw, edges, exits);
+                if (iw_t::instr_map()[iw.as_word()] == iw_t::kUnknown)
+                {
+                    claimed[linear].store(2, std::memory_order_relaxed); //  Not code
+                    break;
+                }
+
+                if (!ends_block(iw))
+                {
+                    linear = edges[0].target;
+                    continue;
+                }
+
+                for (size_t i = 0; i != count; i++)
+                {
+                    leaders[edges[i].target].fetch_or(1 << edges[i].kind, std::memory_order_relaxed);
+                    targets.push_back(edges[i].target);
+                }
+                break;
+            }
+            worklist.done(targets);
+        }
+    };
+
+    std::vector<std::thread> helpers;
+    for (unsigned i = 1; i < threads; i++)
+        helpers.emplace_back(worker);
+    worker();
+    for (auto &helper : helpers)
+        helper.join();
+
+    for (size_t i = 0; i != 16384; i++)
+    {
+        leader_[i] |= leaders[i].load(std::memory_order_relaxed);
+        if (claimed[i].load(std::memory_order_relaxed) == 1)
+        {
+            kind_[i] |= kByteCode;
+            kind_[next_linear(i, 1)] |= kByteOperand;
+            instructions_++;
+        }
+    }
+    for (auto &kind : kind_)
+        if ((kind & (kByteCode | kByteOperand)) == (kByteCode | kByteOperand))
+            kind |= kByteOverlap;
+}
+
+void cfg_t::build_blocks()
+{
+    std::vector<bool> in_block(16384);
+
+    for (size_t start = 0; start != 16384; start++)
+    {
+        if (!(kind_[start] & kByteCode) || in_block[start])
+            continue;
+
+        block_t block{(uint16_t)start, (uint16_t)start, false, {}};
+        uint16_t pc = start;
+        for (;;)
+        {
+            in_block[pc] = true;
+            iw_t iw(bytes_[pc], bytes_[next_linear(pc, 1)]);
+            auto next = next_linear(pc);
+            block.end = next;
+
+            if (ends_block(iw))
+            {
+                edge_t edges[2];
+                auto count = successors(addrs_t(pc), iw, edges, block.exits);
+                block.successors.assign(edges, edges + count);
+                break;
+            }
+            if (!(kind_[next] & kByteCode) || leader_[next] || in_block[next])
+            {
+                block.successors.push_back({next, kEdgeFallthrough});
+                break;
+            }
+            pc = next;
+        }
+        blocks_.push_back(std::move(block));
+    }
+
+    for (size_t start = 0; start != 16384;)
+    {
+        if (kind_[start] != kByteData)
+        {
+            start++;
+            continue;
+        }
+        size_t end = start;
+        while (end != 16384 && kind_[end] == kByteData)
+            end++;
+        data_.push_back({(uint16_t)start, (uint16_t)end});
+        start = end;
+    }
+}
+
+const cfg_t::block_t *cfg_t::block(uint16_t linear) const
+{
+    auto it = std::lower_bound(blocks_.begin(), blocks_.end(), linear,
+                               [](const block_t &block, uint16_t linear) { return block.start < linear; });
+    if (it == blocks_.end() || it->start != linear)
+        return nullptr;
+    return &*it;
+}
+
+std::string cfg_t::label(uint16_t linear) const
+{
+    auto why = leader_[linear];
+    char prefix;
+    if (why & 0x80)
+        prefix = 'E';
+    else if (why & (1 << kEdgeCall))
+        prefix = 'S';
+    else if (why & ((1 << kEdgeBranch) | (1 << kEdgeSkip)))
+        prefix = 'L';
+    else
+        return "";
+
+    //  "P01-002" -> "L01002"
+    auto adrs = addrs_t(linear).as_string();
+    return prefix + adrs.substr(1, 2) + adrs.substr(4, 3);
+}
+
+void test_cfg_t()
+{
+    memory_t memory;
+
+    //  The bootstrap
+    memory.copy(
+        addrs_t("P01-000"),
+        vector_from_octal_pairs("201-030 170-007 231-002 341-230 111-003 170-016 170-005 100-030"));
+
+    //  What it could load: a polling loop, a subroutine call, a forward TLJ over data
+    memory.copy(
+        addrs_t("P00-030"),
+        vector_from_octal_pairs("201-000 170-207 100-032 120-100 004-002 140-000 377-377 100-046"));
+    memory.copy(addrs_t("P00-100"), vector_from_octal_pairs("140-000"));
+
+    auto at = [](const char *adrs) { return addrs_t(std::string(adrs)).linear(); };
+
+    cfg_t cfg(memory);
+    assert(cfg.instructions() == 8 + 7 + 1);
+
+    //  LDX alone: the BRL loops to P01-002
+    auto b = cfg.block(at("P01-000"));
+    assert(b && b->end == at("P01-002"));
+    assert(b->successors.size() == 1 && b->successors[0].kind == cfg_t::kEdgeFallthrough);
+    b = cfg.block(at("P01-002"));
+    assert(b && b->end == at("P01-012"));
+    assert(b->successors.size() == 2);
+    assert(b->successors[0].target == at("P01-002") && b->successors[0].kind == cfg_t::kEdgeBranch);
+    assert(b->successors[1].target == at("P01-012"));
+    b = cfg.block(at("P01-012"));
+    assert(b && b->end == at("P01-020"));
+    assert(b->successors.size() == 1 && b->successors[0].target == at("P00-030"));
+
+    //  The BRU back into the polling IOC splits the first block
+    b = cfg.block(at("P00-030"));
+    assert(b && b->end == at("P00-032"));
+    b = cfg.block(at("P00-032"));
+    assert(b && b->end == at("P00-034") && b->successors.size() == 2);
+    assert(b->successors[1].target == at("P00-036") && b->successors[1].kind == cfg_t::kEdgeSkip);
+    b = cfg.block(at("P00-036"));
+    assert(b && b->successors[0].target == at("P00-100") && b->successors[0].kind == cfg_t::kEdgeCall);
+    assert(b->successors[1].target == at("P00-040") && b->successors[1].kind == cfg_t::kEdgeReturn);
+    b = cfg.block(at("P00-040"));
+    assert(b && b->successors[0].target == at("P00-046"));
+    b = cfg.block(at("P00-042"));
+    assert(b && b->exits && b->successors.empty());
+    assert(cfg.block(at("P00-100"))->exits);
+
+    //  Never reached
+    assert(cfg.is_data(at("P00-044")) && cfg.is_data(at("P00-045")));
+    assert(cfg.is_code(at("P00-046")));
+    assert(cfg.is_data(at("P01-020")));
+    assert(!cfg.overlaps(at("P00-046")));
+
+    assert(cfg.label(at("P01-000")) == "E01000");
+    assert(cfg.label(at("P01-002")) == "L01002");
+    assert(cfg.label(at("P00-100")) == "S00100");
+    assert(cfg.label(at("P01-012")) == "");
+
+    std::string text;
+    cfg.listing([&](std::string_view chunk) { text += chunk; });
+    assert(text.find("S00100:\nP00-100: 140-000      EXU\n") != std::string::npos);
+    assert(text.find("P00-044 .. P00-045: DATA 2 bytes\n") != std::string::npos);
+
+    //  The same with several threads, on an image full of code
+    for (size_t i = 0; i != 16384; i++)
+        memory[i] = (i * 37 + (i >> 7)) & 0xff;
+    cfg_t one(memory, cfg_t::default_entries(), 1);
+    cfg_t many(memory, cfg_t::default_entries(), 4);
+    assert(one.instructions() == many.instructions());
+    assert(one.blocks().size() == many.blocks().size());
+    for (size_t i = 0; i != one.blocks().size(); i++)
+    {
+        assert(one.blocks()[i].start == many.blocks()[i].start);
+        assert(one.blocks()[i].end == many.blocks()[i].end);
+        assert(one.blocks()[i].successors.size() == many.blocks()[i].successors.size());
+    }
+    for (size_t i = 0; i != 16384; i++)
+        assert(one.is_code(i) == many.is_code(i) && one.label(i) == many.label(i));
+}
@@ -0,0 +1,161 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <span>
+
+#include "addrs.hpp"
+#include "iw.hpp"
+#include "memory.hpp"
+#include "disassembler.hpp"
+
+/*
+    Control flow analysis of a memory image.
+
+    Recursive traversal: starting from entry points, instructions are
+    decoded and their successors followed (branches through
+    iw_t::address() in the current section, TLJ/TMJ through
+    iw_t::signed_jump_count()). Whatever is never reached is data.
+
+    Targets that depend on run-time state (exits through the IAW stack) are
+    not followed: subroutines are assumed to return after the stack and
+    branch that called them.
+
+    The traversal can run on several threads: each one takes an address
+    from the shared worklist and decodes a straight run of instructions,
+    claiming them in an atomic map so no instruction is decoded twice.
+*/
+
+class cfg_t
+{
+public:
+    //  How control reaches a block
+    typedef enum : uint8_t
+    {
+        kEdgeFallthrough, // next instruction
+        kEdgeBranch,      // BRx, EXB, TLJ, TMJ
+        kEdgeCall,        // SBx
+        kEdgeReturn,      // after a SBx, when the subroutine exits
+        kEdgeSkip,        // IOC skip on busy (0207) over the next instruction
+    } eEdge;
+
+    struct edge_t
+    {
+        uint16_t target; // linear
+        eEdge kind;
+    };
+
+    struct block_t
+    {
+        uint16_t start;          // linear address of the first instruction
+        uint16_t end;            // linear address after the last instruction
+        bool exits;              // EXU, TLX or TMX: may leave through the IAW stack
+        std::vector<edge_t> successors;
+    };
+
+    //  A range of bytes never reached by the traversal
+    struct data_t
+    {
+        uint16_t start;
+        uint16_t end;
+    };
+
+    static std::vector<addrs_t> default_entries() { return {addrs_t("P01-000"), addrs_t("P00-030")}; }
+
+private:
+    //  Per byte
+    enum : uint8_t
+    {
+        kByteData = 0,
+        kByteCode = 1,      //  First byte of an instruction
+        kByteOperand = 2,   //  Second byte
+        kByteOverlap = 4,   //  Decoded both as first and second byte
+    };
+
+    std::vector<uint8_t> bytes_;      //  The image
+    std::vector<uint8_t> kind_;       //  kByte*
+    std::vector<uint8_t> leader_;     //  Starts a block, and why (1 << eEdge, plus 0x80 for entries)
+    std::vector<block_t> blocks_;     //  By start address
+    std::vector<data_t> data_;
+    std::vector<uint16_t> entries_;
+    size_t instructions_ = 0;
+
+    void trace(std::span<const uint16_t> entries, unsigned threads);
+    void build_blocks();
+
+public:
+    //  Analyses 16384 bytes, threads == 0 means one per core
+    cfg_t(std::span<const uint8_t> image, const std::vector<addrs_t> &entries = default_entries(), unsigned threads = 1);
+    cfg_t(const memory_t &memory, const std::vector<addrs_t> &entries = default_entries(), unsigned threads = 1)
+        : cfg_t(std::span<const uint8_t>(memory.bytes(), 16384), entries, threads) {}
+
+    //  Successors of the instruction at pc, as the traversal follows them
+    static size_t successors(addrs_t pc, const iw_t &iw, edge_t result[2], bool &exits);
+
+    //  Instructions after which control does not simply go to the next one
+    static bool ends_block(const iw_t &iw);
+
+    const std::vector<block_t> &blocks() const { return blocks_; }
+    const std::vector<data_t> &data() const { return data_; }
+    size_t instructions() const { return instructions_; }
+
+    bool is_code(uint16_t linear) const { return kind_[linear] & kByteCode; }
+    bool is_data(uint16_t linear) const { return kind_[linear] == kByteData; }
+    bool overlaps(uint16_t linear) const { return kind_[linear] & kByteOverlap; }
+
+    //  Block starting at linear, nullptr if none
+    const block_t *block(uint16_t linear) const;
+
+    //  Label of a block leader ("E01000" entry, "S06144" subroutine, "L15042" branch target...), empty if none
+    std::string label(uint16_t linear) const;
+
+    //  Listing with labels, block boundaries and data ranges, in chunks to sink(std::string_view)
+    template <typename Sink>
+    void listing(Sink &&sink) const;
+};
+
+template <typename Sink>
+void cfg_t::listing(Sink &&sink) const
+{
+    disassembler_t disassembler;
+    char line[disassembler_t::kMaxLineLength + 64];
+
+    size_t next_data = 0;
+    for (auto &block : blocks_)
+    {
+        while (next_data != data_.size() && data_[next_data].start < block.start)
+        {
+            auto &data = data_[next_data++];
+            int length = snprintf(line, sizeof(line), "%s .. %s: DATA %d bytes\n",
+                                  addrs_t(data.start).as_string().c_str(),
+                                  addrs_t((uint16_t)(data.end - 1)).as_string().c_str(),
+                                  data.end - data.start);
+            sink(std::string_view(line, length));
+        }
+
+        auto name = label(block.start);
+        if (!name.empty())
+        {
+            name += ":\n";
+            sink(std::string_view(name));
+        }
+        for (uint16_t pc = block.start; pc != block.end; pc = (pc + 2) & 0x3fff)
+        {
+            iw_t iw(bytes_[pc], bytes_[(pc + 1) & 0x3fff]);
+            sink(std::string_view(line, disassembler.listing_line(addrs_t(pc), iw, line)));
+        }
+    }
+    for (; next_data != data_.size(); next_data++)
+    {
+        auto &data = data_[next_data];
+        int length = snprintf(line, sizeof(line), "%s .. %s: DATA %d bytes\n",
+                              addrs_t(data.start).as_string().c_str(),
+                              addrs_t((uint16_t)(data.end - 1)).as_string().c_str(),
+                              data.end - data.start);
+        sink(std::string_view(line, length));
+    }
+}
+
+void test_cfg_t();
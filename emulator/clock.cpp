@@ -0,0 +1,39 @@
+#include "clock.hpp"
+#include "cpu.hpp"
+
+#include <cassert>
+
+void test_guest_clock_t()
+{
+    //  A few timings from the manual
+    assert(instruction_timings[iw_t::kLDA_Imm].not_taken == 4);
+    assert(instruction_timings[iw_t::kLDA_Ind].not_taken == 6);
+    assert(instruction_timings[iw_t::kSTA_Dir].not_taken == 6);
+    assert(instruction_timings[iw_t::kBRL].not_taken == 3);
+    assert(instruction_timings[iw_t::kBRL].taken == 4);
+    assert(instruction_timings[iw_t::kBRU].taken == 4);
+
+    //  Throttled: a 5ms guest loop cannot finish before 5ms of host time
+    memory_t memory;
+    io_t io;
+    //  CPX R#1 377 and BRL back, forever
+    memory.copy(addrs_t("P01-000"), vector_from_octal_pairs("341-377 341-377 111-003"));
+    cpu_t cpu(memory, io);
+    cpu.reset();
+    cpu.clock().set_mode(guest_clock_t::kRealTime);
+
+    auto start = std::chrono::steady_clock::now();
+    while (cpu.cycles() < 5000)
+        cpu.run(100);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    assert(elapsed >= std::chrono::microseconds(5000 - 1000));
+
+    //  Ten times faster
+    cpu.clock().set_mode(guest_clock_t::kScaled, 10.0);
+    start = std::chrono::steady_clock::now();
+    auto target = cpu.cycles() + 20000;
+    while (cpu.cycles() < target)
+        cpu.run(100);
+    elapsed = std::chrono::steady_clock::now() - start;
+    assert(elapsed >= std::chrono::microseconds(2000 - 1000));
+}
@@ -0,0 +1,139 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <chrono>
+#include <thread>
+
+#include "iw.hpp"
+
+/*
+    Guest time is counted in cycles of 1 microsecond, the unit of all the
+    instruction timings of the System Programmers Manual (Section III).
+    Conditional jumps, branches and stack and branches take one more
+    microsecond when performed.
+*/
+
+typedef struct instruction_timing
+{
+    uint8_t not_taken; // or unconditional
+    uint8_t taken;
+} instruction_timing;
+
+constexpr instruction_timing instruction_timing_of(iw_t::eInstructionType type)
+{
+    switch (type)
+    {
+    case iw_t::kTLJ:
+    case iw_t::kTMJ:
+    case iw_t::kTLX:
+    case iw_t::kTMX:
+    case iw_t::kBRE:
+    case iw_t::kBRH:
+    case iw_t::kBRL:
+    case iw_t::kSBE:
+    case iw_t::kSBH:
+    case iw_t::kSBL:
+        return {3, 4};
+    case iw_t::kSBU:
+        return {3, 3};
+    case iw_t::kLDA_Dir:
+    case iw_t::kLDA_Ind:
+    case iw_t::kSTA_Dir:
+    case iw_t::kSTA_Ind:
+    case iw_t::kADA_Dir:
+    case iw_t::kADA_Ind:
+    case iw_t::kSUA_Dir:
+    case iw_t::kSUA_Ind:
+    case iw_t::kANA_Dir:
+    case iw_t::kANA_Ind:
+    case iw_t::kERA_Dir:
+    case iw_t::kERA_Ind:
+    case iw_t::kIRA_Dir:
+    case iw_t::kIRA_Ind:
+    case iw_t::kCPA_Dir:
+    case iw_t::kCPA_Ind:
+        return {6, 6};
+    default: //  Everything else, including IOC (4 to 6, device waits are extra)
+        return {4, 4};
+    }
+}
+
+inline constexpr auto instruction_timings = []()
+{
+    std::array<instruction_timing, iw_t::kInstructionTypeCount> timings{};
+    for (size_t t = 0; t != timings.size(); t++)
+        timings[t] = instruction_timing_of((iw_t::eInstructionType)t);
+    return timings;
+}();
+
+/**
+ * The guest clock, and how it relates to host time.
+ */
+class guest_clock_t
+{
+public:
+    typedef enum
+    {
+        kFast,     // as fast as possible, no host time involved
+        kRealTime, // 1 guest second per host second
+        kScaled,   // N guest seconds per host second
+    } eMode;
+
+    static const uint64_t kCyclesPerSecond = 1000000;
+
+private:
+    uint64_t cycles_ = 0;
+
+    eMode mode_ = kFast;
+    double factor_ = 1.0;
+
+    //  Throttling reference point
+    std::chrono::steady_clock::time_point host_start_;
+    uint64_t guest_start_ = 0;
+
+public:
+    uint64_t cycles() const { return cycles_; }
+    void advance(uint64_t cycles) { cycles_ += cycles; }
+
+    //  Direct access for the interpreter cores
+    uint64_t &counter() { return cycles_; }
+
+    double seconds() const { return (double)cycles_ / kCyclesPerSecond; }
+
+    eMode mode() const { return mode_; }
+    bool throttled() const { return mode_ != kFast; }
+
+    void set_mode(eMode mode, double factor = 1.0)
+    {
+        mode_ = mode;
+        factor_ = mode == kScaled ? factor : 1.0;
+        resync();
+    }
+
+    //  Restart the relation between guest and host time from now
+    //  (after a pause, or if the host could not keep up)
+    void resync()
+    {
+        host_start_ = std::chrono::steady_clock::now();
+        guest_start_ = cycles_;
+    }
+
+    //  Sleeps until the host catches up with the guest
+    //  Meant to be called every few hundred guest microseconds, not per instruction
+    void throttle()
+    {
+        if (mode_ == kFast)
+            return;
+
+        auto guest_us = (cycles_ - guest_start_) / factor_;
+        auto target = host_start_ + std::chrono::microseconds((int64_t)guest_us);
+        auto now = std::chrono::steady_clock::now();
+        if (now < target)
+            std::this_thread::sleep_until(target);
+        else if (now - target > std::chrono::milliseconds(100))
+            resync(); //  Too late, don't try to catch up with a burst
+    }
+};
+
+void test_guest_clock_t();
@@ -0,0 +1,143 @@
+#include "cpu.hpp"
+
+//  Runs the bootstrap with the given core, count instructions at a time,
+//  until it stops on the first loaded byte (001-002, an unimplemented TLJ),
+//  after the deck status, the tape stop and the branch to P00-030
+static uint64_t run_bootstrap(memory_t &memory, io_t &io, cpu_t::eCore core, uint64_t count, std::string &error)
+{
+    memory.copy(
+        addrs_t("P01-000"),
+        vector_from_octal_pairs("201-030 170-007 231-002 341-230 111-003 170-016 170-005 100-030"));
+
+    cpu_t cpu(memory, io);
+    cpu.set_core(core);
+    cpu.reset();
+
+    uint64_t total = 0;
+    try
+    {
+        for (;;)
+        {
+            uint64_t executed;
+            auto reason = cpu.run(count, executed);
+            assert(reason == cpu_t::kStopBudget);
+            assert(executed == count);
+            total += executed;
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        error = e.what();
+    }
+    assert(count != 1 || total == 1 + 4 * 0200 + 3); //  LDX, 128 times the 4 instructions loop, status, stop, BRU
+
+    //  LDX, 128 times IOC STA CPX, 127 BRL taken and a last one not taken, status,
+    //  plus the wait for the first characters, after 30 inches of leader
+    assert(cpu.cycles() > 4 + 0200 * (4 + 6 + 4) + 0177 * 4 + 3 + 4 + 3 * guest_clock_t::kCyclesPerSecond);
+    assert(error == "Unimplemented instruction: TLJ 0 2");
+    assert(io.accumulator() == io_t::kStatusClipOut);
+    assert(!io.tape_reader(1).moving());
+    return cpu.cycles();
+}
+
+void load_polling_program(memory_t &memory)
+{
+    //  P01-002 CPX R#2 377 (low), IOC 207, BRU P01-012, BRL P01-002
+    //  P01-012 STA R#1+, CPX R#1 035, BRL P01-002
+    memory.copy(
+        addrs_t("P01-000"),
+        vector_from_octal_pairs("201-030 342-377 170-207 101-012 111-003 231-002 341-035 111-003"));
+}
+
+uint64_t run_polling_program(cpu_t &cpu, uint64_t count)
+{
+    uint64_t total = 0;
+    try
+    {
+        for (;;)
+        {
+            uint64_t executed;
+            cpu.run(count, executed);
+            total += executed;
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        if (std::string(e.what()) != "Unimplemented instruction: TLX 0") //  000-000 after the loop
+            throw;
+    }
+    return total;
+}
+
+//  Reads the 5 bytes of the tape in a polling loop (skip on busy)
+static void run_polling(memory_t &memory, io_t &io, cpu_t::eCore core, bool idle_skip, uint64_t count,
+                        uint64_t &cycles, uint64_t &total, uint64_t &skipped)
+{
+    load_polling_program(memory);
+
+    cpu_t cpu(memory, io);
+    cpu.set_core(core);
+    cpu.set_idle_skip(idle_skip);
+    cpu.reset();
+
+    total = run_polling_program(cpu, count);
+    cycles = cpu.cycles();
+    skipped = cpu.idle_skipped();
+}
+
+static void test_idle_skip()
+{
+    for (uint64_t count : {1, 7, 1000000})
+    {
+        memory_t reference_memory;
+        io_t reference_io;
+        uint64_t reference_cycles, reference_total, skipped;
+        run_polling(reference_memory, reference_io, cpu_t::kCoreSwitch, false, count, reference_cycles, reference_total, skipped);
+        assert(skipped == 0);
+        assert(reference_cycles > 3 * guest_clock_t::kCyclesPerSecond);
+        for (int i = 0; i != 5; i++)
+            assert(reference_memory[addrs_t(0, 030 + i)] == i + 1);
+
+        //  Same instructions, same time, but most of them skipped
+        for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreThreaded, cpu_t::kCoreJIT})
+        {
+            memory_t memory;
+            io_t io;
+            uint64_t cycles, total;
+            run_polling(memory, io, core, true, count, cycles, total, skipped);
+            assert(cycles == reference_cycles);
+            assert(total == reference_total);
+            assert(count < 1000 || skipped > total * 9 / 10); //  Small budgets leave little to skip
+            const memory_t &a = memory, &b = reference_memory;
+            for (size_t i = 0; i != 16384; i++)
+                assert(a[i] == b[i]);
+        }
+    }
+}
+
+void test_cpu_t()
+{
+    test_idle_skip();
+
+    memory_t reference_memory;
+    io_t reference_io;
+    std::string reference_error;
+    auto reference_cycles = run_bootstrap(reference_memory, reference_io, cpu_t::kCoreSwitch, 1, reference_error);
+
+    //  Other cores must end in the same state, whatever the run() granularity
+    for (auto core : {cpu_t::kCoreThreaded, cpu_t::kCoreJIT})
+    for (uint64_t count : {1, 7, 1000})
+    {
+        memory_t memory;
+        io_t io;
+        std::string error;
+        auto cycles = run_bootstrap(memory, io, core, count, error);
+
+        assert(cycles == reference_cycles);
+        assert(error == reference_error);
+        assert(io.accumulator() == reference_io.accumulator());
+        const memory_t &a = memory, &b = reference_memory;
+        for (size_t i = 0; i != 16384; i++)
+            assert(a[i] == b[i]);
+    }
+}
@@ -0,0 +1,895 @@
+#pragma once
+#include "utils.hpp"
+#include <cstdint>
+#include <string>
+#include <cassert>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <memory>
+#include <algorithm>
+#include <utility>
+
+#include "addrs.hpp"
+#include "iw.hpp"
+#include "disassembler.hpp"
+#include "memory.hpp"
+#include "decode_cache.hpp"
+#include "jit.hpp"
+#include "clock.hpp"
+#include "trace.hpp"
+#include "profile.hpp"
+
+#include "io.hpp"
+
+// stack==P00-040
+
+class cpu_t
+{
+    guest_clock_t clock_;
+    memory_t &memory_;
+    io_t &io_;
+    scheduler_t &scheduler_;
+    uint8_t sp_;
+
+    disassembler_t disassembler;
+    decode_cache_t decode_cache_;
+
+public:
+    //  Interpreter cores, selectable to benchmark and cross-check them
+    typedef enum
+    {
+        kCoreSwitch,   // execute() on each instruction
+        kCoreThreaded, // one dispatch per instruction through handler addresses
+        kCoreJIT,      // translated to x86-64 (see jit.hpp), threaded core if unavailable
+    } eCore;
+
+    //  Why run() returned
+    typedef enum
+    {
+        kStopBudget,    // executed the requested number of instructions
+        kStopRequested, // request_stop() was called (by a device, a debugger...)
+    } eStopReason;
+
+private:
+    eCore core_ = kCoreThreaded;
+    bool stop_requested_ = false;
+    bool idle_skip_ = true;
+    uint64_t idle_skipped_ = 0;
+    trace_buffer_t *trace_ = nullptr;
+    profile_t *profile_ = nullptr;
+    std::unique_ptr<jit_t> jit_; //  Created on first use of kCoreJIT
+
+    uint8_t sp() const { return sp_ & 0x1f; }
+
+    addrs_t sp_base( int stack ) const
+    {
+        return addrs_t(0, 040 + stack * 2);
+    }
+
+    addrs_t sp_addrs() const
+    {
+        return sp_base(sp());
+    }
+
+    //  Current instruction address
+    addrs_t iaw() const { return memory_.get_addrs(sp_addrs()); }
+    void set_iaw(const addrs_t addrs)
+    {
+        memory_.set_addrs(sp_addrs(), addrs);
+    }
+
+    addrs_t index_register_addrs( int reg) const
+    {
+        return addrs_t(0, reg );
+    }
+
+    //  Reads through the const memory: observers only hear about writes
+    uint8_t index_register(int reg) const
+    {
+        assert(reg >= 1 && reg <= 8);
+        return std::as_const(memory_)[index_register_addrs(reg)];
+    }
+
+    uint8_t &writable_index_register(int reg)
+    {
+        assert(reg >= 1 && reg <= 8);
+        return memory_[index_register_addrs(reg)];
+    }
+
+    //  Instruction semantics, shared by all interpreter cores
+    //  Branches return true and update pc if taken
+
+    void op_LDX(const decoded_iw_t &instr)
+    {
+        writable_index_register(instr.reg) = instr.literal();
+    }
+
+    //  Returns true if the next instruction must be skipped
+    bool op_IOC(const decoded_iw_t &instr)
+    {
+        for (;;)
+        {
+            switch (io_.execute(instr.iw(), clock_.cycles()))
+            {
+                case io_t::kIOCDone:
+                    return false;
+                case io_t::kIOCSkip:
+                    return true;
+                case io_t::kIOCWait:
+                    wait_for_event();
+                    break;
+            }
+        }
+    }
+
+    void op_STA_Ind(const decoded_iw_t &instr)
+    {
+        addrs_t addr{ instr.page, index_register(instr.reg) };
+        memory_[addr] = io_.accumulator();
+        if (instr.mode != iw_t::kUnchanged)
+            register_update(writable_index_register(instr.reg), instr.mode);
+    }
+
+    void op_CPX(const decoded_iw_t &instr)
+    {
+        compare( index_register(instr.reg), instr.literal());
+    }
+
+    bool op_BRU(const decoded_iw_t &instr, addrs_t &pc)
+    {
+        addrs_t target{ instr.target };
+        target.set_section(pc.section());
+        pc = target;
+        return true;
+    }
+
+    bool op_BRL(const decoded_iw_t &instr, addrs_t &pc)
+    {
+        if (compare_ != kLow)
+            return false;
+        return op_BRU(instr, pc);
+    }
+
+    [[noreturn]] void op_unknown(const decoded_iw_t &instr) const
+    {
+        throw std::runtime_error("Unknown instruction: " + instr.iw().as_octal());
+    }
+
+    [[noreturn]] void op_unimplemented(const decoded_iw_t &instr) const
+    {
+        throw std::runtime_error("Unimplemented instruction: " + disassembler.disassemble(instr.iw()));
+    }
+
+    //  Runs the device events that are due
+    //  Cores call it before an instruction when cycles() >= scheduler_.next_cycle()
+    void service_events()
+    {
+        scheduler_.run_until(clock_.cycles());
+    }
+
+    //  A device is not ready: skip guest time to the next event
+    void wait_for_event()
+    {
+        if (!scheduler_.device_pending())
+            throw std::runtime_error("CPU waits for a device, but no device event is pending");
+        if (scheduler_.next_cycle() > clock_.cycles())
+            clock_.advance(scheduler_.next_cycle() - clock_.cycles());
+        service_events();
+    }
+
+    //  What an iteration of an idle loop must leave unchanged (see idle_skip())
+    struct idle_state_t
+    {
+        uint16_t pc = 0xffff; //  Never a linear address
+        uint8_t sp = 0;
+        uint8_t compare = 0;
+        uint8_t accumulator = 0;
+        uint8_t registers[8] = {};
+        uint64_t side_effects = 0;
+        uint64_t events = 0;
+
+        bool operator==(const idle_state_t &) const = default;
+    };
+    idle_state_t idle_last_;
+
+    static const uint64_t kIdleLoopMax = 32; // instructions
+
+    idle_state_t idle_state(addrs_t pc) const
+    {
+        idle_state_t state;
+        state.pc = pc.linear();
+        state.sp = sp_;
+        state.compare = compare_;
+        state.accumulator = io_.accumulator();
+        for (int i = 1; i <= 8; i++)
+            state.registers[i - 1] = index_register(i);
+        state.side_effects = io_.side_effects();
+        state.events = scheduler_.dispatched();
+        return state;
+    }
+
+    //  Instructions that only change what idle_state_t covers
+    static bool idle_safe(iw_t::eInstructionType type)
+    {
+        switch (type)
+        {
+            case iw_t::kLDX:
+            case iw_t::kCPX:
+            case iw_t::kBRU:
+            case iw_t::kBRL:
+            case iw_t::kIOC: //  Polls, checked with io_t::side_effects()
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    uint64_t idle_skip(addrs_t pc, uint64_t remaining);
+
+    //  Index register an instruction writes, 0 if none
+    static uint8_t written_register(const decoded_iw_t &instr)
+    {
+        switch (instr.type)
+        {
+            case iw_t::kLDX:
+            case iw_t::kLIA:
+            case iw_t::kADX:
+            case iw_t::kSUX:
+                return instr.reg;
+            case iw_t::kLDA_Ind:
+            case iw_t::kSTA_Ind:
+            case iw_t::kADA_Ind:
+            case iw_t::kSUA_Ind:
+            case iw_t::kANA_Ind:
+            case iw_t::kERA_Ind:
+            case iw_t::kIRA_Ind:
+            case iw_t::kCPA_Ind:
+                return instr.mode != iw_t::kUnchanged ? instr.reg : 0;
+            default:
+                return 0;
+        }
+    }
+
+    //  After the execution of instr, that started at pc and cycles
+    void trace(const decoded_iw_t &instr, addrs_t pc, uint64_t cycles)
+    {
+        trace_record_t record;
+        record.cycle = cycles;
+        record.pc = pc.linear();
+        record.iwl = instr.iwl;
+        record.iwr = instr.iwr;
+        record.accumulator = io_.accumulator();
+        record.reg = written_register(instr);
+        record.reg_value = record.reg ? index_register(record.reg) : 0;
+        record.compare = compare_;
+        trace_->push(record);
+    }
+
+    //  After the execution of the instruction at pc, that took cycles (times in a row)
+    void profile(uint16_t pc, iw_t::eInstructionType type, uint64_t cycles, bool taken, uint64_t times = 1)
+    {
+        profile_->add(pc, type, cycles, taken, times);
+        if (sp() == 0)
+            return;
+
+        //  Callers on the IAW stack, then the instruction
+        uint16_t frames[profile_t::kMaxDepth + 1];
+        size_t depth = 0;
+        for (int level = 0; level < sp(); level++)
+            frames[depth++] = memory_.get_addrs(sp_base(level)).linear();
+        frames[depth++] = pc;
+        profile_->add_stack(frames, depth, cycles * times);
+    }
+
+    eStopReason run_switch(uint64_t count, uint64_t &executed);
+    template <bool kTracing, bool kProfiling>
+    eStopReason run_threaded(uint64_t count, uint64_t &executed);
+    eStopReason run_jit(uint64_t count, uint64_t &executed);
+
+    //  The instantiation for the current tracing and profiling
+    eStopReason run_threaded(uint64_t count, uint64_t &executed)
+    {
+        if (trace_)
+            return profile_ ? run_threaded<true, true>(count, executed) : run_threaded<true, false>(count, executed);
+        return profile_ ? run_threaded<false, true>(count, executed) : run_threaded<false, false>(count, executed);
+    }
+
+    eStopReason run_core(uint64_t count, uint64_t &executed)
+    {
+        executed = 0;
+        switch (core_)
+        {
+            case kCoreThreaded:
+                return run_threaded(count, executed);
+            case kCoreJIT:
+                return run_jit(count, executed);
+            default:
+                return run_switch(count, executed);
+        }
+    }
+
+public:
+    cpu_t(memory_t &mem, io_t &io_device) : memory_(mem), io_(io_device), scheduler_(io_device.scheduler()), decode_cache_(mem) {}
+
+    void reset()
+    {
+        sp_ = 0;
+        set_iaw(addrs_t(1, 0));
+        compare_ = kEqual;
+    }
+
+    void set_core(eCore core) { core_ = core; }
+    eCore core() const { return core_; }
+
+    //  Guest time, in microseconds since power on
+    guest_clock_t &clock() { return clock_; }
+    const guest_clock_t &clock() const { return clock_; }
+    uint64_t cycles() const { return clock_.cycles(); }
+
+    //  Registers outside memory, for snapshots (see snapshot.hpp)
+    struct state_t
+    {
+        uint8_t sp;
+        uint8_t compare;
+        uint64_t cycles;
+    };
+
+    state_t state() const { return {sp_, (uint8_t)compare_, clock_.cycles()}; }
+
+    //  Decoded and translated code follow memory on their own
+    void restore(const state_t &state)
+    {
+        sp_ = state.sp;
+        compare_ = (eCompareResult)state.compare;
+        clock_.counter() = state.cycles;
+        clock_.resync();
+        idle_last_ = idle_state_t{};
+        stop_requested_ = false;
+    }
+
+    //  Current instruction address and IAW stack level, between instructions
+    addrs_t pc() const { return iaw(); }
+    uint8_t stack_level() const { return sp(); }
+
+    //  Records each executed instruction in buffer (nullptr to stop tracing)
+    //  Translated code is not traced: kCoreJIT runs the threaded core meanwhile
+    void set_trace(trace_buffer_t *buffer) { trace_ = buffer; }
+    trace_buffer_t *tracing() const { return trace_; }
+
+    //  Counts executions and cycles per address and instruction type (nullptr to stop)
+    //  Like tracing, kCoreJIT runs the threaded core meanwhile
+    void set_profile(profile_t *profile) { profile_ = profile; }
+    profile_t *profiling() const { return profile_; }
+
+    //  Fast-forwards idle loops to the next device event (on by default)
+    //  Results are identical with and without it
+    void set_idle_skip(bool enabled) { idle_skip_ = enabled; }
+    bool idle_skip_enabled() const { return idle_skip_; }
+    uint64_t idle_skipped() const { return idle_skipped_; } // instructions not executed
+
+    //  Makes run() return after the current instruction
+    void request_stop() { stop_requested_ = true; }
+
+    //  Instructions executed between two host clock checks when throttled
+    //  (about a millisecond of guest time)
+    static constexpr uint64_t kThrottleSlice = 256;
+
+    //  Runs up to count instructions without returning
+    //  executed receives the number of instructions actually executed
+    //  Unless the clock runs in kFast mode, execution is paced to host time
+    eStopReason run(uint64_t count, uint64_t &executed)
+    {
+        executed = 0;
+        stop_requested_ = false;
+        if (!clock_.throttled())
+            return run_core(count, executed);
+
+        eStopReason reason = kStopBudget;
+        while (executed != count && reason == kStopBudget)
+        {
+            uint64_t slice;
+            reason = run_core(std::min(count - executed, kThrottleSlice), slice);
+            executed += slice;
+            clock_.throttle();
+        }
+        return reason;
+    }
+
+    eStopReason run(uint64_t count)
+    {
+        uint64_t executed;
+        return run(count, executed);
+    }
+
+    void step()
+    {
+        if (clock_.cycles() >= scheduler_.next_cycle())
+            service_events();
+
+        // Fetch the (pre-decoded) instruction at the current instruction address
+        addrs_t pc = iaw();
+        const decoded_iw_t &instr = decode_cache_.fetch(pc);
+        auto cycles = clock_.cycles();
+
+        bool taken = execute( instr );
+        if (!taken)
+        {
+            set_iaw(pc.next_instruction());
+            clock_.advance(instr.cycles);
+        }
+        else
+            clock_.advance(instr.taken_cycles);
+        if (trace_)
+            trace(instr, pc, cycles);
+        if (profile_)
+            profile(pc.linear(), instr.type, clock_.cycles() - cycles, taken);
+    };
+
+    void register_update(uint8_t &reg, iw_t::eIndexingMode mode)
+    {
+        switch (mode)
+        {
+            case iw_t::kIncrement:
+                reg++;
+                break;
+            case iw_t::kDecrement:
+                reg--;
+                break;
+            case iw_t::kUnchanged:
+                // Do nothing
+                break;
+        }
+    }
+
+    typedef enum
+    {
+        kLow,
+        kEqual,
+        kHigh
+    } eCompareResult;
+
+    eCompareResult compare_;
+
+    void compare( uint8_t v0, uint8_t v1)
+    {
+        if (v0 < v1)
+        {
+            compare_ = kLow;
+        }
+        else if (v0 == v1)
+        {
+            compare_ = kEqual;
+        }
+        else
+        {
+            compare_ = kHigh;
+        }
+    }
+
+    uint8_t section() const
+    {
+        return iaw().section();
+    }
+
+    bool execute(const iw_t &iw)
+    {
+        return execute(decoded_iw_t(iw));
+    }
+
+    bool execute(const decoded_iw_t &instr)
+    {
+        bool result = false; // We move to next instruction by default
+
+        switch (instr.type)
+        {
+            case iw_t::kLDX:
+                op_LDX(instr);
+                break;
+            case iw_t::kIOC:
+                if (op_IOC(instr))
+                {
+                    set_iaw(iaw().next_instruction().next_instruction());
+                    result = true;
+                }
+                break;
+            case iw_t::kSTA_Ind:
+                op_STA_Ind(instr);
+                break;
+            case iw_t::kCPX:
+                op_CPX(instr);
+                break;
+            case iw_t::kBRU:
+            {
+                addrs_t pc = iaw();
+                op_BRU(instr, pc);
+                set_iaw(pc);
+                result = true;
+                break;
+            }
+            case iw_t::kBRL:
+            {
+                addrs_t pc = iaw();
+                if (op_BRL(instr, pc))
+                {
+                    set_iaw(pc);
+                    result = true;
+                }
+                break;
+            }
+            case iw_t::kUnknown:
+                op_unknown(instr);
+            default:
+                op_unimplemented(instr);
+        }
+        return result;
+    }
+
+    void dump() const
+    {
+        std::cout << "CPU state:" << std::endl;
+        auto pc = iaw();
+        auto iw = memory_.get_instruction(pc);
+
+        std::cout << "  " << pc.as_string() << ": ";
+        std::cout << iw.as_octal() << "     ";
+        std::cout << disassembler.disassemble(iw) << std::endl;
+
+        std::cout << "  SP : ";
+        for (int i = 0; i < 8; ++i)
+        {
+            if (i==sp())
+                std::cout << "*";
+            std::cout << (sp_base(i)).as_string() << " ";
+        }
+        std::cout << std::endl;
+
+        std::cout << "  IAW: ";
+        for (int i = 0; i < 8; ++i)
+        {
+            if (i==sp())
+                std::cout << "*";
+            std::cout << memory_.get_addrs(sp_base(i)).as_string() << " ";
+        }
+        std::cout << std::endl;
+
+        std::cout << "   ACC R#1 R#2 R#3 R#4 R#5 R#6 R#7 R#8 ";
+        static const char *compare_str[] = {"L", "E", "H"};
+        std::cout << " CMP:" << compare_str[compare_] << std::endl;
+        std::cout << "   ";
+        std::cout << to_octal(io_.accumulator()) << " ";
+        for (int i = 1; i <= 8; ++i)
+            std::cout << to_octal(index_register(i)) << " ";
+        std::cout << std::endl;
+
+        memory_.dump( {0,030}, 16);
+    }
+};
+
+//  Idle loop fast-forward
+//
+//  Called by the cores before a polling IOC. If the machine is in the same
+//  state as the last time it was there, the program may be spinning: one
+//  more iteration is executed here, checking that it only contains
+//  instructions without side effects. If it comes back to the same state,
+//  every further iteration will do the same until a device event, so the
+//  clock is moved forward by as many whole iterations as fit before it.
+//
+//  Returns the number of instructions executed or skipped. If 0, nothing
+//  was done and the caller executes the IOC.
+inline uint64_t cpu_t::idle_skip(addrs_t pc, uint64_t remaining)
+{
+    auto state = idle_state(pc);
+    if (!(state == idle_last_))
+    {
+        idle_last_ = state;
+        return 0;
+    }
+    idle_last_ = idle_state_t{};
+
+    //  Verification iteration, stops as soon as something is not idle
+    auto start = clock_.cycles();
+    uint64_t executed = 0;
+    addrs_t current = pc;
+    struct
+    {
+        uint16_t pc;
+        iw_t::eInstructionType type;
+        uint64_t cycles;
+        bool taken;
+    } profiled[kIdleLoopMax]; //  The iteration, for the skipped ones
+    do
+    {
+        if (executed == remaining || executed == kIdleLoopMax || clock_.cycles() >= scheduler_.next_cycle())
+            return executed;
+        const decoded_iw_t &instr = decode_cache_.fetch(current);
+        if (!idle_safe(instr.type))
+            return executed;
+        auto cycles = clock_.cycles();
+        bool taken = execute(instr);
+        if (!taken)
+        {
+            set_iaw(current.next_instruction());
+            clock_.advance(instr.cycles);
+        }
+        else
+            clock_.advance(instr.taken_cycles);
+        if (trace_)
+            trace(instr, current, cycles);
+        if (profile_)
+        {
+            profiled[executed] = {current.linear(), instr.type, clock_.cycles() - cycles, taken};
+            profile(current.linear(), instr.type, clock_.cycles() - cycles, taken);
+        }
+        executed++;
+        current = iaw();
+    } while (!(current == pc));
+
+    if (!(idle_state(pc) == state) || executed == remaining)
+        return executed;
+
+    //  Whole iterations before the next event, within the budget
+    auto period = clock_.cycles() - start;
+    auto iterations = (scheduler_.next_cycle() - clock_.cycles()) / period;
+    iterations = std::min(iterations, (remaining - executed) / executed);
+    clock_.advance(iterations * period);
+    idle_skipped_ += iterations * executed;
+    if (profile_ && iterations)
+        for (uint64_t i = 0; i != executed; i++)
+            profile(profiled[i].pc, profiled[i].type, profiled[i].cycles, profiled[i].taken, iterations);
+    return executed + iterations * executed;
+}
+
+//  Reference core: one execute() (and one switch) per instruction
+inline cpu_t::eStopReason cpu_t::run_switch(uint64_t count, uint64_t &executed)
+{
+    while (executed != count)
+    {
+        if (clock_.cycles() >= scheduler_.next_cycle())
+            service_events();
+        addrs_t pc = iaw();
+        const decoded_iw_t &instr = decode_cache_.fetch(pc);
+        if (instr.type == iw_t::kIOC && idle_skip_)
+        {
+            if (auto skipped = idle_skip(pc, count - executed))
+            {
+                executed += skipped;
+                if (stop_requested_)
+                    return kStopRequested;
+                continue;
+            }
+        }
+        executed++;
+        auto cycles = clock_.cycles();
+        bool taken = execute(instr);
+        if (!taken)
+        {
+            set_iaw(pc.next_instruction());
+            clock_.advance(instr.cycles);
+        }
+        else
+            clock_.advance(instr.taken_cycles);
+        if (trace_)
+            trace(instr, pc, cycles);
+        if (profile_)
+            profile(pc.linear(), instr.type, clock_.cycles() - cycles, taken);
+        if (stop_requested_)
+            return kStopRequested;
+    }
+    return kStopBudget;
+}
+
+//  Threaded core: the current instruction address is kept in a local,
+//  and each handler jumps directly to the handler of the next instruction.
+//  Uses GCC/clang labels as values, with a switch fallback elsewhere.
+//  Instantiated with and without the tracing and profiling code.
+template <bool kTracing, bool kProfiling>
+inline cpu_t::eStopReason cpu_t::run_threaded(uint64_t count, uint64_t &executed)
+{
+    addrs_t pc = iaw();
+    const decoded_iw_t *instr;
+    uint64_t remaining = count;
+    [[maybe_unused]] addrs_t start_pc = pc;
+    [[maybe_unused]] uint64_t start_cycles = 0;
+
+#if defined(__GNUC__)
+    void *handlers[iw_t::kInstructionTypeCount];
+    for (auto &handler : handlers)
+        handler = &&unimplemented;
+    handlers[iw_t::kUnknown] = &&unknown;
+    handlers[iw_t::kLDX] = &&LDX;
+    handlers[iw_t::kIOC] = &&IOC;
+    handlers[iw_t::kSTA_Ind] = &&STA_Ind;
+    handlers[iw_t::kCPX] = &&CPX;
+    handlers[iw_t::kBRU] = &&BRU;
+    handlers[iw_t::kBRL] = &&BRL;
+
+#define ICL_DISPATCH() goto *handlers[instr->type]
+#define ICL_HANDLER(name) name:
+#else
+#define ICL_DISPATCH() goto dispatch
+#define ICL_HANDLER(name) case iw_t::k##name:
+#endif
+
+//  Each handler ends with one of those
+#define ICL_NEXT()                         \
+    pc = pc.next_instruction();            \
+    clock_.advance(instr->cycles);         \
+    ICL_CONTINUE(false)
+#define ICL_JUMP()                         \
+    clock_.advance(instr->taken_cycles);   \
+    ICL_CONTINUE(true)
+#define ICL_CONTINUE(taken)                \
+    if constexpr (kTracing)                \
+        trace(*instr, start_pc, start_cycles); \
+    if constexpr (kProfiling)              \
+        profile(start_pc.linear(), instr->type, clock_.cycles() - start_cycles, taken); \
+    set_iaw(pc);                           \
+    if (--remaining == 0 || stop_requested_) \
+        goto done;                         \
+    if (clock_.cycles() >= scheduler_.next_cycle()) \
+        service_events();                  \
+    ICL_FETCH();                           \
+    ICL_DISPATCH()
+#define ICL_FETCH()                        \
+    instr = &decode_cache_.fetch(pc);      \
+    if constexpr (kTracing || kProfiling)  \
+    {                                      \
+        start_pc = pc;                     \
+        start_cycles = clock_.cycles();    \
+    }
+
+    if (remaining == 0)
+        goto done;
+    if (clock_.cycles() >= scheduler_.next_cycle())
+        service_events();
+    ICL_FETCH();
+
+#if defined(__GNUC__)
+    ICL_DISPATCH();
+    {
+#else
+dispatch:
+    switch (instr->type)
+    {
+#endif
+    ICL_HANDLER(LDX)
+        op_LDX(*instr);
+        ICL_NEXT();
+
+    ICL_HANDLER(IOC)
+        if (idle_skip_)
+        {
+            if (auto skipped = idle_skip(pc, remaining))
+            {
+                remaining -= skipped;
+                pc = iaw();
+                if (remaining == 0 || stop_requested_)
+                    goto done;
+                if (clock_.cycles() >= scheduler_.next_cycle())
+                    service_events();
+                ICL_FETCH();
+                ICL_DISPATCH();
+            }
+        }
+        if (op_IOC(*instr))
+        {
+            pc = pc.next_instruction().next_instruction();
+            ICL_JUMP(); //  Skips the next instruction, like execute()
+        }
+        ICL_NEXT();
+
+    ICL_HANDLER(STA_Ind)
+        op_STA_Ind(*instr);
+        ICL_NEXT(); //  Like execute(), a store to the current IAW is overwritten
+
+    ICL_HANDLER(CPX)
+        op_CPX(*instr);
+        ICL_NEXT();
+
+    ICL_HANDLER(BRU)
+        op_BRU(*instr, pc);
+        ICL_JUMP();
+
+    ICL_HANDLER(BRL)
+        if (op_BRL(*instr, pc))
+        {
+            ICL_JUMP();
+        }
+        ICL_NEXT();
+
+#if defined(__GNUC__)
+    unknown:
+        op_unknown(*instr);
+    unimplemented:
+        op_unimplemented(*instr);
+    }
+#else
+    case iw_t::kUnknown:
+        op_unknown(*instr);
+    default:
+        op_unimplemented(*instr);
+    }
+#endif
+
+#undef ICL_NEXT
+#undef ICL_JUMP
+#undef ICL_CONTINUE
+#undef ICL_FETCH
+#undef ICL_HANDLER
+#undef ICL_DISPATCH
+
+done:
+    executed = count - remaining;
+    return stop_requested_ ? kStopRequested : kStopBudget;
+}
+
+//  JIT dispatcher: runs translated blocks, and interprets what the translator left out
+inline cpu_t::eStopReason cpu_t::run_jit(uint64_t count, uint64_t &executed)
+{
+    if (!jit_)
+        jit_ = std::make_unique<jit_t>(memory_);
+    if (!jit_->available() || trace_ || profile_)
+        return run_threaded(count, executed);
+
+    jit_context_t ctx;
+    ctx.stop = &stop_requested_;
+
+    uint64_t remaining = count;
+    while (remaining != 0 && !stop_requested_)
+    {
+        if (clock_.cycles() >= scheduler_.next_cycle())
+            service_events();
+        addrs_t pc = iaw();
+        const jit_block_t &block = jit_->block(pc);
+        //  Blocks only run if no event is due before their last instruction
+        if (!block.entry || block.length > remaining ||
+            clock_.cycles() + block.lead_cycles >= scheduler_.next_cycle())
+        {
+            const decoded_iw_t &instr = decode_cache_.fetch(pc);
+            if (instr.type == iw_t::kIOC && idle_skip_)
+            {
+                if (auto skipped = idle_skip(pc, remaining))
+                {
+                    remaining -= skipped;
+                    continue;
+                }
+            }
+            remaining--;
+            if (!execute(instr))
+            {
+                set_iaw(pc.next_instruction());
+                clock_.advance(instr.cycles);
+            }
+            else
+                clock_.advance(instr.taken_cycles);
+            continue;
+        }
+
+        ctx.budget = remaining;
+        ctx.cycles = clock_.cycles();
+        ctx.next_event = scheduler_.next_cycle();
+        ctx.compare = compare_;
+        ctx.accumulator = io_.accumulator();
+        uint16_t next = jit_->enter(block, ctx);
+        remaining = ctx.budget;
+        clock_.advance(ctx.cycles - clock_.cycles());
+        compare_ = (eCompareResult)ctx.compare;
+        set_iaw(addrs_t(next));
+
+        if (ctx.last_exit)
+            jit_->chain(ctx, jit_->block(addrs_t(next)));
+    }
+    executed = count - remaining;
+    return stop_requested_ ? kStopRequested : kStopBudget;
+}
+
+//  The polling program of the tests: reads the 5 bytes of the tape into
+//  P00-030 to P00-034, skipping on busy, then stops on the TLX 0 that follows
+void load_polling_program(memory_t &memory);
+
+//  Runs cpu until the polling program stops, count instructions at a time
+//  Returns the instructions executed; other errors are thrown
+uint64_t run_polling_program(cpu_t &cpu, uint64_t count = 1000);
+
+void test_cpu_t();
@@ -0,0 +1,37 @@
+#include "decode_cache.hpp"
+
+void test_decode_cache_t()
+{
+    memory_t mem;
+    mem.copy(addrs_t("P01-000"), vector_from_octal_pairs("201-030 341-230"));
+
+    decode_cache_t cache(mem);
+
+    //  Fields are extracted once
+    auto &ldx = cache.fetch(addrs_t("P01-000"));
+    assert(ldx.type == iw_t::kLDX);
+    assert(ldx.reg == 1);
+    assert(ldx.literal() == 030);
+    assert(cache.misses() == 1);
+
+    //  Second fetch is served from the cache
+    cache.fetch(addrs_t("P01-000"));
+    assert(cache.misses() == 1);
+
+    //  Writing any byte of the slot drops the decoded instruction
+    mem[addrs_t("P01-001")] = 040;
+    assert(cache.fetch(addrs_t("P01-000")).literal() == 040);
+    assert(cache.misses() == 2);
+
+    mem.set_instruction(addrs_t("P01-000"), iw_t(0341, 0230));
+    assert(cache.fetch(addrs_t("P01-000")).type == iw_t::kCPX);
+
+    //  Neighbour slots are untouched
+    assert(cache.fetch(addrs_t("P01-002")).type == iw_t::kCPX);
+    assert(cache.misses() == 4);
+    cache.fetch(addrs_t("P01-002"));
+    assert(cache.misses() == 4);
+
+    //  Odd addresses are decoded each time
+    assert(cache.fetch(addrs_t("P01-001")).iwl == 0230);
+}
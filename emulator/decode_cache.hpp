@@ -0,0 +1,113 @@
+#pragma once
+
+#include <cstdint>
+#include <cassert>
+
+#include "addrs.hpp"
+#include "iw.hpp"
+#include "memory.hpp"
+#include "clock.hpp"
+
+/**
+ * An instruction word with its operand fields already extracted.
+ * This is what the interpreter executes, so the decoding work
+ * (instr_map lookup, field masks and shifts) is done once per slot.
+ */
+class decoded_iw_t
+{
+public:
+    iw_t::eInstructionType type = iw_t::kUnknown; // handler
+    uint8_t iwl = 0;
+    uint8_t iwr = 0;
+    uint8_t reg = 0;       // indexing_register()
+    uint8_t page = 0;      // page_number()
+    uint16_t target = 0;   // address(), section 0
+    iw_t::eIndexingMode mode = iw_t::kUnchanged;
+    uint8_t cycles = 0;        // instruction_timings, not taken
+    uint8_t taken_cycles = 0;  // instruction_timings, taken
+    bool valid = false;
+
+    decoded_iw_t() = default;
+
+    explicit decoded_iw_t(const iw_t &iw)
+        : type(iw_t::instr_map()[iw.as_word()]),
+          iwl(iw.iwl()),
+          iwr(iw.iwr()),
+          reg(iw.indexing_register()),
+          page(iw.page_number()),
+          target(iw.address().linear()),
+          mode(iw.indexing_mode()),
+          cycles(instruction_timings[type].not_taken),
+          taken_cycles(instruction_timings[type].taken),
+          valid(true)
+    {
+    }
+
+    iw_t iw() const { return iw_t(iwl, iwr); }
+    uint8_t literal() const { return iwr; }
+};
+
+/**
+ * Decoded instructions, one per 2-byte slot of memory, keyed by linear address.
+ * Registers itself as a memory observer: any write to a byte of a slot drops it.
+ * Only pages that contain decoded instructions are watched.
+ */
+class decode_cache_t : public memory_observer_t
+{
+    static const size_t kSlots = 16384 / 2;
+
+    memory_t &memory_;
+    decoded_iw_t slots_[kSlots];
+    decoded_iw_t unaligned_; //  Instructions at odd addresses are not cached
+
+    uint64_t misses_ = 0;
+
+public:
+    decode_cache_t(memory_t &memory) : memory_(memory)
+    {
+        memory_.add_observer(this);
+    }
+
+    ~decode_cache_t()
+    {
+        memory_.remove_observer(this);
+    }
+
+    decode_cache_t(const decode_cache_t &) = delete;
+    decode_cache_t &operator=(const decode_cache_t &) = delete;
+
+    const decoded_iw_t &fetch(const addrs_t pc)
+    {
+        auto linear = pc.linear();
+        if (linear & 1)
+        {
+            unaligned_ = decoded_iw_t(memory_.get_instruction(pc));
+            return unaligned_;
+        }
+
+        auto &slot = slots_[linear >> 1];
+        if (!slot.valid)
+        {
+            misses_++;
+            memory_.watch_page(pc.page());
+            slot = decoded_iw_t(memory_.get_instruction(pc));
+        }
+        return slot;
+    }
+
+    void will_write(uint16_t linear) override
+    {
+        assert(linear < 16384);
+        slots_[linear >> 1].valid = false;
+    }
+
+    void invalidate()
+    {
+        for (auto &slot : slots_)
+            slot.valid = false;
+    }
+
+    uint64_t misses() const { return misses_; }
+};
+
+void test_decode_cache_t();
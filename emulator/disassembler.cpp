@@ -1,21 +1,21 @@
 #include "disassembler.hpp"
 #include "utils.hpp"
+#include "memory.hpp"
 
-const std::string disassembler_t::mnemonic(const iw_t& instruction) const
+#include <cassert>
+#include <cstring>
+
+std::string_view disassembler_t::mnemonic(const iw_t& instruction) const
 {
-    auto map = iw_t::instr_map();
-    auto instr = map[instruction.as_word()];
-    // std::cout << std::bitset<8>(iwl) << " " << std::bitset<8>(iwr) << " -> "
-    //           << std::bitset<16>(((int)iwl) << 8 | iwr) << std::endl;
-    // std::cout << (int)instr << std::endl;
-    // std::cout << (int)iw_t::kLDX << std::endl;
+    auto instr = iw_t::instr_map()[instruction.as_word()];
     return iw_t::types()[(int)instr].mnemonic;
 }
 
 const std::string disassembler_t::disassemble(const iw_t& instruction) const
 {
-    std::string result = mnemonic(instruction);
-    auto decode = iw_t::types()[(int)iw_t::instr_map()[instruction.as_word()]].decode;
+    auto &def = iw_t::types()[(int)iw_t::instr_map()[instruction.as_word()]];
+    std::string result{def.mnemonic};
+    auto decode = def.decode;
 
     if (decode & iw_t::kDECODE_SHIFT)
     {
@@ -85,7 +85,10 @@ const std::string disassembler_t::disassemble(const iw_t& instruction) const
 
     if (decode & iw_t::kDECODE_IOC)
     {
-        result += " ; " + instruction.describe_ioc_channel() + " " + instruction.describe_ioc_function_code();
+        result += " ; ";
+        result += instruction.describe_ioc_channel();
+        result += " ";
+        result += instruction.describe_ioc_function_code();
     }
 
     if (decode & iw_t::kDECODE_UV)
@@ -100,3 +103,273 @@ const std::string disassembler_t::disassemble(const iw_t& instruction) const
 
     return result;
 }
+
+namespace
+{
+    //  Appends to a buffer known to be large enough
+    class text_writer_t
+    {
+        char *p_;
+
+    public:
+        text_writer_t(char *p) : p_(p) {}
+
+        char *end() const { return p_; }
+
+        void put(char c) { *p_++ = c; }
+        void put(std::string_view s)
+        {
+            for (auto c : s)
+                *p_++ = c;
+        }
+
+        void decimal(int v)
+        {
+            if (v < 0)
+            {
+                put('-');
+                v = -v;
+            }
+            char digits[4];
+            int n = 0;
+            do
+            {
+                digits[n++] = '0' + v % 10;
+                v /= 10;
+            } while (v);
+            while (n)
+                put(digits[--n]);
+        }
+
+        //  Same as to_octal(v, width): at least width digits
+        void octal(uint8_t v, int width)
+        {
+            int n = v >= 0100 ? 3 : v >= 010 ? 2 : 1;
+            for (int i = n; i < width; i++)
+                put('0');
+            for (int i = n - 1; i >= 0; i--)
+                put('0' + ((v >> (3 * i)) & 7));
+        }
+
+        void bits(uint8_t v)
+        {
+            for (int i = 7; i >= 0; i--)
+                put((v >> i) & 1 ? '1' : '0');
+        }
+
+        //  Same as iw_t::register_name()
+        void reg(char prefix, uint8_t reg)
+        {
+            if (reg >= 8)
+            {
+                put("R?");
+                return;
+            }
+            if (prefix)
+                put(prefix);
+            put('#');
+            put('0' + reg);
+        }
+
+        void address(addrs_t adrs)
+        {
+            put('P');
+            octal(adrs.page(), 2);
+            put('-');
+            octal(adrs.location(), 3);
+        }
+    };
+}
+
+size_t disassembler_t::disassemble(const iw_t& instruction, char *buffer) const
+{
+    auto &def = iw_t::types()[(int)iw_t::instr_map()[instruction.as_word()]];
+    auto decode = def.decode;
+    text_writer_t out(buffer);
+    out.put(def.mnemonic);
+
+    if (decode & iw_t::kDECODE_SHIFT)
+    {
+        out.put(' ');
+        out.decimal(instruction.shift_count());
+    }
+
+    if (decode & iw_t::kDECODE_JUMP)
+    {
+        out.put(' ');
+        out.decimal(instruction.signed_jump_count());
+    }
+
+    if (decode & iw_t::kDECODE_INDEX_REGISTER)
+    {
+        out.put(' ');
+        out.reg('R', instruction.indexing_register());
+    }
+
+    if (decode & iw_t::kDECODE_SECTION_LEVEL)
+    {
+        out.put(" P");
+        out.decimal(instruction.section2());
+        out.decimal(instruction.level());
+    }
+
+    if (decode & iw_t::kDECODE_INDEX_REGISTER_OP)
+    {
+        static const char prefix[] = {'R', 0, 'I', 'D'}; //  By eIndexingMode, 01 has none
+        out.put(' ');
+        out.reg(prefix[instruction.indexing_mode()], instruction.indexing_register());
+    }
+
+    if (decode & iw_t::kDECODE_PAGE_NUMBER)
+    {
+        out.put(" P");
+        out.octal(instruction.page_number(), 2);
+    }
+
+    if (decode & iw_t::kDECODE_ADRS_LEVEL_BYTE)
+    {
+        auto a = instruction.address();
+        out.put(" P");
+        out.octal(a.page(), 1);
+        out.put('-');
+        out.octal(a.location(), 3);
+    }
+
+    if (decode & iw_t::kDECODE_IOC_CHANNEL)
+    {
+        out.put(" C#");
+        out.decimal(instruction.ioc_channel());
+    }
+
+    if (decode & iw_t::kDECODE_SECTION)
+    {
+        out.put(" S#");
+        out.decimal(instruction.section1());
+    }
+
+    if (decode & iw_t::kDECODE_LITERAL)
+    {
+        out.put(' ');
+        out.decimal(instruction.literal());
+    }
+
+    if (decode & iw_t::kDECODE_OLITERAL)
+    {
+        out.put(' ');
+        out.octal(instruction.literal(), 3);
+    }
+
+    if (decode & iw_t::kDECODE_BLITERAL)
+    {
+        out.put(' ');
+        out.bits(instruction.literal());
+    }
+
+    if (decode & iw_t::kDECODE_MASK)
+    {
+        out.put(' ');
+        out.bits(instruction.literal());
+    }
+
+    if (decode & iw_t::kDECODE_IOC)
+    {
+        out.put(" ; ");
+        out.put(instruction.describe_ioc_channel());
+        out.put(' ');
+        out.put(instruction.describe_ioc_function_code());
+    }
+
+    if (decode & iw_t::kDECODE_UV)
+    {
+        out.put(' ');
+        out.put(instruction.set_u() ? "+U" : "-U");
+        out.put(instruction.set_v() ? "+V" : "-V");
+    }
+
+    if (decode & iw_t::kDECODE_ADRS_BYTE)
+    {
+        out.put(" P-");
+        out.octal(instruction.literal(), 3);
+    }
+
+    return out.end() - buffer;
+}
+
+size_t disassembler_t::listing_line(addrs_t adrs, const iw_t& instruction, char *buffer) const
+{
+    text_writer_t out(buffer);
+    out.address(adrs);
+    out.put(": ");
+    out.octal(instruction.iwl(), 3);
+    out.put('-');
+    out.octal(instruction.iwr(), 3);
+    out.put("      ");
+    char *end = out.end();
+    end += disassemble(instruction, end);
+    *end++ = '\n';
+    return end - buffer;
+}
+
+size_t disassembler_t::listing(addrs_t adrs, std::span<const uint8_t> bytes, char *buffer, size_t size, size_t &consumed) const
+{
+    size_t length = 0;
+    consumed = 0;
+    while (consumed + 2 <= bytes.size() && length + kMaxLineLength <= size)
+    {
+        length += listing_line(adrs, iw_t(bytes[consumed], bytes[consumed + 1]), buffer + length);
+        adrs = adrs.next_instruction();
+        consumed += 2;
+    }
+    return length;
+}
+
+void test_disassembler_t()
+{
+    disassembler_t disassembler;
+
+    //  Identical to disassemble(), for every instruction word
+    char buffer[disassembler_t::kMaxLength];
+    for (uint32_t word = 0; word != 65536; word++)
+    {
+        iw_t iw(word >> 8, word & 0xff);
+        auto expected = disassembler.disassemble(iw);
+        auto length = disassembler.disassemble(iw, buffer);
+        assert(length <= disassembler_t::kMaxLength);
+        assert(std::string_view(buffer, length) == expected);
+    }
+
+    //  A whole memory image, through the streaming listing
+    memory_t memory;
+    for (size_t i = 0; i != 16384; i++)
+        memory[i] = (i * 37 + (i >> 7)) & 0xff;
+
+    std::string expected;
+    addrs_t adrs(0, 0);
+    for (size_t i = 0; i != 8192; i++)
+    {
+        iw_t w = memory.get_instruction(adrs);
+        expected += adrs.as_string() + ": " + w.as_octal() + "      " + disassembler.disassemble(w) + "\n";
+        adrs = adrs.next_instruction();
+    }
+
+    std::string text;
+    size_t chunks = 0;
+    disassembler.listing(memory, addrs_t(0, 0), 8192, [&](std::string_view chunk)
+                         { text += chunk; chunks++; });
+    assert(text == expected);
+    assert(chunks > 1);
+
+    //  Odd start, wrapping at the end of memory
+    expected.clear();
+    adrs = addrs_t("P77-375");
+    for (size_t i = 0; i != 3; i++)
+    {
+        iw_t w = memory.get_instruction(adrs);
+        expected += adrs.as_string() + ": " + w.as_octal() + "      " + disassembler.disassemble(w) + "\n";
+        adrs = adrs.next_instruction();
+    }
+    text.clear();
+    disassembler.listing(memory, addrs_t("P77-375"), 3, [&](std::string_view chunk)
+                         { text += chunk; });
+    assert(text == expected);
+}
@@ -1,10 +1,79 @@
 #pragma once
 #include <string>
 #include <bitset>
+#include <string_view>
+#include <span>
+#include <cstdint>
 #include "iw.hpp"
+#include "addrs.hpp"
+
+class memory_t;
 
 class disassembler_t {
 public:
-    const std::string mnemonic(const iw_t& instruction) const;
+    //  Longest text of disassemble()
+    static const size_t kMaxLength = 80;
+
+    //  Longest listing line: "P01-000: 005-017      TLJ -4 15\n"
+    static const size_t kMaxLineLength = 7 + 2 + 7 + 6 + kMaxLength + 1;
+
+    std::string_view mnemonic(const iw_t& instruction) const;
     const std::string disassemble(const iw_t& instruction) const;
+
+    //  Same text as disassemble(), into buffer (kMaxLength bytes at least)
+    //  Does not allocate, returns the length (no terminating nul)
+    size_t disassemble(const iw_t& instruction, char *buffer) const;
+
+    //  One listing line into buffer (kMaxLineLength bytes at least), returns the length
+    size_t listing_line(addrs_t adrs, const iw_t& instruction, char *buffer) const;
+
+    //  Listing of the instruction words in bytes (which start at adrs), into buffer
+    //  Stops before a line that would not fit: returns the length, and in
+    //  consumed the number of bytes disassembled
+    size_t listing(addrs_t adrs, std::span<const uint8_t> bytes, char *buffer, size_t size, size_t &consumed) const;
+
+    //  Same, streamed: sink(std::string_view) receives the text in chunks
+    //  of a few kilobytes, from a buffer on the stack
+    template <typename Sink>
+    void listing(addrs_t adrs, std::span<const uint8_t> bytes, Sink &&sink) const
+    {
+        char buffer[16384];
+        while (bytes.size() >= 2)
+        {
+            size_t consumed;
+            auto length = listing(adrs, bytes, buffer, sizeof(buffer), consumed);
+            sink(std::string_view(buffer, length));
+            adrs = adrs + consumed;
+            bytes = bytes.subspan(consumed);
+        }
+    }
+
+    //  count instruction words of memory, from adrs
+    template <typename Sink>
+    void listing(const memory_t &memory, addrs_t adrs, size_t count, Sink &&sink) const;
 };
+
+#include "memory.hpp"
+
+template <typename Sink>
+void disassembler_t::listing(const memory_t &memory, addrs_t adrs, size_t count, Sink &&sink) const
+{
+    //  Contiguous up to the end of memory, then wraps to P00-000 like addrs_t
+    while (count != 0)
+    {
+        size_t words = std::min<size_t>(count, (16384 - adrs.linear()) / 2);
+        if (words == 0) //  An odd address ending memory, the word wraps
+        {
+            char line[kMaxLineLength];
+            sink(std::string_view(line, listing_line(adrs, memory.get_instruction(adrs), line)));
+            adrs = adrs.next_instruction();
+            count--;
+            continue;
+        }
+        listing(adrs, std::span<const uint8_t>(memory.bytes() + adrs.linear(), words * 2), sink);
+        adrs = adrs + words * 2;
+        count -= words;
+    }
+}
+
+void test_disassembler_t();
@@ -14,219 +14,21 @@
 #include "iw.hpp"
 #include "disassembler.hpp"
 #include "memory.hpp"
+#include "decode_cache.hpp"
+#include "cpu.hpp"
+#include "cfg.hpp"
+#include "sampler.hpp"
+#include "snapshot.hpp"
+#include "time_travel.hpp"
+#include "input_log.hpp"
+#include "record_index.hpp"
+#include "tape_library.hpp"
+#include "tape_decoder.hpp"
+#include "tape_encoder.hpp"
+#include "wav.hpp"
 
 #include "io.hpp"
 
-// stack==P00-040
-
-// class clock_t
-// {
-//     uint64_t cycles;
-// };
-
-class cpu_t
-{
-    // clock_t clock;
-    memory_t &memory_;
-    io_t &io_;
-    uint8_t sp_;
-
-    disassembler_t disassembler;
-
-    uint8_t sp() const { return sp_ & 0x1f; }
-
-    addrs_t sp_base( int stack ) const
-    {
-        return addrs_t(0, 040 + stack * 2); 
-    }
-
-    addrs_t sp_addrs() const
-    {
-        return sp_base(sp());
-    }
-
-    //  Current instruction address
-    addrs_t iaw() const { return memory_.get_addrs(sp_addrs()); }
-    void set_iaw(const addrs_t addrs)
-    {
-        memory_.set_addrs(sp_addrs(), addrs);
-    }
-
-    addrs_t index_register_addrs( int reg) const
-    {
-        return addrs_t(0, reg );
-    }
-
-    uint8_t &index_register(int reg)
-    {
-        assert(reg >= 1 && reg <= 8);
-        return memory_[index_register_addrs(reg)];
-    }
-
-    const uint8_t &index_register(int reg) const
-    {
-        assert(reg >= 1 && reg <= 8);
-        return memory_[index_register_addrs(reg)];
-    }
-
-    
-public:
-    cpu_t(memory_t &mem, io_t &io_device) : memory_(mem), io_(io_device) {}
-
-    void reset()
-    {
-        sp_ = 0;
-        set_iaw(addrs_t(1, 0));
-        compare_ = kEqual;
-    }
-
-    void step()
-    {
-        dump();
-
-        // Fetch the instruction at the current instruction address
-        addrs_t pc = iaw();
-        iw_t iw = memory_.get_instruction(pc);
-
-        if (!execute( iw ))
-        {
-            pc = pc.next_instruction();
-            set_iaw(pc);
-        }
-    };
-
-    void register_update(uint8_t &reg, iw_t::eIndexingMode mode)
-    {
-        switch (mode)
-        {
-            case iw_t::kIncrement:
-                reg++;
-                break;
-            case iw_t::kDecrement:
-                reg--;
-                break;
-            case iw_t::kUnchanged:
-                // Do nothing
-                break;
-        }
-    }
-
-    typedef enum
-    {
-        kLow,
-        kEqual,
-        kHigh
-    } eCompareResult;
-
-    eCompareResult compare_;
-
-    void compare( uint8_t v0, uint8_t v1)
-    {
-        if (v0 < v1)
-        {
-            compare_ = kLow;
-        }
-        else if (v0 == v1)
-        {
-            compare_ = kEqual;
-        }
-        else
-        {
-            compare_ = kHigh;
-        }
-    }
-
-    uint8_t section() const
-    {
-        return iaw().section();
-    }
-
-    bool execute(const iw_t &iw)
-    {
-        bool result = false; // We move to next instruction by default
-
-        // Decode the instruction and execute it
-        auto instr_type = iw_t::instr_map()[iw.as_word()];
-
-        switch (instr_type)
-        {
-            case iw_t::kLDX:
-                index_register(iw.indexing_register()) = iw.literal();
-                break;
-            case iw_t::kIOC:
-                io_.execute(iw);
-                break;
-            case iw_t::kSTA_Ind:
-            {
-                addrs_t addr{ iw.page_number(), index_register(iw.indexing_register()) };
-                memory_[addr] = io_.accumulator();
-                register_update(index_register(iw.indexing_register()), iw.indexing_mode());
-                break;
-            }
-            case iw_t::kCPX:
-                compare( index_register(iw.indexing_register()), iw.literal());
-                break;
-            case iw_t::kBRL:
-            {
-                addrs_t target = iw.address();
-                target.set_section(section());
-                if (compare_==kLow)
-                {
-                    set_iaw(target);
-                    result = true;
-                }
-                break;
-            }
-            case iw_t::kUnknown:
-                throw std::runtime_error("Unknown instruction: " + iw.as_octal());
-            default:
-                disassembler_t disassembler;
-                throw std::runtime_error("Unimplemented instruction: " + disassembler.disassemble(iw));
-        }
-        return result;
-    }
-
-    void dump() const
-    {
-        std::cout << "CPU state:" << std::endl;
-        auto pc = iaw();
-        auto iw = memory_.get_instruction(pc);
-
-        std::cout << "  " << pc.as_string() << ": ";
-        std::cout << iw.as_octal() << "     ";
-        std::cout << disassembler.disassemble(iw) << std::endl;
-
-        std::cout << "  SP : ";
-        for (int i = 0; i < 8; ++i)
-        {
-            if (i==sp())
-                std::cout << "*";
-            std::cout << (sp_base(i)).as_string() << " ";
-        }
-        std::cout << std::endl;
-
-        std::cout << "  IAW: ";
-        for (int i = 0; i < 8; ++i)
-        {
-            if (i==sp())
-                std::cout << "*";
-            std::cout << memory_.get_addrs(sp_base(i)).as_string() << " ";
-        }
-        std::cout << std::endl;
-
-        std::cout << "   ACC R#1 R#2 R#3 R#4 R#5 R#6 R#7 R#8 ";
-        static const char *compare_str[] = {"L", "E", "H"};
-        std::cout << " CMP:" << compare_str[compare_] << std::endl;
-        std::cout << "   ";
-        std::cout << to_octal(io_.accumulator()) << " ";
-        for (int i = 1; i <= 8; ++i)
-            std::cout << to_octal(index_register(i)) << " ";
-        std::cout << std::endl;
-
-        memory_.dump( {0,030}, 16);
-    }
-};
-
 void load_bootstrap(memory_t &memory)
 {
     // Load the bootstrap code into memory starting at P01-000
@@ -273,6 +75,28 @@ int main(int argc, char **argv)
     test_addrs_t();
     test_memory_t();
     test_iw_t();
+    test_disassembler_t();
+    test_decode_cache_t();
+    test_guest_clock_t();
+    test_scheduler_t();
+    test_tape_t();
+    test_tape_journal_t();
+    test_wav_t();
+    test_tape_decoder_t();
+    test_tape_encoder_t();
+    test_tape_reader_t();
+    test_record_index_t();
+    test_tape_library_t();
+    test_io_t();
+    test_cpu_t();
+    test_jit_t();
+    test_trace_buffer_t();
+    test_cfg_t();
+    test_profile_t();
+    test_sampler_t();
+    test_snapshot_t();
+    test_time_travel_t();
+    test_input_log_t();
     test_disassemble_memory(adrs, data);
     // icl1501::iw_t::test();
 
@@ -283,9 +107,85 @@ int main(int argc, char **argv)
     cpu_t cpu(memory, io);
     cpu.reset();
     std::cout << "Bootstrap loaded into memory." << std::endl;
-    while (1)
-        cpu.step();
-    std::cout << "CPU step executed." << std::endl;
 
+    //  ICL1501_TRACE=file records the last instructions executed (see icl1501-trace)
+    trace_buffer_t trace;
+    const char *trace_path = getenv("ICL1501_TRACE");
+    if (trace_path)
+        cpu.set_trace(&trace);
+
+    //  ICL1501_PROFILE=prefix writes prefix.txt (hot spots) and prefix.folded (flame graph stacks)
+    profile_t profile;
+    const char *profile_prefix = getenv("ICL1501_PROFILE");
+    if (profile_prefix)
+        cpu.set_profile(&profile);
+
+    //  ICL1501_SAMPLES=file samples the pc every ICL1501_SAMPLE_CYCLES guest cycles (10000 by default),
+    //  or every ICL1501_SAMPLE_HOST_US host microseconds (see icl1501-trace --samples)
+    sampler_t sampler(cpu, memory, io.scheduler());
+    const char *samples_path = getenv("ICL1501_SAMPLES");
+    if (samples_path)
+    {
+        if (const char *host_us = getenv("ICL1501_SAMPLE_HOST_US"))
+            sampler.start(sampler_t::kHostTime, strtoull(host_us, nullptr, 10), cpu.cycles());
+        else
+        {
+            const char *cycles = getenv("ICL1501_SAMPLE_CYCLES");
+            sampler.start(sampler_t::kGuestCycles, cycles ? strtoull(cycles, nullptr, 10) : 10000, cpu.cycles());
+        }
+    }
+
+    //  ICL1501_TAPES=file puts tapes in the decks, mounted when the program selects them (see tape_library.hpp)
+    //  ICL1501_TAPE=file replaces the tape in deck 2, the one loading: a text tape (TapeFormat.md) or an image (icl1501-tape)
+    //  What is written to a tape file goes to file.journal; ICL1501_COMPACT=1 makes the files images with the writes at the end
+    if (getenv("ICL1501_COMPACT"))
+        io.set_compact_on_release(true);
+    if (const char *library_path = getenv("ICL1501_TAPES"))
+        io.load_library(library_path, cpu.cycles());
+    if (const char *tape_path = getenv("ICL1501_TAPE"))
+    {
+        io.insert(1, tape_path, cpu.cycles());
+        std::cout << "Mounted tape " << tape_path << ": " << io.tape_reader(1).tape()->size() << " bytes" << std::endl;
+    }
+
+    //  ICL1501_RECORD=file records the device input, ICL1501_REPLAY=file runs again from it, without tapes
+    input_log_t input_log;
+    const char *record_path = getenv("ICL1501_RECORD");
+    if (const char *replay_path = getenv("ICL1501_REPLAY"))
+    {
+        input_log = input_log_t::load(replay_path);
+        io.set_input_log(&input_log, cpu.cycles());
+    }
+    else if (record_path)
+        io.set_input_log(&input_log, cpu.cycles());
+
+    auto save_outputs = [&]()
+    {
+        if (record_path && !input_log.replaying())
+            input_log.save(record_path);
+        if (samples_path)
+            sampler.save(samples_path);
+        if (!profile_prefix)
+            return;
+        profile.save_report(std::string(profile_prefix) + ".txt", memory);
+        profile.save_collapsed(std::string(profile_prefix) + ".folded");
+    };
+
+    try
+    {
+        while (1)
+            cpu.run(1000000);
+    }
+    catch (const std::runtime_error &e)
+    {
+        std::cout << "CPU stopped: " << e.what() << std::endl;
+        cpu.dump();
+        if (trace_path)
+            trace.save(trace_path);
+        save_outputs();
+        return 1;
+    }
+
+    save_outputs();
     return 0;
 }
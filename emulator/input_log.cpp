@@ -0,0 +1,267 @@
+#include "input_log.hpp"
+#include "memory.hpp"
+#include "cpu.hpp"
+#include "io.hpp"
+
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+const input_log_t::input_t &input_log_t::at(int device, size_t index) const
+{
+    if (!has(device, index))
+        throw std::runtime_error("Input log has no input " + std::to_string(index) + " for device " + std::to_string(device));
+    return streams_[device].inputs[index];
+}
+
+size_t input_log_t::size() const
+{
+    size_t size = 0;
+    for (auto &stream : streams_)
+        size += stream.inputs.size();
+    return size;
+}
+
+static void put_le(std::vector<uint8_t> &data, uint64_t value, int bytes)
+{
+    for (int i = 0; i != bytes; i++)
+        data.push_back(value >> (8 * i));
+}
+
+static void put_leb128(std::vector<uint8_t> &data, uint64_t value)
+{
+    while (value >= 0x80)
+    {
+        data.push_back(value | 0x80);
+        value >>= 7;
+    }
+    data.push_back(value);
+}
+
+std::vector<uint8_t> input_log_t::encode() const
+{
+    std::vector<uint8_t> data(8);
+    memcpy(data.data(), "ICLINPUT", 8);
+    put_le(data, kVersion, 4);
+    put_le(data, kStreams, 4);
+    for (auto &stream : streams_)
+    {
+        put_le(data, stream.inputs.size(), 8);
+        uint64_t cycle = 0;
+        for (auto &input : stream.inputs)
+        {
+            //  Scheduled events are not in cycle order: a runaway comes before a character scheduled later
+            auto delta = (int64_t)(input.cycle - cycle);
+            auto zigzag = ((uint64_t)delta << 1) ^ (uint64_t)(delta >> 63);
+            put_leb128(data, zigzag << 1 | input.runaway);
+            if (!input.runaway)
+                data.push_back(input.value);
+            cycle = input.cycle;
+        }
+    }
+    return data;
+}
+
+//  Reads from a decode() buffer, throws at the end
+class input_reader_t
+{
+    const std::vector<uint8_t> &data_;
+    size_t offset_ = 0;
+
+public:
+    explicit input_reader_t(const std::vector<uint8_t> &data) : data_(data) {}
+
+    uint8_t byte()
+    {
+        if (offset_ == data_.size())
+            throw std::runtime_error("Truncated input log");
+        return data_[offset_++];
+    }
+
+    uint64_t le(int bytes)
+    {
+        uint64_t value = 0;
+        for (int i = 0; i != bytes; i++)
+            value |= (uint64_t)byte() << (8 * i);
+        return value;
+    }
+
+    uint64_t leb128()
+    {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7)
+        {
+            auto b = byte();
+            value |= (uint64_t)(b & 0x7f) << shift;
+            if (!(b & 0x80))
+                return value;
+        }
+        throw std::runtime_error("Invalid input log");
+    }
+
+    bool done() const { return offset_ == data_.size(); }
+};
+
+input_log_t input_log_t::decode(const std::vector<uint8_t> &data)
+{
+    if (data.size() < 8 || memcmp(data.data(), "ICLINPUT", 8) != 0)
+        throw std::runtime_error("Not an input log");
+    input_reader_t reader(data);
+    reader.le(8);
+    if (reader.le(4) != kVersion)
+        throw std::runtime_error("Unsupported input log version");
+    auto streams = reader.le(4);
+    if (streams > kStreams)
+        throw std::runtime_error("Unsupported input log version");
+
+    input_log_t log(kReplaying);
+    for (size_t s = 0; s != streams; s++)
+    {
+        auto &stream = log.streams_[s];
+        auto count = reader.le(8);
+        uint64_t cycle = 0;
+        for (uint64_t i = 0; i != count; i++)
+        {
+            auto code = reader.leb128();
+            bool runaway = code & 1;
+            auto zigzag = code >> 1;
+            cycle += (zigzag >> 1) ^ -(zigzag & 1);
+            stream.inputs.push_back({cycle, runaway ? (uint8_t)0 : reader.byte(), runaway});
+        }
+    }
+    if (!reader.done())
+        throw std::runtime_error("Invalid input log");
+    return log;
+}
+
+void input_log_t::save(const std::string &path) const
+{
+    auto data = encode();
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char *)data.data(), data.size());
+    if (!file)
+        throw std::runtime_error("Cannot write input log: " + path);
+}
+
+input_log_t input_log_t::load(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Cannot open input log: " + path);
+    std::vector<uint8_t> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    try
+    {
+        return decode(data);
+    }
+    catch (const std::runtime_error &e)
+    {
+        throw std::runtime_error(std::string(e.what()) + ": " + path);
+    }
+}
+
+//  The polling program of test_cpu_t, in a machine with log, until it stops
+static void run_logged(memory_t &memory, input_log_t &log, cpu_t::eCore core, uint64_t &cycles)
+{
+    load_polling_program(memory);
+    io_t io;
+    cpu_t cpu(memory, io);
+    cpu.reset();
+    cpu.set_core(core);
+    io.set_input_log(&log, cpu.cycles());
+    run_polling_program(cpu);
+    cycles = cpu.cycles();
+}
+
+void test_input_log_t()
+{
+    //  Streams
+    input_log_t log;
+    log.record(1, 0, {100, 1, false});
+    log.record(1, 1, {300, 2, false});
+    log.record(1, 1, {300, 2, false}); //  Again, after going back
+    log.record(1, 2, {5000300, 0, true});
+    log.record(1, 3, {200000, 0377, false}); //  Scheduled after the runaway was cancelled
+    log.record(1, 5, {200100, 4, false});    //  Not the next one: ignored
+    assert(log.size() == 4 && log.stream(0).inputs.empty());
+
+    auto data = log.encode();
+    assert(data.size() == 8 + 4 + 4 + 8 * input_log_t::kStreams + (2 + 1) + (2 + 1) + 4 + (4 + 1));
+    auto decoded = input_log_t::decode(data);
+    assert(decoded.replaying());
+    assert(decoded.stream(1) == log.stream(1) && decoded.stream(0) == log.stream(0));
+    assert(decoded.has(1, 3) && !decoded.has(1, 4) && decoded.at(1, 2).runaway);
+    assert(!decoded.has(0, 0));
+    bool thrown = false;
+    try
+    {
+        decoded.at(0, 0);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    data.pop_back();
+    thrown = false;
+    try
+    {
+        input_log_t::decode(data);
+    }
+    catch (const std::runtime_error &e)
+    {
+        thrown = std::string(e.what()) == "Truncated input log";
+    }
+    assert(thrown);
+
+    //  A whole run, replayed by each core from the file
+    memory_t recorded;
+    input_log_t recording;
+    uint64_t cycles;
+    run_logged(recorded, recording, cpu_t::kCoreThreaded, cycles);
+    //  Five characters, then the runaway
+    assert(recording.stream(1).inputs.size() == 6 && recording.stream(1).inputs[5].runaway);
+    assert(recording.stream(0).inputs.empty());
+
+    auto path = test_path("input");
+    recording.save(path);
+    for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreThreaded, cpu_t::kCoreJIT})
+    {
+        memory_t memory;
+        auto replay = input_log_t::load(path);
+        uint64_t replay_cycles;
+        run_logged(memory, replay, core, replay_cycles);
+        assert(replay_cycles == cycles);
+        for (size_t i = 0; i != 16384; i++)
+            assert(memory[i] == recorded[i]);
+    }
+    remove(path.c_str());
+
+    //  Without the tape, at the same cycles
+    scheduler_t scheduler;
+    tape_reader_t reader(nullptr, scheduler);
+    reader.set_input_log(&recording, 1, 0);
+    recording.replay();
+    reader.start(0);
+    uint8_t value;
+    scheduler.run_until(recording.stream(1).inputs[0].cycle - 1);
+    assert(!reader.transfer(value));
+    scheduler.run_until(recording.stream(1).inputs[0].cycle);
+    assert(reader.transfer(value) && value == 1);
+
+    //  A recording cut short cannot be replayed past its end
+    input_log_t partial;
+    partial.record(1, 0, recording.stream(1).inputs[0]);
+    partial.replay();
+    memory_t memory;
+    try
+    {
+        run_logged(memory, partial, cpu_t::kCoreSwitch, cycles);
+        assert(false);
+    }
+    catch (const std::runtime_error &e)
+    {
+        assert(std::string(e.what()) == "Input log has no input 1 for device 1");
+    }
+}
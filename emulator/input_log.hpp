@@ -0,0 +1,107 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+
+/*
+    Record and replay of external input.
+
+    The devices are the only nondeterminism of the machine: given the same
+    input at the same guest cycles, a run is bit-identical. A log holds,
+    for each input device, what reached the machine and when.
+
+    Recording: the devices append to the log as input is scheduled. Going
+    back (snapshots, time travel) and running again does not append twice,
+    as input is indexed by its position in the stream.
+
+    Replaying: the devices take their input from the log instead of the
+    tapes, which do not need to be mounted. Running past the end of a
+    stream is an error, as the recording does not know what came next.
+
+    Today the tape readers are the only input devices: a stream is the
+    events a reader scheduled while reading, in order: characters reaching
+    the head, and runaways (no character ahead). An event may be cancelled
+    by a later command, on both sides alike.
+
+    File format: "ICLINPUT", version (4 bytes), stream count (4 bytes, at
+    most kStreams), then for each stream: input count (8 bytes), and the
+    inputs as a LEB128 of the zigzag cycle delta from the previous one,
+    shifted left once with the runaway flag, followed by the value for
+    characters.
+*/
+
+class input_log_t
+{
+public:
+    typedef enum
+    {
+        kRecording,
+        kReplaying,
+    } eMode;
+
+    static const uint32_t kVersion = 2;
+    static const int kStreams = 8; //  One per tape deck
+
+    struct input_t
+    {
+        uint64_t cycle;
+        uint8_t value;
+        bool runaway; //  No character ahead: the tape halts at cycle
+
+        bool operator==(const input_t &) const = default;
+    };
+
+    struct stream_t
+    {
+        std::vector<input_t> inputs;
+
+        bool operator==(const stream_t &) const = default;
+    };
+
+private:
+    eMode mode_;
+    stream_t streams_[kStreams];
+
+public:
+    explicit input_log_t(eMode mode = kRecording) : mode_(mode) {}
+
+    eMode mode() const { return mode_; }
+    bool replaying() const { return mode_ == kReplaying; }
+
+    //  Replays what was recorded so far
+    void replay() { mode_ = kReplaying; }
+
+    const stream_t &stream(int device) const { return streams_[device]; }
+
+    //  Recording, index is the position of input in the stream
+    //  Already recorded positions are left as they are
+    void record(int device, size_t index, const input_t &input)
+    {
+        auto &inputs = streams_[device].inputs;
+        if (index == inputs.size())
+            inputs.push_back(input);
+    }
+
+    //  Replaying
+    //  false if there is nothing at index, because the recording stopped before
+    bool has(int device, size_t index) const { return index < streams_[device].inputs.size(); }
+
+    //  Throws std::runtime_error if index was not recorded
+    const input_t &at(int device, size_t index) const;
+
+    size_t size() const;
+
+    std::vector<uint8_t> encode() const;
+
+    //  Throws std::runtime_error if data is not a log. The result replays
+    static input_log_t decode(const std::vector<uint8_t> &data);
+
+    //  Throws std::runtime_error if the file cannot be written
+    void save(const std::string &path) const;
+
+    //  Throws std::runtime_error if the file cannot be read or is not a log
+    static input_log_t load(const std::string &path);
+};
+
+void test_input_log_t();
@@ -0,0 +1,90 @@
+#include "io.hpp"
+
+#include <cassert>
+#include <filesystem>
+
+void test_io_t()
+{
+    io_t io;
+    auto ioc = [&](int channel, int function_code, uint64_t now = 0)
+    { return io.execute(iw_t(0170 | channel, function_code), now); };
+
+    //  Deck 2 is loading: clip out once it moved
+    assert(io.deck() == 1);
+    ioc(0, io_t::kTapeSelectPair1);
+    assert(io.accumulator() == 0);
+    assert(ioc(0, io_t::kTapeSelectPair1, 100000) == io_t::kIOCDone);
+    assert(io.accumulator() == io_t::kStatusClipOut);
+
+    //  Deck 1 is empty
+    ioc(1, io_t::kTapeSelectPair1);
+    assert(io.deck() == 0 && io.accumulator() == io_t::kStatusCartridgeOut);
+
+    //  A tape in deck 6 (second deck of pair 3), loaded when selected
+    auto path = test_path("io.tape");
+    tape_t({7}).save(path);
+    io.insert(5, path, 0);
+    assert(io.library().present(5) && !io.library().mounted(5));
+    ioc(2, io_t::kTapeTransferByteSkip); //  Second deck of pair 1
+    assert(io.deck() == 1 && !io.library().mounted(5));
+    ioc(2, io_t::kTapeSelectPair3);
+    assert(io.deck() == 5 && io.library().mounted(5) && io.library().loads() == 1);
+    assert(io.accumulator() == 0 && io.tape_reader(5).tape()->size() == 1);
+    std::filesystem::remove(path);
+
+    //  Channel 1 now selects in pair 3
+    ioc(1, io_t::kTapeTransferByteSkip);
+    assert(io.deck() == 4);
+    ioc(2, io_t::kTapeTransferByteSkip);
+    assert(io.deck() == 5);
+
+    //  Reading deck 6
+    io.tape_reader(5).start(0);
+    io.scheduler().run_until(3100000);
+    assert(ioc(0, io_t::kTapeTransferByteBlocking, 3100000) == io_t::kIOCDone && io.accumulator() == 7);
+
+    //  Runaway once past the data, reset once the status is loaded
+    io.scheduler().run_until(9000000);
+    ioc(0, io_t::kTapeSelectPair3, 9000000);
+    assert(io.accumulator() == (io_t::kStatusRunaway | io_t::kStatusClipOut));
+    ioc(0, io_t::kTapeSelectPair3, 9000000);
+    assert(io.accumulator() == io_t::kStatusClipOut);
+
+    io.eject(5, 9000000);
+    ioc(0, io_t::kTapeSelectPair3, 9000000);
+    assert(io.accumulator() == io_t::kStatusCartridgeOut && !io.library().present(5));
+
+    //  Writing the accumulator (the status: clip out) on a tape file, journaled
+    auto written = test_path("io-write.tape");
+    std::filesystem::remove(tape_journal_t::path_of(written));
+    tape_t({1, 2, 3}).save(written);
+    uint64_t now = 10000000;
+    io.insert(6, written, now);
+    ioc(1, io_t::kTapeSelectPair4, now);
+    assert(io.deck() == 6 && io.accumulator() == 0);
+    ioc(0, io_t::kTapeForwardSlow, now);
+    now += 100000;
+    ioc(0, io_t::kTapeSelectPair4, now);
+    assert(io.accumulator() == io_t::kStatusClipOut);
+    ioc(0, io_t::kTapeWriteMode, now);
+    assert(ioc(0, io_t::kTapeTransferByteBlocking, now) == io_t::kIOCDone);
+    assert(ioc(0, io_t::kTapeTransferByteSkip, now) == io_t::kIOCSkip); //  The head is still on it
+    io.scheduler().run_until(now + 600); //  Passed it, not by a whole character yet
+    assert(ioc(0, io_t::kTapeTransferByteSkip, now + 600) == io_t::kIOCDone);
+    ioc(0, io_t::kTapeStop, now + 600);
+    assert(io.library().mounted(6) && io.tape_reader(6).tape()->size() == 5);
+    assert(std::filesystem::exists(tape_journal_t::path_of(written)));
+
+    //  Mounted again: the file and the journal
+    io.eject(6, now + 600);
+    io.insert(6, written, now + 600);
+    ioc(1, io_t::kTapeSelectPair4, now + 600);
+    auto &tape = *io.tape_reader(6).tape();
+    assert(tape.size() == 5 && tape[0] == io_t::kStatusClipOut && tape[1] == io_t::kStatusClipOut && tape[2] == 1);
+
+    //  Compacted: an image with the writes, no journal
+    io.compact(6, now + 600);
+    assert(!std::filesystem::exists(tape_journal_t::path_of(written)));
+    assert(tape_t::load(written)->size() == 5);
+    std::filesystem::remove(written);
+}
@@ -2,20 +2,152 @@
 #include <cstdint>
 #include <vector>
 #include <cassert>
+#include <iostream>
+#include <memory>
 
 #include "iw.hpp"
+#include "scheduler.hpp"
 #include "tape_reader.hpp"
+#include "tape_library.hpp"
 
+/*
+    The devices on the IOC channels.
+
+    Tapes: eight decks in four pairs (see tape_library.hpp), each with its
+    tape_reader_t. Functions 016/026/036/046 select pair 1 to 4; channel 1
+    or 2 selects the first or second deck of the current pair, channel 0
+    uses the current deck. A deck's tape is mounted when the deck is first
+    selected. The motion functions (forward, reverse, stop, rewind, erase)
+    and the read and write modes apply to the current deck. In write mode,
+    the transfer functions write the accumulator.
+*/
 class io_t
 {
-    tape_reader_t tape_readers_[2];
-    int tape_index_ = 1;
+public:
+    static const int kDecks = tape_library_t::kDecks;
+
+private:
+    scheduler_t scheduler_; //  Shared by all devices
+    tape_library_t library_;
+    std::unique_ptr<tape_reader_t> tape_readers_[kDecks];
+    int deck_ = 1; //  Current deck
+    int pair_ = 0; //  Current pair
     uint8_t accumulator_ = 0;
+    uint64_t side_effects_ = 0;
+
+    //  Transfer-byte on the current deck, reading or writing the accumulator
+    bool transfer(uint64_t now)
+    {
+        auto &reader = *tape_readers_[deck_];
+        if (reader.write_mode())
+            return reader.write(accumulator_, now);
+        return reader.transfer(accumulator_);
+    }
+
+    //  Makes deck current, with its tape mounted
+    void select(int deck, uint64_t now)
+    {
+        deck_ = deck;
+        auto &reader = *tape_readers_[deck];
+        if (!reader.tape() && library_.present(deck))
+            reader.mount(library_.mount(deck), now);
+    }
 
 public:
+    //  Deck status (IOC 016/026/036/046)
+    static const uint8_t kStatusKeyboardError = 0001;
+    static const uint8_t kStatusTapeError = 0002;
+    static const uint8_t kStatusIO = 0004;
+    static const uint8_t kStatusRunaway = 0010;
+    static const uint8_t kStatusCartridgeOut = 0020;
+    static const uint8_t kStatusClipOut = 0040;
+    static const uint8_t kStatusEOT = 0100;
+
     io_t()
-        : tape_readers_{nullptr,new tape_t({1, 2, 3, 4, 5})}
     {
+        for (auto &reader : tape_readers_)
+            reader = std::make_unique<tape_reader_t>(nullptr, scheduler_);
+
+        library_.insert(1, std::make_unique<tape_t>(std::vector<uint8_t>{1, 2, 3, 4, 5}));
+        select(1, 0);
+        std::cout << "Mounted tape:\n";
+        tape_readers_[1]->tape()->dump();
+
+        //  As if loaded with the LOAD key: the tape is already moving
+        tape_readers_[1]->start(0);
+    }
+
+    io_t(const io_t &) = delete;
+    io_t &operator=(const io_t &) = delete;
+
+    scheduler_t &scheduler() { return scheduler_; }
+
+    tape_reader_t &tape_reader(int deck) { return *tape_readers_[deck]; }
+    const tape_library_t &library() const { return library_; }
+    int deck() const { return deck_; }
+
+    //  Replaces the cartridge of a deck: a tape file, mounted when the deck is
+    //  selected (or now if its tape is moving), or a tape already in memory
+    //  Throws std::runtime_error if the file is needed now and cannot be loaded (the deck is then empty)
+    void insert(int deck, const std::string &path, uint64_t now)
+    {
+        auto &reader = *tape_readers_[deck];
+        bool needed = deck == deck_ || reader.moving();
+        reader.flush(now);
+        library_.assign(deck, path);
+        tape_t *tape = nullptr;
+        try
+        {
+            tape = needed ? library_.mount(deck) : nullptr;
+        }
+        catch (const std::runtime_error &)
+        {
+            reader.mount(nullptr, now);
+            library_.eject(deck);
+            throw;
+        }
+        reader.mount(tape, now);
+    }
+
+    void insert(int deck, std::unique_ptr<tape_t> tape, uint64_t now)
+    {
+        tape_readers_[deck]->mount(tape.get(), now);
+        library_.insert(deck, std::move(tape));
+    }
+
+    void eject(int deck, uint64_t now)
+    {
+        tape_readers_[deck]->mount(nullptr, now);
+        library_.eject(deck);
+    }
+
+    //  The file of a deck as an image with what was written, without journal (see tape_library.hpp)
+    //  Throws std::runtime_error if it cannot be written
+    void compact(int deck, uint64_t now)
+    {
+        tape_readers_[deck]->flush(now);
+        library_.compact(deck);
+    }
+
+    void set_compact_on_release(bool compact) { library_.set_compact_on_release(compact); }
+
+    //  Decks from a library configuration, mounted when selected
+    //  Throws std::runtime_error if it cannot be read
+    void load_library(const std::string &path, uint64_t now)
+    {
+        tape_library_t config;
+        config.load_config(path);
+        for (int deck = 0; deck != kDecks; deck++)
+            if (config.present(deck))
+                insert(deck, config.path(deck), now);
+    }
+
+    //  Records all input to log, or replays it (see input_log.hpp). nullptr to stop
+    //  The log outlives its use here
+    void set_input_log(input_log_t *log, uint64_t now)
+    {
+        for (int i = 0; i != kDecks; i++)
+            tape_readers_[i]->set_input_log(log, i, now);
     }
 
     uint8_t accumulator()
@@ -23,10 +155,87 @@ public:
         return accumulator_;
     }
 
+    //  Status of a deck, as loaded by the select functions
+    uint8_t status(int deck, uint64_t now) const
+    {
+        auto &reader = *tape_readers_[deck];
+        uint8_t status = 0;
+        if (reader.overrun())
+            status |= kStatusTapeError;
+        if (reader.runaway())
+            status |= kStatusRunaway;
+        if (!library_.present(deck))
+            return status | kStatusCartridgeOut;
+        auto location = reader.location(now);
+        if (location.inches() > 0)
+            status |= kStatusClipOut;
+        if (reader.tape() && !(location < reader.tape()->end()))
+            status |= kStatusEOT;
+        return status;
+    }
+
+    static const int kTapeForwardSlowErase = 0000;
+    static const int kTapeForwardSlow = 0001;
+    static const int kTapeForwardFast = 0002;
+    static const int kTapeReverseSlow = 0003;
+    static const int kTapeReverseFast = 0004;
+    static const int kTapeStop = 0005;
+    static const int kTapeWriteMode = 0010;
+    static const int kTapeReadMode = 0011;
+    static const int kTapeRewind = 0012;
     static const int kTapeTransferByteBlocking = 0007;
+    static const int kTapeTransferByteSkip = 0207;
+    static const int kTapeSelectPair1 = 0016;
+    static const int kTapeSelectPair2 = 0026;
+    static const int kTapeSelectPair3 = 0036;
+    static const int kTapeSelectPair4 = 0046;
+
+    typedef enum
+    {
+        kIOCDone, // executed
+        kIOCWait, // device not ready, nothing done: let time pass and execute again
+        kIOCSkip, // device busy, nothing done: skip the next instruction
+    } eIOCResult;
+
+    //  Device state, for snapshots (see snapshot.hpp)
+    //  Mounted tapes stay mounted
+    struct state_t
+    {
+        uint8_t accumulator;
+        int deck;
+        int pair;
+        uint64_t side_effects;
+        tape_reader_t::state_t tape_readers[kDecks];
+    };
+
+    state_t state() const
+    {
+        state_t state{accumulator_, deck_, pair_, side_effects_, {}};
+        for (int i = 0; i != kDecks; i++)
+            state.tape_readers[i] = tape_readers_[i]->state();
+        return state;
+    }
+
+    //  Pending device events are posted again, in this io_t's scheduler
+    void restore(const state_t &state)
+    {
+        accumulator_ = state.accumulator;
+        deck_ = state.deck;
+        pair_ = state.pair;
+        side_effects_ = state.side_effects;
+        for (int i = 0; i != kDecks; i++)
+            tape_readers_[i]->restore(state.tape_readers[i]);
+    }
+
+    //  Counts the IOCs that changed something (device or accumulator)
+    //  Polling a busy device leaves it unchanged
+    uint64_t side_effects() const
+    {
+        return side_effects_;
+    }
 
     // Instuction is assumed to be an IOC
-    void execute(const iw_t &iw)
+    eIOCResult execute(const iw_t &iw, uint64_t now)
     {
         int channel = iw.ioc_channel();
         int function_code = iw.ioc_function_code();
@@ -35,13 +244,52 @@ public:
         {
         case 1:
         case 2:
-            tape_index_ = channel - 1; // fallthrough to read from the tape
+            if (function_code == kTapeSelectPair1 || function_code == kTapeSelectPair2 ||
+                function_code == kTapeSelectPair3 || function_code == kTapeSelectPair4)
+                pair_ = (function_code >> 3) - 1;
+            select(pair_ * 2 + channel - 1, now); // fallthrough to the current deck
         case 0:
-            // tape_readers_[tape_index_].execute(function_code);
             switch (function_code)
             {
+            case kTapeForwardSlowErase:
+                tape_readers_[deck_]->forward_erase(now);
+                break;
+            case kTapeForwardSlow:
+            case kTapeForwardFast:
+                tape_readers_[deck_]->forward(function_code == kTapeForwardFast, now);
+                break;
+            case kTapeReverseSlow:
+            case kTapeReverseFast:
+                tape_readers_[deck_]->reverse(function_code == kTapeReverseFast, now);
+                break;
+            case kTapeStop:
+                tape_readers_[deck_]->stop(now);
+                break;
+            case kTapeWriteMode:
+                tape_readers_[deck_]->write_mode(now);
+                break;
+            case kTapeReadMode:
+                tape_readers_[deck_]->read(now);
+                break;
+            case kTapeRewind:
+                tape_readers_[deck_]->rewind(now);
+                break;
             case kTapeTransferByteBlocking:
-                accumulator_ = tape_readers_[tape_index_].next();
+                if (!transfer(now))
+                    return kIOCWait;
+                break;
+            case kTapeTransferByteSkip:
+                //  The accumulator is destroyed on the real machine, it is left unchanged here
+                if (!transfer(now))
+                    return kIOCSkip;
+                break;
+            case kTapeSelectPair1:
+            case kTapeSelectPair2:
+            case kTapeSelectPair3:
+            case kTapeSelectPair4:
+                //  Ends a read: the errors are reset once loaded
+                accumulator_ = status(deck_, now);
+                tape_readers_[deck_]->clear_errors();
                 break;
             default:
                 throw std::runtime_error("Unimplemented tape function code: " + std::to_string(function_code));
@@ -50,5 +298,9 @@ public:
         default:
             throw std::runtime_error("Unimplemented IOC channel: " + std::to_string(channel));
         }
+        side_effects_++;
+        return kIOCDone;
     }
 };
+
+void test_io_t();
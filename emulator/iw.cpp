@@ -3,11 +3,84 @@
 
 #include <iostream>
 
+//  Most specific match wins (most mask bits set)
+//  On equal specificity, the latest entry of types() wins (EMP replaces LSW)
+//  Types are first filtered on the left byte, to keep the compile-time evaluation cheap
+static constexpr std::array<iw_t::eInstructionType, 65536> make_instr_map()
+{
+    std::array<iw_t::eInstructionType, 65536> map{};
+
+    //  All types, from least to most specific
+    std::array<iw_t::instruction_def, iw_t::kInstructionTypeCount> sorted{};
+    size_t n = 0;
+    for (int bits = 0; bits != 17; bits++)
+        for (auto &type : iw_t::types())
+            if (std::popcount(type.mask) == bits)
+                sorted[n++] = type;
+
+    for (int iwl = 0; iwl < 256; iwl++)
+    {
+        //  Right byte value/mask of the types matching this left byte
+        uint8_t values[iw_t::kInstructionTypeCount]{};
+        uint8_t masks[iw_t::kInstructionTypeCount]{};
+        iw_t::eInstructionType instrs[iw_t::kInstructionTypeCount]{};
+        int count = 0;
+        for (auto &type : sorted)
+            if ((iwl & (type.mask >> 8)) == ((type.value & type.mask) >> 8))
+            {
+                values[count] = type.value & type.mask & 0xff;
+                masks[count] = type.mask & 0xff;
+                instrs[count] = type.instr;
+                count++;
+            }
+
+        iw_t::eInstructionType *row = map.data() + (iwl << 8);
+        for (int iwr = 0; iwr < 256; iwr++)
+        {
+            int c = count - 1;
+            while ((iwr & masks[c]) != values[c])
+                c--;
+            row[iwr] = instrs[c];
+        }
+    }
+    return map;
+}
+
+constinit const std::array<iw_t::eInstructionType, 65536> iw_instr_map = make_instr_map();
+
+static constexpr bool types_in_enum_order()
+{
+    for (size_t t = 0; t != iw_t::types().size(); t++)
+        if (iw_t::types()[t].instr != t)
+            return false;
+    return true;
+}
+
+static_assert(types_in_enum_order(), "types() must be indexable by eInstructionType");
+static_assert(sizeof(iw_t::eInstructionType) == 1);
+
 void test_iw_t()
 {
     assert(iw_t::instr_map()[0] == iw_t::kTLX);
     assert(iw_t::instr_map()[0b10000011'00100010] == iw_t::kLDX);
 
+    //  Compile-time table must match the original runtime construction
+    //  (fill from least specific match to most specific)
+    static iw_t::eInstructionType reference[65536];
+    for (int bits = 0; bits != 17; bits++)
+        for (auto &type : iw_t::types())
+        {
+            if (std::popcount(type.mask) != bits)
+                continue;
+            for (int i = 0; i < 65536; i++)
+            {
+                iw_t instr(i >> 8, i & 0xff);
+                if (instr.compare(type.value >> 8, type.mask >> 8, type.value & 0xff, type.mask & 0xff))
+                    reference[i] = type.instr;
+            }
+        }
+    assert(std::equal(std::begin(reference), std::end(reference), iw_t::instr_map()));
+
     iw_t instruction(0203, 042);
     disassembler_t disasm;
     std::cout << "Instruction: " << disasm.mnemonic(instruction) << std::endl;
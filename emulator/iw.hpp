@@ -5,6 +5,8 @@
 #include <cassert>
 #include <cstdio>
 #include <bitset>
+#include <array>
+#include <string_view>
 
 #include "addrs.hpp"
 #include "utils.hpp"
@@ -65,6 +67,7 @@ public:
         return iwl_ & 0b00011110;
     }
 
+    //  true for a backward jump (TLJ, -NN is 00JJ1-LLL)
     bool direction() const
     {
         return (iwl_ & 01) != 0;
@@ -73,7 +76,7 @@ public:
     int signed_jump_count() const
     {
         int count = jump_count();
-        return direction() ? count : -count;
+        return direction() ? -count : count;
     }
 
     uint8_t literal() const
@@ -155,7 +158,7 @@ public:
         return reg_name + "#" + std::to_string(reg);
     }
 
-    typedef enum
+    typedef enum : uint8_t
     {
         kUnknown = 0, // Default
         kTLJ,
@@ -220,7 +223,7 @@ public:
     typedef struct instruction_def
     {
         eInstructionType instr;
-        std::string mnemonic;
+        std::string_view mnemonic;
         uint16_t value;
         uint16_t mask;
         int decode;
@@ -247,7 +250,7 @@ public:
         return to_octal(ioc_function_code());
     }
 
-    std::string describe_ioc_channel() const
+    std::string_view describe_ioc_channel() const
     {
         auto c = ioc_channel();
         switch (c)
@@ -267,7 +270,7 @@ public:
         }
     }
 
-    std::string describe_ioc_tape() const
+    std::string_view describe_ioc_tape() const
     {
         switch (ioc_function_code())
         {
@@ -297,13 +300,13 @@ public:
         case 0026:
         case 0036:
         case 0046:
-            return "select deck and load status [TODO]";
+            return "select deck and load status";
         default:
             return "???";
         }
     }
 
-    std::string describe_ioc_keyboard() const
+    std::string_view describe_ioc_keyboard() const
     {
         switch (ioc_function_code())
         {
@@ -320,7 +323,7 @@ public:
         }
     }
 
-    std::string describe_ioc_CRT() const
+    std::string_view describe_ioc_CRT() const
     {
         // int code = ioc_function_code();
         // int ss = code >> 6;
@@ -333,7 +336,7 @@ public:
         return "[TODO]";
     }
 
-    std::string describe_ioc_function_code() const
+    std::string_view describe_ioc_function_code() const
     {
         auto c = ioc_channel();
         switch (c)
@@ -351,135 +354,31 @@ public:
         }
     }
 
-    static const int kDECODE_NONE = 0x00;
-    static const int kDECODE_JUMP = 0x01;
-    static const int kDECODE_LITERAL = 0x02;
-    static const int kDECODE_INDEX_REGISTER = 0x04;
-    static const int kDECODE_IOC = 0x08;
-    static const int kDECODE_IOC_CHANNEL = 0x10;
-    static const int kDECODE_OLITERAL = 0x20;
-    static const int kDECODE_INDEX_REGISTER_OP = 0x40;
-    static const int kDECODE_PAGE_NUMBER = 0x80;
-    static const int kDECODE_ADRS_LEVEL_BYTE = 0x100;
-    static const int kDECODE_MASK = 0x200;
-    static const int kDECODE_SECTION = 0x400;
-    static const int kDECODE_UV = 0x800;
-    static const int kDECODE_ADRS_BYTE = 0x1000;
-    static const int kDECODE_SECTION_LEVEL = 0x2000;
-    static const int kDECODE_BLITERAL = 0x4000;
-    static const int kDECODE_SHIFT = 0x8000;
-
-    static const std::vector<instruction_def>
-    types()
-    {
-        static const std::vector<instruction_def> types = {
-            instruction_def{kUnknown, "???", 0b00000000'00000000, 0b00000000'00000000, kDECODE_NONE},
-            instruction_def{kTLJ, "TLJ", 0b00000000'00000000, 0b11100000'00000000, kDECODE_JUMP | kDECODE_LITERAL},
-            instruction_def{kTMJ, "TMJ", 0b00100000'00000000, 0b11100000'00000000, kDECODE_JUMP | kDECODE_MASK},
-            instruction_def{kTLX, "TLX", 0b00000000'00000000, 0b11111111'00000000, kDECODE_LITERAL},
-            instruction_def{kTMX, "TMX", 0b00100000'00000000, 0b11111111'00000000, kDECODE_MASK},
-            instruction_def{kBRU, "BRU", 0b01000000'00000000, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kBRE, "BRE", 0b01000000'00000001, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kBRH, "BRH", 0b01001000'00000000, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kBRL, "BRL", 0b01001000'00000001, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kSBU, "SBU", 0b01010000'00000000, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kSBE, "SBE", 0b01010000'00000001, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kSBH, "SBH", 0b01011000'00000000, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kSBL, "SBL", 0b01011000'00000001, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kEXB, "EXB", 0b01110000'00000000, 0b11111000'00000001, kDECODE_ADRS_LEVEL_BYTE},
-            instruction_def{kEXU, "EXU", 0b01100000'00000000, 0b11111111'11111111, kDECODE_NONE},
-            instruction_def{kSMS, "SMS", 0b01101000'00000000, 0b11111111'11000111, kDECODE_SECTION},
-            instruction_def{kSMC, "SMC", 0b01101001'00000000, 0b11111111'00111111, kDECODE_UV},
-            instruction_def{kSSC, "SSC", 0b01101010'00000000, 0b11111111'00000111, kDECODE_UV | kDECODE_SECTION},
-            instruction_def{kSAC, "SAC", 0b01101011'00000000, 0b11111111'11111111, 0},
-            instruction_def{kLSW, "LSW", 0b01101100'00000000, 0b11111111'11111111, 0},
-            instruction_def{kEMP, "EMP", 0b01101100'00000000, 0b11111111'11111111, 0}, // replaces LSW
-            instruction_def{kLPS, "LPS", 0b01101101'00000000, 0b11111111'11111111, 0},
-            instruction_def{kDPI, "DPI", 0b01101110'00000000, 0b11111111'11111111, 0},
-            instruction_def{kEPI, "EPI", 0b01101110'00000001, 0b11111111'11111111, 0},
-            instruction_def{kCPI, "CPI", 0b01101110'00000010, 0b11111111'11111111, 0},
-            instruction_def{kTRM, "TRM", 0b01101111'00000000, 0b11111111'11111111, 0},
-            instruction_def{kLDA_Imm, "LDA", 0b10000000'00000000, 0b11111111'00000000, kDECODE_LITERAL},
-            instruction_def{kLDA_Dir, "LDA", 0b10001000'00000000, 0b11111111'00000000, kDECODE_ADRS_BYTE},
-            instruction_def{kLDA_Ind, "LDA", 0b10001000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER_OP | kDECODE_SECTION_LEVEL},
-            instruction_def{kLDX, "LDX", 0b10000000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER | kDECODE_LITERAL},
-            instruction_def{kLIA, "LIA", 0b10010000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER | kDECODE_LITERAL},
-            instruction_def{kSTA_Dir, "STA", 0b10011000'00000000, 0b11111111'00000000, kDECODE_ADRS_BYTE},
-            instruction_def{kSTA_Ind, "STA", 0b10011000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER_OP | kDECODE_PAGE_NUMBER},
-            instruction_def{kADA_Imm, "ADA", 0b10100000'00000000, 0b11111111'00000000, kDECODE_LITERAL},
-            instruction_def{kADA_Dir, "ADA", 0b10101000'00000000, 0b11111111'00000000, kDECODE_ADRS_BYTE},
-            instruction_def{kADA_Ind, "ADA", 0b10101000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER_OP | kDECODE_PAGE_NUMBER},
-            instruction_def{kADX, "ADX", 0b10100000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER | kDECODE_LITERAL},
-            instruction_def{kSUA_Imm, "SUA", 0b10110000'00000000, 0b11111111'00000000, kDECODE_LITERAL},
-            instruction_def{kSUA_Dir, "SUA", 0b10111000'00000000, 0b11111111'00000000, kDECODE_ADRS_BYTE},
-            instruction_def{kSUA_Ind, "SUA", 0b10111000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER_OP | kDECODE_PAGE_NUMBER},
-            instruction_def{kSUX, "SUX", 0b10110000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER | kDECODE_LITERAL},
-            instruction_def{kANA_Imm, "ANA", 0b11000000'00000000, 0b11111111'00000000, kDECODE_BLITERAL},
-            instruction_def{kANA_Dir, "ANA", 0b11001000'00000000, 0b11111111'00000000, kDECODE_ADRS_BYTE},
-            instruction_def{kANA_Ind, "ANA", 0b11001000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER_OP | kDECODE_PAGE_NUMBER},
-            instruction_def{kSAN, "SAN", 0b11000000'00000000, 0b11111000'00000000, kDECODE_SHIFT | kDECODE_BLITERAL},
-            instruction_def{kERA_Imm, "ERA", 0b11010000'00000000, 0b11111111'00000000, kDECODE_BLITERAL},
-            instruction_def{kERA_Dir, "ERA", 0b11011000'00000000, 0b11111111'00000000, kDECODE_ADRS_BYTE},
-            instruction_def{kERA_Ind, "ERA", 0b11011000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER_OP | kDECODE_PAGE_NUMBER},
-            instruction_def{kSER, "SER", 0b11010000'00000000, 0b11111000'00000000, kDECODE_SHIFT | kDECODE_BLITERAL},
-            instruction_def{kIRA_Imm, "IRA", 0b11110000'00000000, 0b11111111'00000000, kDECODE_BLITERAL},
-            instruction_def{kIRA_Dir, "IRA", 0b11111000'00000000, 0b11111111'00000000, kDECODE_ADRS_BYTE},
-            instruction_def{kIRA_Ind, "IRA", 0b11111000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER_OP | kDECODE_PAGE_NUMBER},
-            instruction_def{kSIR, "SIR", 0b11110000'00000000, 0b11111000'00000000, kDECODE_SHIFT | kDECODE_BLITERAL},
-            instruction_def{kCPA_Imm, "CPA", 0b11100000'00000000, 0b11111111'00000000, kDECODE_LITERAL},
-            instruction_def{kCPA_Dir, "CPA", 0b11101000'00000000, 0b11111111'00000000, kDECODE_ADRS_BYTE},
-            instruction_def{kCPA_Ind, "CPA", 0b11101000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER_OP | kDECODE_PAGE_NUMBER},
-            instruction_def{kCPX, "CPX", 0b11100000'00000000, 0b11111000'00000000, kDECODE_INDEX_REGISTER | kDECODE_LITERAL},
-            instruction_def{kIOC, "IOC", 0b01111000'00000000, 0b11111000'00000000, kDECODE_IOC_CHANNEL | kDECODE_OLITERAL | kDECODE_IOC}};
-        return types;
-    }
-
-    static const eInstructionType *instr_map()
-    {
-
-        static eInstructionType instr_map[65536] = {kUnknown};
-
-        static bool initialized = false;
-        if (!initialized)
-        { // We fill from least specific match (least bits) to most specific
-            for (int bits = 0; bits != 17; bits++)
-            {
-                for (auto &type : iw_t::types())
-                {
-                    if (std::popcount(type.mask) != bits)
-                        continue;
-                    std::cout << type.mnemonic << " ("
-                              << std::bitset<16>(type.value) << ","
-                              << std::bitset<16>(type.mask) << ") = " << bits << " bits" << std::endl;
-                    for (int i = 0; i < 65536; i++)
-                    {
-                        iw_t instr(i >> 8, i & 0xff);
-                        if (instr.compare(type.value >> 8, type.mask >> 8, type.value & 0xff, type.mask & 0xff))
-                        {
-                            instr_map[i] = type.instr;
-                        }
-                    }
-                }
-            }
-
-            // for (int i = 0; i < 65536; i++)
-            // {
-            //     if (instr_map[i] == kUnknown)
-            //     {
-            //         std::cout << "Instruction " << std::oct << std::setfill('0') << std::setw(3) << i
-            //                   << " is unknown" << std::dec << std::endl;
-            //     }
-            //     else
-            //     {
-            //         std::cout << "Instruction " << std::hex << std::setfill('0') << std::setw(3) << i
-            //                   << " is of type " << instr_map[i] << std::dec << std::endl;
-            //     }
-            // }
-            initialized = true;
-        }
-
-        return instr_map;
-    }
+    static constexpr int kDECODE_NONE = 0x00;
+    static constexpr int kDECODE_JUMP = 0x01;
+    static constexpr int kDECODE_LITERAL = 0x02;
+    static constexpr int kDECODE_INDEX_REGISTER = 0x04;
+    static constexpr int kDECODE_IOC = 0x08;
+    static constexpr int kDECODE_IOC_CHANNEL = 0x10;
+    static constexpr int kDECODE_OLITERAL = 0x20;
+    static constexpr int kDECODE_INDEX_REGISTER_OP = 0x40;
+    static constexpr int kDECODE_PAGE_NUMBER = 0x80;
+    static constexpr int kDECODE_ADRS_LEVEL_BYTE = 0x100;
+    static constexpr int kDECODE_MASK = 0x200;
+    static constexpr int kDECODE_SECTION = 0x400;
+    static constexpr int kDECODE_UV = 0x800;
+    static constexpr int kDECODE_ADRS_BYTE = 0x1000;
+    static constexpr int kDECODE_SECTION_LEVEL = 0x2000;
+    static constexpr int kDECODE_BLITERAL = 0x4000;
+    static constexpr int kDECODE_SHIFT = 0x8000;
+
+    static constexpr size_t kInstructionTypeCount = kIOC + 1;
+
+    //  One entry per eInstructionType, in enum order (defined below the class)
+    static constexpr const std::array<instruction_def, kInstructionTypeCount> &types();
+
+    //  Instruction type of each of the 65536 instruction words (built at compile time in iw.cpp)
+    static const eInstructionType *instr_map();
 
     const std::string as_octal() const
     {
@@ -491,4 +390,77 @@ public:
     }
 };
 
+inline constexpr std::array<iw_t::instruction_def, iw_t::kInstructionTypeCount> iw_instruction_defs = {{
+    iw_t::instruction_def{iw_t::kUnknown, "???", 0b00000000'00000000, 0b00000000'00000000, iw_t::kDECODE_NONE},
+    iw_t::instruction_def{iw_t::kTLJ, "TLJ", 0b00000000'00000000, 0b11100000'00000000, iw_t::kDECODE_JUMP | iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kTMJ, "TMJ", 0b00100000'00000000, 0b11100000'00000000, iw_t::kDECODE_JUMP | iw_t::kDECODE_MASK},
+    iw_t::instruction_def{iw_t::kTLX, "TLX", 0b00000000'00000000, 0b11111111'00000000, iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kTMX, "TMX", 0b00100000'00000000, 0b11111111'00000000, iw_t::kDECODE_MASK},
+    iw_t::instruction_def{iw_t::kBRU, "BRU", 0b01000000'00000000, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kBRE, "BRE", 0b01000000'00000001, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kBRH, "BRH", 0b01001000'00000000, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kBRL, "BRL", 0b01001000'00000001, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kSBU, "SBU", 0b01010000'00000000, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kSBE, "SBE", 0b01010000'00000001, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kSBH, "SBH", 0b01011000'00000000, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kSBL, "SBL", 0b01011000'00000001, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kEXB, "EXB", 0b01110000'00000000, 0b11111000'00000001, iw_t::kDECODE_ADRS_LEVEL_BYTE},
+    iw_t::instruction_def{iw_t::kEXU, "EXU", 0b01100000'00000000, 0b11111111'11111111, iw_t::kDECODE_NONE},
+    iw_t::instruction_def{iw_t::kSMS, "SMS", 0b01101000'00000000, 0b11111111'11000111, iw_t::kDECODE_SECTION},
+    iw_t::instruction_def{iw_t::kSMC, "SMC", 0b01101001'00000000, 0b11111111'00111111, iw_t::kDECODE_UV},
+    iw_t::instruction_def{iw_t::kSSC, "SSC", 0b01101010'00000000, 0b11111111'00000111, iw_t::kDECODE_UV | iw_t::kDECODE_SECTION},
+    iw_t::instruction_def{iw_t::kSAC, "SAC", 0b01101011'00000000, 0b11111111'11111111, 0},
+    iw_t::instruction_def{iw_t::kLSW, "LSW", 0b01101100'00000000, 0b11111111'11111111, 0},
+    iw_t::instruction_def{iw_t::kEMP, "EMP", 0b01101100'00000000, 0b11111111'11111111, 0}, // replaces LSW
+    iw_t::instruction_def{iw_t::kLPS, "LPS", 0b01101101'00000000, 0b11111111'11111111, 0},
+    iw_t::instruction_def{iw_t::kDPI, "DPI", 0b01101110'00000000, 0b11111111'11111111, 0},
+    iw_t::instruction_def{iw_t::kEPI, "EPI", 0b01101110'00000001, 0b11111111'11111111, 0},
+    iw_t::instruction_def{iw_t::kCPI, "CPI", 0b01101110'00000010, 0b11111111'11111111, 0},
+    iw_t::instruction_def{iw_t::kTRM, "TRM", 0b01101111'00000000, 0b11111111'11111111, 0},
+    iw_t::instruction_def{iw_t::kLDA_Imm, "LDA", 0b10000000'00000000, 0b11111111'00000000, iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kLDA_Dir, "LDA", 0b10001000'00000000, 0b11111111'00000000, iw_t::kDECODE_ADRS_BYTE},
+    iw_t::instruction_def{iw_t::kLDA_Ind, "LDA", 0b10001000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER_OP | iw_t::kDECODE_SECTION_LEVEL},
+    iw_t::instruction_def{iw_t::kLDX, "LDX", 0b10000000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER | iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kLIA, "LIA", 0b10010000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER | iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kSTA_Dir, "STA", 0b10011000'00000000, 0b11111111'00000000, iw_t::kDECODE_ADRS_BYTE},
+    iw_t::instruction_def{iw_t::kSTA_Ind, "STA", 0b10011000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER_OP | iw_t::kDECODE_PAGE_NUMBER},
+    iw_t::instruction_def{iw_t::kADA_Imm, "ADA", 0b10100000'00000000, 0b11111111'00000000, iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kADA_Dir, "ADA", 0b10101000'00000000, 0b11111111'00000000, iw_t::kDECODE_ADRS_BYTE},
+    iw_t::instruction_def{iw_t::kADA_Ind, "ADA", 0b10101000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER_OP | iw_t::kDECODE_PAGE_NUMBER},
+    iw_t::instruction_def{iw_t::kADX, "ADX", 0b10100000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER | iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kSUA_Imm, "SUA", 0b10110000'00000000, 0b11111111'00000000, iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kSUA_Dir, "SUA", 0b10111000'00000000, 0b11111111'00000000, iw_t::kDECODE_ADRS_BYTE},
+    iw_t::instruction_def{iw_t::kSUA_Ind, "SUA", 0b10111000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER_OP | iw_t::kDECODE_PAGE_NUMBER},
+    iw_t::instruction_def{iw_t::kSUX, "SUX", 0b10110000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER | iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kANA_Imm, "ANA", 0b11000000'00000000, 0b11111111'00000000, iw_t::kDECODE_BLITERAL},
+    iw_t::instruction_def{iw_t::kANA_Dir, "ANA", 0b11001000'00000000, 0b11111111'00000000, iw_t::kDECODE_ADRS_BYTE},
+    iw_t::instruction_def{iw_t::kANA_Ind, "ANA", 0b11001000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER_OP | iw_t::kDECODE_PAGE_NUMBER},
+    iw_t::instruction_def{iw_t::kSAN, "SAN", 0b11000000'00000000, 0b11111000'00000000, iw_t::kDECODE_SHIFT | iw_t::kDECODE_BLITERAL},
+    iw_t::instruction_def{iw_t::kERA_Imm, "ERA", 0b11010000'00000000, 0b11111111'00000000, iw_t::kDECODE_BLITERAL},
+    iw_t::instruction_def{iw_t::kERA_Dir, "ERA", 0b11011000'00000000, 0b11111111'00000000, iw_t::kDECODE_ADRS_BYTE},
+    iw_t::instruction_def{iw_t::kERA_Ind, "ERA", 0b11011000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER_OP | iw_t::kDECODE_PAGE_NUMBER},
+    iw_t::instruction_def{iw_t::kSER, "SER", 0b11010000'00000000, 0b11111000'00000000, iw_t::kDECODE_SHIFT | iw_t::kDECODE_BLITERAL},
+    iw_t::instruction_def{iw_t::kIRA_Imm, "IRA", 0b11110000'00000000, 0b11111111'00000000, iw_t::kDECODE_BLITERAL},
+    iw_t::instruction_def{iw_t::kIRA_Dir, "IRA", 0b11111000'00000000, 0b11111111'00000000, iw_t::kDECODE_ADRS_BYTE},
+    iw_t::instruction_def{iw_t::kIRA_Ind, "IRA", 0b11111000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER_OP | iw_t::kDECODE_PAGE_NUMBER},
+    iw_t::instruction_def{iw_t::kSIR, "SIR", 0b11110000'00000000, 0b11111000'00000000, iw_t::kDECODE_SHIFT | iw_t::kDECODE_BLITERAL},
+    iw_t::instruction_def{iw_t::kCPA_Imm, "CPA", 0b11100000'00000000, 0b11111111'00000000, iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kCPA_Dir, "CPA", 0b11101000'00000000, 0b11111111'00000000, iw_t::kDECODE_ADRS_BYTE},
+    iw_t::instruction_def{iw_t::kCPA_Ind, "CPA", 0b11101000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER_OP | iw_t::kDECODE_PAGE_NUMBER},
+    iw_t::instruction_def{iw_t::kCPX, "CPX", 0b11100000'00000000, 0b11111000'00000000, iw_t::kDECODE_INDEX_REGISTER | iw_t::kDECODE_LITERAL},
+    iw_t::instruction_def{iw_t::kIOC, "IOC", 0b01111000'00000000, 0b11111000'00000000, iw_t::kDECODE_IOC_CHANNEL | iw_t::kDECODE_OLITERAL | iw_t::kDECODE_IOC}
+}};
+
+constexpr const std::array<iw_t::instruction_def, iw_t::kInstructionTypeCount> &iw_t::types()
+{
+    return iw_instruction_defs;
+}
+
+extern const std::array<iw_t::eInstructionType, 65536> iw_instr_map;
+
+inline const iw_t::eInstructionType *iw_t::instr_map()
+{
+    return iw_instr_map.data();
+}
+
 void test_iw_t();
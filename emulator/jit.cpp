@@ -0,0 +1,523 @@
+#include "jit.hpp"
+#include "cpu.hpp"
+
+#include <cstring>
+#include <stdexcept>
+
+#ifdef ICL_JIT_X86_64
+#include <sys/mman.h>
+#endif
+
+bool jit_t::ends_block(iw_t::eInstructionType type)
+{
+    switch (type)
+    {
+    case iw_t::kTLJ:
+    case iw_t::kTMJ:
+    case iw_t::kTLX:
+    case iw_t::kTMX:
+    case iw_t::kBRU:
+    case iw_t::kBRE:
+    case iw_t::kBRH:
+    case iw_t::kBRL:
+    case iw_t::kSBU:
+    case iw_t::kSBE:
+    case iw_t::kSBH:
+    case iw_t::kSBL:
+    case iw_t::kEXB:
+    case iw_t::kEXU:
+    case iw_t::kIOC:
+        return true;
+    default:
+        return false;
+    }
+}
+
+bool jit_t::translatable(iw_t::eInstructionType type)
+{
+    switch (type)
+    {
+    case iw_t::kLDX:
+    case iw_t::kCPX:
+    case iw_t::kSTA_Ind:
+    case iw_t::kBRL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+#ifdef ICL_JIT_X86_64
+
+//  Called by generated code for stores to watched pages
+static void jit_store(jit_context_t *ctx, uint32_t linear, uint32_t value)
+{
+    (*ctx->memory_object)[linear] = value;
+    if (ctx->jit->take_invalidated())
+        ctx->invalidated = 1;
+}
+
+namespace
+{
+    //  Just enough of an x86-64 assembler for the translator
+    //  rbx: jit_context_t *, r12: memory bytes
+    class emitter_t
+    {
+        uint8_t *p_;
+
+    public:
+        emitter_t(uint8_t *p) : p_(p) {}
+
+        uint8_t *here() const { return p_; }
+
+        void u8(uint8_t v) { *p_++ = v; }
+        void u32(uint32_t v) { memcpy(p_, &v, 4); p_ += 4; }
+        void u64(uint64_t v) { memcpy(p_, &v, 8); p_ += 8; }
+        void bytes(std::initializer_list<uint8_t> bs) { for (auto b : bs) u8(b); }
+
+        //  Leaves a rel32 to be fixed, returns its location
+        uint8_t *rel32() { auto r = p_; u32(0); return r; }
+        static void fix(uint8_t *rel, const uint8_t *target)
+        {
+            int32_t offset = (int32_t)(target - (rel + 4));
+            memcpy(rel, &offset, 4);
+        }
+
+        void disp32(size_t offset) { u32((uint32_t)offset); }
+
+        //  ctx field accesses (mod=10, rm=rbx)
+        void cmp_qword_ctx_imm32(size_t offset, uint32_t imm) { bytes({0x48, 0x81, 0xBB}); disp32(offset); u32(imm); }
+        void sub_qword_ctx_imm32(size_t offset, uint32_t imm) { bytes({0x48, 0x81, 0xAB}); disp32(offset); u32(imm); }
+        void add_qword_ctx_imm32(size_t offset, uint32_t imm) { bytes({0x48, 0x81, 0x83}); disp32(offset); u32(imm); }
+        void mov_rax_ctx(size_t offset) { bytes({0x48, 0x8B, 0x83}); disp32(offset); }
+        void mov_rdx_ctx(size_t offset) { bytes({0x48, 0x8B, 0x93}); disp32(offset); }
+        void mov_ctx_ecx(size_t offset) { bytes({0x89, 0x8B}); disp32(offset); }
+        void movzx_ecx_ctx(size_t offset) { bytes({0x0F, 0xB6, 0x8B}); disp32(offset); }
+        void cmp_dword_ctx_imm8(size_t offset, uint8_t imm) { bytes({0x83, 0xBB}); disp32(offset); u8(imm); }
+        void cmp_byte_ctx_imm8(size_t offset, uint8_t imm) { bytes({0x80, 0xBB}); disp32(offset); u8(imm); }
+        void cmp_rax_ctx(size_t offset) { bytes({0x48, 0x3B, 0x83}); disp32(offset); }
+
+        //  Memory reads (r12 + disp32)
+        void movzx_eax_mem(uint16_t linear) { bytes({0x41, 0x0F, 0xB6, 0x84, 0x24}); disp32(linear); }
+        void movzx_ecx_mem(uint16_t linear) { bytes({0x41, 0x0F, 0xB6, 0x8C, 0x24}); disp32(linear); }
+
+        void mov_eax_imm32(uint32_t imm) { u8(0xB8); u32(imm); }
+        void mov_ecx_imm32(uint32_t imm) { u8(0xB9); u32(imm); }
+        void or_eax_imm32(uint32_t imm) { u8(0x0D); u32(imm); }
+        void add_rax_imm32(uint32_t imm) { bytes({0x48, 0x05}); u32(imm); }
+        void xor_edx_edx() { bytes({0x31, 0xD2}); }
+
+        uint8_t *jmp() { u8(0xE9); return rel32(); }
+        uint8_t *jne() { bytes({0x0F, 0x85}); return rel32(); }
+        uint8_t *jl() { bytes({0x0F, 0x8C}); return rel32(); }
+        uint8_t *jae() { bytes({0x0F, 0x83}); return rel32(); }
+    };
+}
+
+jit_t::jit_t(memory_t &memory) : memory_(memory)
+{
+    void *code = mmap(nullptr, kCodeSize, PROT_READ | PROT_WRITE | PROT_EXEC, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (code == MAP_FAILED)
+        return;
+    code_ = (uint8_t *)code;
+    emit_runtime();
+    flush();
+    flushes_ = 0;
+    memory_.add_observer(this);
+}
+
+jit_t::~jit_t()
+{
+    if (code_)
+    {
+        memory_.remove_observer(this);
+        munmap(code_, kCodeSize);
+    }
+}
+
+//  Trampoline and epilogue, at the start of the buffer and never flushed
+void jit_t::emit_runtime()
+{
+    emitter_t e(code_);
+
+    //  uint32_t trampoline(jit_context_t *ctx, uint8_t *entry)
+    trampoline_ = e.here();
+    e.bytes({0x53});                   // push rbx
+    e.bytes({0x41, 0x54});             // push r12
+    e.bytes({0x55});                   // push rbp (stack is now 16 bytes aligned)
+    e.bytes({0x48, 0x89, 0xFB});       // mov rbx, rdi
+    e.bytes({0x4C, 0x8B, 0xA3});       // mov r12, [rbx + memory]
+    e.disp32(offsetof(jit_context_t, memory));
+    e.bytes({0xFF, 0xE6});             // jmp rsi
+
+    //  eax: next pc, rdx: exit to chain (or 0)
+    epilogue_ = e.here();
+    e.bytes({0x48, 0x89, 0x93});       // mov [rbx + last_exit], rdx
+    e.disp32(offsetof(jit_context_t, last_exit));
+    e.bytes({0x5D});                   // pop rbp
+    e.bytes({0x41, 0x5C});             // pop r12
+    e.bytes({0x5B});                   // pop rbx
+    e.bytes({0xC3});                   // ret
+
+    used_ = e.here() - code_;
+}
+
+void jit_t::flush()
+{
+    blocks_.clear();
+    memset(slots_, 0, sizeof(slots_));
+    memset(covered_, 0, sizeof(covered_));
+    used_ = epilogue_ + 16 - code_;
+    flushes_++;
+}
+
+void jit_t::will_write(uint16_t linear)
+{
+    if (covered_[linear])
+    {
+        flush();
+        invalidated_ = true;
+    }
+}
+
+const jit_block_t &jit_t::block(addrs_t pc)
+{
+    static const jit_block_t no_block{0, 0, 0, nullptr};
+
+    auto linear = pc.linear();
+    if (!code_ || (linear & 1))
+        return no_block;
+
+    auto index = slots_[linear >> 1];
+    if (index)
+        return blocks_[index - 1];
+    return *translate(pc);
+}
+
+//  Stores cl to [r12 + rax], through jit_store() if page is watched
+static void emit_store(emitter_t &e, uint8_t page)
+{
+    e.mov_rdx_ctx(offsetof(jit_context_t, watched_pages));
+    e.bytes({0x48, 0x8B, 0x12});           // mov rdx, [rdx]
+    e.bytes({0x48, 0x0F, 0xBA, 0xE2, page}); // bt rdx, page
+    e.bytes({0x72, 6});                    // jc slow
+    e.bytes({0x41, 0x88, 0x0C, 0x04});     // mov [r12 + rax], cl
+    e.bytes({0xEB, 19});                   // jmp done
+    e.bytes({0x48, 0x89, 0xDF});           // slow: mov rdi, rbx
+    e.bytes({0x89, 0xC6});                 // mov esi, eax
+    e.bytes({0x89, 0xCA});                 // mov edx, ecx
+    e.bytes({0x48, 0xB8});                 // mov rax, jit_store
+    e.u64((uint64_t)&jit_store);
+    e.bytes({0xFF, 0xD0});                 // call rax
+}                                          // done:
+
+//  Chainable exit: the final jmp is the one chain() patches
+static void emit_exit(emitter_t &e, uint16_t pc, uint8_t *epilogue)
+{
+    e.mov_eax_imm32(pc);
+    e.bytes({0x48, 0xBA});                 // mov rdx, address of the jmp
+    e.u64((uint64_t)(e.here() + 8));
+    emitter_t::fix(e.jmp(), epilogue);
+}
+
+const jit_block_t *jit_t::translate(addrs_t start)
+{
+    //  Worst case is around 100 bytes per instruction
+    if (used_ + 256 + kMaxBlockLength * 128 > kCodeSize)
+        flush();
+
+    translations_++;
+
+    //  Early exits (a store hit translated code), by number of instructions done
+    struct early_exit_t
+    {
+        uint8_t *jne;
+        uint16_t done;
+        uint16_t pc;
+        uint32_t cycles;    // of the instructions not done
+    };
+    std::vector<early_exit_t> early_exits;
+
+    //  First pass: find the extent of the block
+    std::vector<std::pair<addrs_t, decoded_iw_t>> instrs;
+    addrs_t pc = start;
+    while (instrs.size() < kMaxBlockLength)
+    {
+        decoded_iw_t instr(memory_.get_instruction(pc));
+        //  R#0 is not an index register, let the interpreter complain
+        bool uses_register = instr.type != iw_t::kBRL;
+        if (!translatable(instr.type) || (uses_register && instr.reg == 0))
+            break;
+        instrs.push_back({pc, instr});
+        memory_.watch_page(pc.page());
+        covered_[pc.linear()] = covered_[(pc + 1).linear()] = 1;
+        pc = pc.next_instruction();
+        if (ends_block(instr.type))
+            break;
+    }
+
+    jit_block_t block{start.linear(), (uint16_t)instrs.size(), 0, nullptr};
+    if (instrs.empty())
+    {
+        //  Not translated, but remember it (and forget it if the instruction changes)
+        memory_.watch_page(start.page());
+        covered_[start.linear()] = covered_[(start + 1).linear()] = 1;
+    }
+    else
+    {
+        emitter_t e(code_ + used_);
+        block.entry = e.here();
+        uint32_t n = instrs.size();
+
+        //  Guest time of the block if no branch is taken
+        uint32_t cycles = 0;
+        for (auto &[ipc, instr] : instrs)
+            cycles += instr.cycles;
+        uint32_t cycles_done = 0;
+        block.lead_cycles = cycles - instrs.back().second.cycles;
+
+        //  Entry: leave if asked to stop, if not enough budget for the whole block,
+        //  or if a device event is due before the last instruction
+        e.mov_rax_ctx(offsetof(jit_context_t, stop));
+        e.bytes({0x80, 0x38, 0x00});       // cmp byte [rax], 0
+        auto stop_exit = e.jne();
+        e.cmp_qword_ctx_imm32(offsetof(jit_context_t, budget), n);
+        auto budget_exit = e.jl();
+        e.mov_rax_ctx(offsetof(jit_context_t, cycles));
+        e.add_rax_imm32(block.lead_cycles);
+        e.cmp_rax_ctx(offsetof(jit_context_t, next_event));
+        auto event_exit = e.jae();
+        e.sub_qword_ctx_imm32(offsetof(jit_context_t, budget), n);
+        e.add_qword_ctx_imm32(offsetof(jit_context_t, cycles), cycles);
+
+        for (size_t i = 0; i != instrs.size(); i++)
+        {
+            auto &[ipc, instr] = instrs[i];
+            bool stores = false;
+            switch (instr.type)
+            {
+            case iw_t::kLDX:
+                e.mov_eax_imm32(instr.reg);
+                e.mov_ecx_imm32(instr.literal());
+                emit_store(e, 0);
+                stores = true;
+                break;
+
+            case iw_t::kCPX:
+                //  compare = (v >= literal) + (v > literal), i.e. kLow, kEqual or kHigh
+                e.movzx_eax_mem(instr.reg);
+                e.bytes({0x3C, instr.literal()});  // cmp al, literal
+                e.bytes({0x0F, 0x93, 0xC1});       // setae cl
+                e.bytes({0x0F, 0x97, 0xC2});       // seta dl
+                e.bytes({0x0F, 0xB6, 0xC9});       // movzx ecx, cl
+                e.bytes({0x0F, 0xB6, 0xD2});       // movzx edx, dl
+                e.bytes({0x01, 0xD1});             // add ecx, edx
+                e.mov_ctx_ecx(offsetof(jit_context_t, compare));
+                break;
+
+            case iw_t::kSTA_Ind:
+            {
+                //  Same address computation as cpu_t::op_STA_Ind
+                uint8_t page = addrs_t(instr.page, 0).page();
+                e.movzx_eax_mem(instr.reg);
+                e.or_eax_imm32(page << 8);
+                e.movzx_ecx_ctx(offsetof(jit_context_t, accumulator));
+                emit_store(e, page);
+                if (instr.mode != iw_t::kUnchanged)
+                {
+                    e.movzx_ecx_mem(instr.reg);
+                    if (instr.mode == iw_t::kIncrement)
+                        e.bytes({0xFE, 0xC1});     // inc cl
+                    else
+                        e.bytes({0xFE, 0xC9});     // dec cl
+                    e.mov_eax_imm32(instr.reg);
+                    emit_store(e, 0);
+                }
+                stores = true;
+                break;
+            }
+
+            case iw_t::kBRL:
+            {
+                addrs_t target{instr.target};
+                target.set_section(ipc.section());
+                e.cmp_dword_ctx_imm8(offsetof(jit_context_t, compare), cpu_t::kLow);
+                auto not_taken = e.jne();
+                if (instr.taken_cycles != instr.cycles)
+                    e.add_qword_ctx_imm32(offsetof(jit_context_t, cycles), instr.taken_cycles - instr.cycles);
+                emit_exit(e, target.linear(), epilogue_);
+                emitter_t::fix(not_taken, e.here());
+                break;
+            }
+
+            default:
+                assert(false);
+            }
+
+            cycles_done += instr.cycles;
+            //  Also after the last instruction: the exit jump may be chained to stale code
+            if (stores)
+            {
+                e.cmp_byte_ctx_imm8(offsetof(jit_context_t, invalidated), 0);
+                early_exits.push_back({e.jne(), (uint16_t)(i + 1), ipc.next_instruction().linear(), cycles - cycles_done});
+            }
+        }
+
+        //  Fall through (after a branch not taken, or before an instruction left to the interpreter)
+        emit_exit(e, pc.linear(), epilogue_);
+
+        //  Out of line exits, that are never chained
+        emitter_t::fix(stop_exit, e.here());
+        emitter_t::fix(budget_exit, e.here());
+        emitter_t::fix(event_exit, e.here());
+        e.mov_eax_imm32(start.linear());
+        e.xor_edx_edx();
+        emitter_t::fix(e.jmp(), epilogue_);
+
+        for (auto &exit : early_exits)
+        {
+            emitter_t::fix(exit.jne, e.here());
+            e.add_qword_ctx_imm32(offsetof(jit_context_t, budget), n - exit.done);
+            e.sub_qword_ctx_imm32(offsetof(jit_context_t, cycles), exit.cycles);
+            e.mov_eax_imm32(exit.pc);
+            e.xor_edx_edx();
+            emitter_t::fix(e.jmp(), epilogue_);
+        }
+
+        used_ = (e.here() - code_ + 15) & ~(size_t)15;
+    }
+
+    blocks_.push_back(block);
+    slots_[start.linear() >> 1] = blocks_.size();
+    return &blocks_.back();
+}
+
+uint16_t jit_t::enter(const jit_block_t &block, jit_context_t &ctx)
+{
+    assert(block.entry);
+    ctx.memory = memory_.bytes();
+    ctx.watched_pages = memory_.watched_pages();
+    ctx.memory_object = &memory_;
+    ctx.jit = this;
+    ctx.invalidated = 0;
+    ctx.last_exit = nullptr;
+    ctx.generation = flushes_;
+    invalidated_ = false;
+
+    auto trampoline = (uint32_t(*)(jit_context_t *, uint8_t *))trampoline_;
+    return trampoline(&ctx, block.entry);
+}
+
+void jit_t::chain(jit_context_t &ctx, const jit_block_t &target)
+{
+    //  Nothing to patch if the code the exit belongs to was thrown away
+    if (!ctx.last_exit || ctx.generation != flushes_ || !target.entry)
+        return;
+    emitter_t::fix((uint8_t *)ctx.last_exit + 1, target.entry);
+    ctx.last_exit = nullptr;
+}
+
+#else
+
+//  No code generation on this host: cpu_t falls back to the threaded core
+
+jit_t::jit_t(memory_t &memory) : memory_(memory) {}
+jit_t::~jit_t() {}
+void jit_t::emit_runtime() {}
+void jit_t::flush() {}
+void jit_t::will_write(uint16_t) {}
+const jit_block_t *jit_t::translate(addrs_t) { return nullptr; }
+
+const jit_block_t &jit_t::block(addrs_t)
+{
+    static const jit_block_t no_block{0, 0, 0, nullptr};
+    return no_block;
+}
+
+uint16_t jit_t::enter(const jit_block_t &, jit_context_t &)
+{
+    throw std::runtime_error("JIT not available on this host");
+}
+
+void jit_t::chain(jit_context_t &, const jit_block_t &) {}
+
+#endif
+
+void test_jit_t()
+{
+    //  Self-modifying code: the STA patches the literal of the CPX that follows
+    //  in the same block, which must be re-translated
+    uint64_t cycles[2];
+    for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreJIT})
+    {
+        memory_t memory;
+        io_t io;
+        memory.copy(addrs_t("P04-000"), vector_from_octal_pairs("201-007 231-004 202-000 342-001 114-021"));
+        cpu_t cpu(memory, io);
+        cpu.set_core(core);
+        cpu.reset();
+        memory.set_addrs(addrs_t(0, 040), addrs_t("P04-000"));
+
+        uint64_t executed;
+        cpu.run(5, executed);
+        assert(executed == 5);
+        assert(cpu.compare_ == cpu_t::kEqual); //  CPX R#2 000, not 001
+        assert(memory.get_addrs(addrs_t(0, 040)) == addrs_t("P04-012"));
+        cycles[core == cpu_t::kCoreJIT] = cpu.cycles();
+    }
+    assert(cycles[0] == cycles[1]);
+
+    //  A store as the last of a full block patches the BRL of the block it is
+    //  chained to, on the third pass of a loop: the chained jump must not be taken
+    std::string errors[2];
+    for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreJIT})
+    {
+        memory_t memory;
+        io_t io;
+        addrs_t pc("P00-076");
+        memory.copy(pc, vector_from_octal_pairs("201-305")); //  LDX R#1 305
+        for (size_t i = 1; i != 64; i++) //  kMaxBlockLength
+            memory.copy(pc = pc.next_instruction(), vector_from_octal_pairs("342-001")); //  CPX R#2 001
+        //  P00-276: STA R#1- (P00-305, 304, then 303), CPX R#2 001, BRL P00-100
+        memory.copy(pc.next_instruction(), vector_from_octal_pairs("231-003 342-001 110-101"));
+        cpu_t cpu(memory, io);
+        cpu.set_core(core);
+        cpu.reset();
+        memory.set_addrs(addrs_t(0, 040), addrs_t("P00-076"));
+        try
+        {
+            cpu.run(1000);
+        }
+        catch (const std::runtime_error &e)
+        {
+            errors[core == cpu_t::kCoreJIT] = e.what();
+        }
+        cycles[core == cpu_t::kCoreJIT] = cpu.cycles();
+    }
+    assert(errors[0].find("BRH") != std::string::npos && errors[0] == errors[1]);
+    assert(cycles[0] == cycles[1]);
+
+    //  Chained blocks, and a budget that ends in the middle of a block
+    for (uint64_t count : {1, 2, 3, 100, 701})
+    {
+        memory_t memories[2];
+        for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreJIT})
+        {
+            auto &memory = memories[core == cpu_t::kCoreJIT];
+            io_t io;
+            //  R#2 counts up to 250, in a loop
+            memory.copy(addrs_t("P01-000"), vector_from_octal_pairs("202-000 203-005 232-022 342-372 111-005"));
+            cpu_t cpu(memory, io);
+            cpu.set_core(core);
+            cpu.reset();
+            uint64_t executed;
+            cpu.run(count, executed);
+            assert(executed == count);
+            cycles[core == cpu_t::kCoreJIT] = cpu.cycles();
+        }
+        assert(cycles[0] == cycles[1]);
+        const memory_t &a = memories[0], &b = memories[1];
+        for (size_t i = 0; i != 16384; i++)
+            assert(a[i] == b[i]);
+    }
+}
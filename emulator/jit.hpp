@@ -0,0 +1,132 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "addrs.hpp"
+#include "iw.hpp"
+#include "memory.hpp"
+
+/*
+    Basic-block translator from DPL-1 to x86-64.
+
+    A block is a straight run of instructions, ending at the first branch,
+    jump, exit or IOC, or before the first instruction the translator does
+    not know. Those are left to the interpreter (see cpu_t::run_jit).
+
+    Generated code is entered through a small trampoline with rbx pointing
+    to a jit_context_t and r12 to the memory bytes. Memory is read directly,
+    writes go through jit_store() whenever the page is watched, so observers
+    (decode cache, the translator itself...) see them.
+
+    A block only runs if no device event (see scheduler.hpp) is due before
+    its last instruction starts, so events are seen at the same instruction
+    as with the interpreters.
+
+    Each exit of a block is a patchable "jmp rel32": once the destination
+    has been translated, the exit is chained to it and the code runs from
+    block to block without returning to the dispatcher.
+
+    A write to a byte of a translated block throws all translations away.
+*/
+
+#if defined(__x86_64__) && defined(__linux__)
+#define ICL_JIT_X86_64 1
+#endif
+
+class jit_t;
+
+//  Everything generated code reads or writes, at fixed offsets
+struct jit_context_t
+{
+    const uint8_t *memory;         // memory_t::bytes()
+    const uint64_t *watched_pages; // memory_t::watched_pages()
+    memory_t *memory_object;       // for jit_store()
+    jit_t *jit;
+    const bool *stop;        // non-zero makes block entries return
+    int64_t budget;          // instructions left to execute
+    uint64_t cycles;         // guest_clock_t::cycles()
+    uint64_t next_event;     // scheduler_t::next_cycle(), blocks that would reach it return
+    uint32_t compare;        // cpu_t::eCompareResult
+    uint8_t accumulator;     // read only, IOC is never translated
+    uint8_t invalidated;     // a store hit translated code, leave the block
+    void *last_exit;         // the "jmp rel32" the last block left from, if chainable
+    uint64_t generation;     // jit_t::flushes() when entered
+};
+
+struct jit_block_t
+{
+    uint16_t pc;        // linear address of first instruction
+    uint16_t length;    // in instructions
+    uint32_t lead_cycles; // from entry to the start of the last instruction
+    uint8_t *entry;     // nullptr if the first instruction cannot be translated
+};
+
+class jit_t : public memory_observer_t
+{
+    static const size_t kCodeSize = 4 * 1024 * 1024;
+    static const size_t kMaxBlockLength = 64;
+
+    memory_t &memory_;
+
+    uint8_t *code_ = nullptr;  // RWX buffer
+    size_t used_ = 0;
+    uint8_t *trampoline_ = nullptr;
+    uint8_t *epilogue_ = nullptr;
+
+    std::vector<jit_block_t> blocks_;
+    uint32_t slots_[16384 / 2];     // block index + 1, per 2-byte slot, 0 if none
+    uint8_t covered_[16384];        // bytes that belong to a translation
+    bool invalidated_ = false;
+
+    uint64_t flushes_ = 0;
+    uint64_t translations_ = 0;
+
+    void emit_runtime();
+    const jit_block_t *translate(addrs_t pc);
+
+public:
+    jit_t(memory_t &memory);
+    ~jit_t();
+
+    jit_t(const jit_t &) = delete;
+    jit_t &operator=(const jit_t &) = delete;
+
+    //  Code generation needs an x86-64 Linux host, and an executable mapping
+    bool available() const { return code_ != nullptr; }
+
+    //  Block starting at pc, translated on first use
+    const jit_block_t &block(addrs_t pc);
+
+    //  Runs from block until an exit that is not chained (or out of budget)
+    //  Returns the linear address of the next instruction to execute
+    uint16_t enter(const jit_block_t &block, jit_context_t &ctx);
+
+    //  Patches the exit ctx.last_exit to jump straight to the target
+    void chain(jit_context_t &ctx, const jit_block_t &target);
+
+    //  Throws away all translations
+    void flush();
+
+    void will_write(uint16_t linear) override;
+
+    //  For jit_store()
+    bool take_invalidated()
+    {
+        bool result = invalidated_;
+        invalidated_ = false;
+        return result;
+    }
+
+    //  Instructions that end a block (they change the flow or talk to devices)
+    static bool ends_block(iw_t::eInstructionType type);
+
+    //  Instructions the translator knows how to generate
+    static bool translatable(iw_t::eInstructionType type);
+
+    uint64_t flushes() const { return flushes_; }
+    uint64_t translations() const { return translations_; }
+};
+
+void test_jit_t();
@@ -8,16 +8,78 @@
 #include "addrs.hpp"
 #include "iw.hpp"
 
+//  Interface for components that cache derived views of memory
+//  (decoded instructions...) and need to know when a byte changes
+class memory_observer_t
+{
+public:
+	virtual ~memory_observer_t() = default;
+
+	//  Called before the byte at linear address is (potentially) modified
+	virtual void will_write(uint16_t linear) = 0;
+};
+
 class memory_t
 {
+public:
+	static const size_t kPageSize = 256;
+	static const size_t kPages = 64;
+
+private:
 	uint8_t data[16384];
 
+	std::vector<memory_observer_t *> observers_;
+	uint64_t watched_pages_ = 0; //  One bit per 256 bytes page, observers are only called for those
+	uint64_t observed_pages_ = 0; //  Asked with watch_page(), for good
+	uint64_t extra_pages_ = 0;    //  Asked with set_extra_watched_pages(), for a while
+
+	void notify(size_t index)
+	{
+		if (!((watched_pages_ >> (index >> 8)) & 1))
+			return;
+		for (auto observer : observers_)
+			observer->will_write(index);
+	}
+
 public:
 	memory_t() { std::fill(std::begin(data), std::end(data), 0); }
 
+	void add_observer(memory_observer_t *observer)
+	{
+		observers_.push_back(observer);
+	}
+
+	void remove_observer(memory_observer_t *observer)
+	{
+		observers_.erase(std::remove(observers_.begin(), observers_.end(), observer), observers_.end());
+	}
+
+	//  Raw access for generated code (see jit.hpp)
+	//  Reads only: writes must go through operator[] so observers are notified
+	const uint8_t *bytes() const { return data; }
+	const uint64_t *watched_pages() const { return &watched_pages_; }
+
+	//  Observers must ask for the pages they care about
+	//  (writes to the stack and index registers in page 0 are then almost free)
+	void watch_page(uint8_t page)
+	{
+		assert(page < 64);
+		observed_pages_ |= 1ull << page;
+		watched_pages_ = observed_pages_ | extra_pages_;
+	}
+
+	//  Pages to watch on top of those, until changed (a debugger watching an address...)
+	void set_extra_watched_pages(uint64_t pages)
+	{
+		extra_pages_ = pages;
+		watched_pages_ = observed_pages_ | extra_pages_;
+	}
+
+	//  Mutable access: observers are told the byte is about to change
 	uint8_t &operator[](size_t index)
 	{
 		assert(index < sizeof(data));
+		notify(index);
 		return data[index];
 	}
 
@@ -73,6 +135,28 @@ public:
 		set(adrs, new_adrs.high(), new_adrs.low());
 	}
 
+	const uint8_t *page(uint8_t page) const
+	{
+		assert(page < kPages);
+		return data + page * kPageSize;
+	}
+
+	//  Replace a page with kPageSize bytes
+	//  Observers are only told about the bytes that change
+	void write_page(uint8_t page, const uint8_t *bytes)
+	{
+		assert(page < kPages);
+		uint8_t *target = data + page * kPageSize;
+		if (std::equal(bytes, bytes + kPageSize, target))
+			return;
+		for (size_t i = 0; i != kPageSize; i++)
+			if (target[i] != bytes[i])
+			{
+				notify(page * kPageSize + i);
+				target[i] = bytes[i];
+			}
+	}
+
 	//  Fill memory from adrs with content of bytes
 	void copy(addrs_t adrs, const std::vector<uint8_t> &bytes)
 	{
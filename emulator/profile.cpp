@@ -0,0 +1,236 @@
+#include "profile.hpp"
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+void profile_t::clear()
+{
+    std::fill(addresses_.begin(), addresses_.end(), counters_t{});
+    std::fill(std::begin(types_), std::end(types_), counters_t{});
+    stacks_.clear();
+}
+
+profile_t::counters_t profile_t::total() const
+{
+    counters_t result;
+    for (auto &counters : types_)
+    {
+        result.executions += counters.executions;
+        result.cycles += counters.cycles;
+        result.taken += counters.taken;
+    }
+    return result;
+}
+
+bool profile_t::conditional(iw_t::eInstructionType type)
+{
+    switch (type)
+    {
+    case iw_t::kTLJ:
+    case iw_t::kTMJ:
+    case iw_t::kBRE:
+    case iw_t::kBRH:
+    case iw_t::kBRL:
+    case iw_t::kSBE:
+    case iw_t::kSBH:
+    case iw_t::kSBL:
+        return true;
+    default:
+        return false;
+    }
+}
+
+std::string profile_t::report(const memory_t &memory, size_t top) const
+{
+    auto totals = total();
+    auto percent = [&](uint64_t cycles) { return totals.cycles ? 100.0 * cycles / totals.cycles : 0.0; };
+
+    std::string text;
+    char line[disassembler_t::kMaxLineLength + 80];
+    disassembler_t disassembler;
+
+    snprintf(line, sizeof(line), "Profile: %llu instructions, %llu cycles (%.3f s guest time)\n\n",
+             (unsigned long long)totals.executions, (unsigned long long)totals.cycles,
+             (double)totals.cycles / guest_clock_t::kCyclesPerSecond);
+    text += line;
+
+    //  Hot spots
+    std::vector<uint16_t> order;
+    for (size_t pc = 0; pc != kSlots; pc++)
+        if (addresses_[pc].executions)
+            order.push_back(pc);
+    std::stable_sort(order.begin(), order.end(), [&](uint16_t a, uint16_t b)
+                     { return addresses_[a].cycles > addresses_[b].cycles; });
+    if (order.size() > top)
+        order.resize(top);
+
+    text += "      cycles      %   executions        taken  instruction\n";
+    for (auto pc : order)
+    {
+        auto &counters = addresses_[pc];
+        int length = snprintf(line, sizeof(line), "%12llu %6.2f %12llu %12llu  ",
+                              (unsigned long long)counters.cycles, percent(counters.cycles),
+                              (unsigned long long)counters.executions, (unsigned long long)counters.taken);
+        addrs_t adrs(pc);
+        length += disassembler.listing_line(adrs, memory.get_instruction(adrs), line + length);
+        text.append(line, length);
+    }
+
+    //  Instruction types
+    std::vector<size_t> types;
+    for (size_t type = 0; type != iw_t::kInstructionTypeCount; type++)
+        if (types_[type].executions)
+            types.push_back(type);
+    std::stable_sort(types.begin(), types.end(), [&](size_t a, size_t b)
+                     { return types_[a].cycles > types_[b].cycles; });
+
+    text += "\n      cycles      %   executions  type\n";
+    for (auto type : types)
+    {
+        auto &counters = types_[type];
+        snprintf(line, sizeof(line), "%12llu %6.2f %12llu  %.*s\n",
+                 (unsigned long long)counters.cycles, percent(counters.cycles),
+                 (unsigned long long)counters.executions,
+                 (int)iw_t::types()[type].mnemonic.size(), iw_t::types()[type].mnemonic.data());
+        text += line;
+    }
+
+    //  Branches, by address
+    text += "\n       taken    not taken  branch\n";
+    for (size_t pc = 0; pc != kSlots; pc++)
+    {
+        auto &counters = addresses_[pc];
+        if (!counters.executions)
+            continue;
+        addrs_t adrs((uint16_t)pc);
+        auto iw = memory.get_instruction(adrs);
+        auto type = iw_t::instr_map()[iw.as_word()];
+        if (!conditional(type) && type != iw_t::kBRU && type != iw_t::kSBU)
+            continue;
+        int length = snprintf(line, sizeof(line), "%12llu %12llu  ",
+                              (unsigned long long)counters.taken,
+                              (unsigned long long)(counters.executions - counters.taken));
+        length += disassembler.listing_line(adrs, iw, line + length);
+        text.append(line, length);
+    }
+    return text;
+}
+
+std::string profile_t::collapsed() const
+{
+    //  sp 0: the instruction alone, what is not counted deeper
+    std::vector<uint64_t> alone(kSlots);
+    for (size_t pc = 0; pc != kSlots; pc++)
+        alone[pc] = addresses_[pc].cycles;
+
+    std::vector<std::pair<std::string, uint64_t>> lines;
+    for (auto &[key, cycles] : stacks_)
+    {
+        std::string frames;
+        uint16_t frame = 0;
+        for (size_t i = 0; i != key.size() / sizeof(uint16_t); i++)
+        {
+            memcpy(&frame, key.data() + i * sizeof(uint16_t), sizeof(frame));
+            if (i)
+                frames += ";";
+            frames += addrs_t(frame).as_string();
+        }
+        alone[frame & (kSlots - 1)] -= cycles;
+        lines.emplace_back(frames, cycles);
+    }
+    for (size_t pc = 0; pc != kSlots; pc++)
+        if (alone[pc])
+            lines.emplace_back(addrs_t((uint16_t)pc).as_string(), alone[pc]);
+
+    std::sort(lines.begin(), lines.end());
+    std::string text;
+    for (auto &[frames, cycles] : lines)
+        text += frames + " " + std::to_string(cycles) + "\n";
+    return text;
+}
+
+void profile_t::save_report(const std::string &path, const memory_t &memory, size_t top) const
+{
+    std::ofstream file(path);
+    file << report(memory, top);
+    if (!file)
+        throw std::runtime_error("Cannot write profile report: " + path);
+}
+
+void profile_t::save_collapsed(const std::string &path) const
+{
+    std::ofstream file(path);
+    file << collapsed();
+    if (!file)
+        throw std::runtime_error("Cannot write collapsed stacks: " + path);
+}
+
+//  The polling program of test_cpu_t, profiled
+static void run_profiled(memory_t &memory, cpu_t::eCore core, bool idle_skip, profile_t &profile, uint64_t &cycles)
+{
+    load_polling_program(memory);
+
+    io_t io;
+    cpu_t cpu(memory, io);
+    cpu.set_core(core);
+    cpu.set_idle_skip(idle_skip);
+    cpu.set_profile(&profile);
+    cpu.reset();
+    run_polling_program(cpu);
+    cycles = cpu.cycles();
+}
+
+void test_profile_t()
+{
+    memory_t memory;
+    profile_t reference;
+    uint64_t reference_cycles;
+    run_profiled(memory, cpu_t::kCoreSwitch, false, reference, reference_cycles);
+
+    //  Every cycle is somewhere
+    auto total = reference.total();
+    assert(total.cycles == reference_cycles);
+
+    //  5 characters stored, the loop ends on the last one
+    auto sta = reference.address(addrs_t("P01-012").linear());
+    assert(sta.executions == 5 && sta.cycles == 5 * 6);
+    auto brl = reference.address(addrs_t("P01-016").linear());
+    assert(brl.executions == 5 && brl.taken == 4);
+    assert(reference.type(iw_t::kSTA_Ind).executions == 5);
+    assert(reference.type(iw_t::kBRU).executions == reference.type(iw_t::kBRU).taken);
+
+    //  Waiting for the tape: the polling loop has most of the time
+    auto ioc = reference.address(addrs_t("P01-004").linear());
+    assert(ioc.cycles > total.cycles / 4);
+
+    //  Idle skip and the cores do not change the counts
+    for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreThreaded, cpu_t::kCoreJIT})
+    {
+        memory_t memory;
+        profile_t profile;
+        uint64_t cycles;
+        run_profiled(memory, core, true, profile, cycles);
+        assert(cycles == reference_cycles);
+        for (size_t pc = 0; pc != profile_t::kSlots; pc++)
+        {
+            auto &a = profile.address(pc), &b = reference.address(pc);
+            assert(a.executions == b.executions && a.cycles == b.cycles && a.taken == b.taken);
+        }
+    }
+
+    auto report = reference.report(memory, 3);
+    assert(report.find("P01-004: 170-207") != std::string::npos);
+    assert(report.find("P01-016: 111-003") != std::string::npos);
+
+    //  Stacks: two levels under a subroutine at P00-100
+    profile_t profile;
+    profile.add(addrs_t("P00-100").linear(), iw_t::kLDX, 4, false);
+    uint16_t frames[] = {addrs_t("P01-020").linear(), addrs_t("P00-100").linear()};
+    profile.add_stack(frames, 2, 4);
+    profile.add(addrs_t("P01-000").linear(), iw_t::kLDX, 4, false);
+    assert(profile.collapsed() == "P01-000 4\nP01-020;P00-100 4\n");
+}
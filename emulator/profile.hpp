@@ -0,0 +1,94 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <unordered_map>
+
+#include "iw.hpp"
+
+class memory_t;
+
+/*
+    Guest profiler.
+
+    When enabled (cpu_t::set_profile()), each executed instruction adds to
+    the counters of its linear address and of its instruction type: how
+    many times it ran, the guest cycles it took (including device waits),
+    and for branches how many times it was taken.
+
+    With subroutines on the IAW stack (sp > 0), the cycles are also
+    accumulated per stack: the IAW of each level below the current one,
+    then the instruction. At sp 0 the stack is the instruction alone, and
+    the per-address counters are used.
+
+    The threaded core has an instantiation with the counting code and one
+    without, so profiling costs nothing when off.
+*/
+
+class profile_t
+{
+public:
+    static const size_t kSlots = 16384;
+    static const size_t kMaxDepth = 32; //  IAW stack levels
+
+    struct counters_t
+    {
+        uint64_t executions = 0;
+        uint64_t cycles = 0;
+        uint64_t taken = 0;
+    };
+
+private:
+    std::vector<counters_t> addresses_;
+    counters_t types_[iw_t::kInstructionTypeCount];
+
+    //  Frames (linear addresses, outermost first) packed in a string, to cycles
+    std::unordered_map<std::string, uint64_t> stacks_;
+
+public:
+    profile_t() : addresses_(kSlots) {}
+
+    profile_t(const profile_t &) = delete;
+    profile_t &operator=(const profile_t &) = delete;
+
+    void add(uint16_t pc, iw_t::eInstructionType type, uint64_t cycles, bool taken, uint64_t times = 1)
+    {
+        auto &address = addresses_[pc & (kSlots - 1)];
+        address.executions += times;
+        address.cycles += cycles * times;
+        address.taken += taken ? times : 0;
+        auto &counters = types_[type];
+        counters.executions += times;
+        counters.cycles += cycles * times;
+        counters.taken += taken ? times : 0;
+    }
+
+    //  depth frames, outermost first, the last one being the instruction
+    void add_stack(const uint16_t *frames, size_t depth, uint64_t cycles)
+    {
+        stacks_[std::string((const char *)frames, depth * sizeof(uint16_t))] += cycles;
+    }
+
+    void clear();
+
+    const counters_t &address(uint16_t pc) const { return addresses_[pc & (kSlots - 1)]; }
+    const counters_t &type(iw_t::eInstructionType type) const { return types_[type]; }
+    counters_t total() const;
+
+    //  Conditional branches, for the taken/not taken counts
+    static bool conditional(iw_t::eInstructionType type);
+
+    //  Addresses sorted by cycles, the top ones with their disassembly,
+    //  then the instruction types, then the branches
+    std::string report(const memory_t &memory, size_t top = 100) const;
+
+    //  Collapsed stacks ("P00-100;P01-002 1234", cycles) for flamegraph.pl and friends
+    std::string collapsed() const;
+
+    //  Throw std::runtime_error if the file cannot be written
+    void save_report(const std::string &path, const memory_t &memory, size_t top = 100) const;
+    void save_collapsed(const std::string &path) const;
+};
+
+void test_profile_t();
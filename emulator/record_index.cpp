@@ -0,0 +1,184 @@
+#include "record_index.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+record_index_t::record_index_t(const tape_t &tape)
+    : tape_(tape)
+{
+    for (size_t r = 0; r != tape.runs(); r++)
+    {
+        auto end = tape.run_end(r);
+        for (auto index = tape.run(r).index; end - index >= kLabelSize; index += kRecordSize)
+        {
+            record_t record;
+            record.sequence = tape[index];
+            record.control = tape[index + 1];
+            for (int i = 0; i != 3; i++)
+                record.pid[i] = tape[index + 4 + i];
+            record.page_allocation = tape[index + 7];
+            record.index = index;
+            record.length = std::min(end - index, kRecordSize);
+            by_pid_[std::string(record.pid_view())].push_back(records_.size());
+            records_.push_back(record);
+            if (record.length < kRecordSize)
+                break;
+        }
+    }
+}
+
+const record_index_t::record_t *record_index_t::find(std::string_view pid, size_t from) const
+{
+    auto it = by_pid_.find(pid);
+    if (it == by_pid_.end())
+        return nullptr;
+    auto &list = it->second;
+    auto found = std::lower_bound(list.begin(), list.end(), from, [&](size_t r, size_t index)
+                                  { return records_[r].index < index; });
+    return found == list.end() ? nullptr : &records_[*found];
+}
+
+const record_index_t::record_t *record_index_t::next(size_t from) const
+{
+    auto found = std::lower_bound(records_.begin(), records_.end(), from, [](const record_t &r, size_t index)
+                                  { return r.index < index; });
+    return found == records_.end() ? nullptr : &*found;
+}
+
+std::vector<uint8_t> record_index_t::data(const record_t &record) const
+{
+    std::vector<uint8_t> result;
+    for (auto i = record.index + kLabelSize; i != record.index + record.length; i++)
+        result.push_back(tape_[i]);
+    return result;
+}
+
+std::vector<uint8_t> record_index_t::extract(std::string_view pid) const
+{
+    std::vector<uint8_t> result;
+    for (auto record = find(pid); record; record = find(pid, record->index + 1))
+    {
+        auto bytes = data(*record);
+        result.insert(result.end(), bytes.begin(), bytes.end());
+    }
+    return result;
+}
+
+std::vector<std::string> record_index_t::pids() const
+{
+    std::vector<std::string> result;
+    for (auto &record : records_)
+        if (by_pid_.find(record.pid_view())->second.front() == (size_t)(&record - records_.data()))
+            result.emplace_back(record.pid_view());
+    return result;
+}
+
+void record_index_t::assemble(std::string_view pid, image_t &image) const
+{
+    memset(image.bytes, 0, sizeof(image.bytes));
+    image.halves = 0;
+    image.records = 0;
+    for (auto record = find(pid); record; record = find(pid, record->index + 1))
+    {
+        auto offset = record->page() * 256 + record->upper_half() * image_t::kHalfPage;
+        for (auto i = record->index + kLabelSize; i != record->index + record->length; i++)
+            image.bytes[offset++] = tape_[i];
+        if (record->length > kLabelSize) //  Not a label alone (end of file)
+            image.halves |= 1ull << (2 * record->page() + record->upper_half());
+        image.records++;
+    }
+}
+
+std::string record_index_t::listing() const
+{
+    std::string result = "SEQ CTL PID       PAGE          LOCATION          LENGTH\n";
+    for (auto &record : records_)
+    {
+        std::string pid;
+        for (auto c : record.pid)
+            pid += c >= ' ' && c < 0177 ? std::string(1, c) : "\\" + to_octal(c);
+        char line[128];
+        snprintf(line, sizeof(line), "%s %s %-9s P%02o %s %s %s  %zu\n",
+                 to_octal(record.sequence).c_str(), to_octal(record.control).c_str(), pid.c_str(),
+                 record.page(), record.upper_half() ? "upper" : "lower", record.relocatable() ? "R" : "-",
+                 location(record).as_string().c_str(), record.length);
+        result += line;
+    }
+    return result;
+}
+
+//  A standard record: label, then data bytes counting from first
+static std::vector<uint8_t> test_record(uint8_t sequence, uint8_t control, const char *pid, uint8_t page_allocation, uint8_t first)
+{
+    std::vector<uint8_t> record{sequence, control, 0, 0, (uint8_t)pid[0], (uint8_t)pid[1], (uint8_t)pid[2], page_allocation};
+    for (size_t i = 0; i != record_index_t::kDataSize; i++)
+        record.push_back(first + i);
+    return record;
+}
+
+void test_record_index_t()
+{
+    //  A program (two records), two overlays, the second one split across a gap, and end of file
+    tape_t tape;
+    auto location = tape_location_t(30.0);
+    auto write = [&](const std::vector<uint8_t> &block)
+    {
+        for (auto byte : block)
+        {
+            tape.append(location, byte);
+            location = location + tape_location_t::one_byte();
+        }
+        location = location + tape_location_t(0.5); //  Inter-record gap
+    };
+    auto main1 = test_record(1, 0, "MAI", (2 << 2) | 1, 0);
+    auto main2 = test_record(2, 0375, "MAI", (2 << 2) | 3, 1);
+    main1.insert(main1.end(), main2.begin(), main2.end()); //  Back to back
+    write(main1);
+    write(test_record(3, 0375, "XYZ", 3 << 2, 2));
+    write(test_record(4, 0375, "ABC", 4 << 2, 3));
+    write(test_record(5, 0375, "XYZ", 3 << 2 | 2, 4));
+    write({6, 0377, 0, 0, 0, 0, 0, 0});
+    write({1, 2, 3}); //  Noise
+
+    record_index_t index(tape);
+    assert(index.size() == 6);
+    assert(index[1].sequence == 2 && index[1].end_of_load() && index[1].index == record_index_t::kRecordSize);
+    assert(index[1].page() == 2 && index[1].upper_half() && index[1].relocatable());
+    assert(index[5].end_of_file() && index[5].length == record_index_t::kLabelSize);
+    assert(index.data(index[5]).empty());
+
+    //  Searching forward from the head
+    auto xyz = index.find("XYZ");
+    assert(xyz && xyz->sequence == 3);
+    assert(index.location(*xyz) == tape.location(2 * record_index_t::kRecordSize));
+    assert(tape.location(xyz->index).inches() > index.location(index[1]).inches() + 0.5);
+    auto second = index.find("XYZ", xyz->index + 1);
+    assert(second && second->sequence == 5 && second->upper_half());
+    assert(!index.find("XYZ", second->index + 1));
+    assert(!index.find("QQQ"));
+    assert(index.next(xyz->index + 1)->sequence == 4);
+    assert(!index.next(tape.size()));
+
+    //  Extracting an overlay
+    auto overlay = index.extract("XYZ");
+    assert(overlay.size() == 2 * record_index_t::kDataSize);
+    assert(overlay[0] == 2 && overlay[record_index_t::kDataSize] == 4);
+
+    //  Reassembling: both halves of page 3 for XYZ, lower half of page 2 for MAI (twice)
+    assert((index.pids() == std::vector<std::string>{"MAI", "XYZ", "ABC", std::string(3, '\0')}));
+    record_index_t::image_t image;
+    index.assemble("XYZ", image);
+    assert(image.records == 2 && image.halves == (3ull << 6));
+    assert(image.loaded(3, false) && image.loaded(3, true) && !image.loaded(2, false));
+    assert(image.bytes[3 * 256] == 2 && image.bytes[3 * 256 + 128] == 4 && image.bytes[3 * 256 + 255] == 131);
+    index.assemble("MAI", image);
+    assert(image.records == 2 && image.halves == (3ull << 4));
+    assert(image.bytes[2 * 256] == 0 && image.bytes[2 * 256 + 128] == 1);
+    index.assemble(std::string(3, '\0'), image);
+    assert(image.records == 1 && !image.halves);
+
+    auto listing = index.listing();
+    assert(listing.find("003 375 XYZ       P03 lower -") != std::string::npos);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <map>
+
+#include "tape.hpp"
+
+/*
+    Index of the records of a Mini-Tape.
+
+    A Standard C4 Program Record is an 8 bytes label followed by 128 data
+    bytes (System Programmers Manual, section 8):
+
+        1    sequence number, from 001, wrapping around
+        2    control: 375 end of program load, 377 end of file
+        3-4  not used
+        5-7  PID, the SEG or OVL identifier (not used in data files)
+        8    page allocation (not used in data files)
+
+    Records are the blocks of bytes between two gaps of the tape (the runs
+    of tape_t). A block longer than a record is taken as records written
+    back to back. Blocks shorter than a label are not records.
+
+    The tape is scanned once. Records are then found by PID, or by their
+    position, with binary searches.
+
+    A program is reassembled by putting the data of each of its records in
+    the half page given by its page allocation (assemble()).
+*/
+
+class record_index_t
+{
+public:
+    static constexpr size_t kLabelSize = 8;
+    static constexpr size_t kDataSize = 128;
+    static constexpr size_t kRecordSize = kLabelSize + kDataSize;
+
+    static constexpr uint8_t kControlEndOfLoad = 0375;
+    static constexpr uint8_t kControlEndOfFile = 0377;
+
+    struct record_t
+    {
+        uint8_t sequence;
+        uint8_t control;
+        uint8_t pid[3];
+        uint8_t page_allocation;
+        size_t index;  //  First byte of the label on the tape
+        size_t length; //  Label included, kRecordSize for a standard record
+
+        //  Page allocation: bits 6-2 page, bit 1 upper half, bit 0 relocatable
+        uint8_t page() const { return (page_allocation >> 2) & 037; }
+        bool upper_half() const { return page_allocation & 2; }
+        bool relocatable() const { return page_allocation & 1; }
+
+        std::string_view pid_view() const { return std::string_view((const char *)pid, 3); }
+        bool end_of_file() const { return control == kControlEndOfFile; }
+        bool end_of_load() const { return control == kControlEndOfLoad; }
+    };
+
+    //  A program, as loaded in memory
+    struct image_t
+    {
+        static const size_t kPages = 32; //  DPL pages of the page allocation byte
+        static const size_t kHalfPage = 128;
+
+        uint8_t bytes[kPages * 256];
+        uint64_t halves;  //  Bit 2 * page + upper half, for the half pages loaded
+        size_t records;
+
+        bool loaded(size_t page, bool upper) const { return halves >> (2 * page + upper) & 1; }
+    };
+
+private:
+    const tape_t &tape_;
+    std::vector<record_t> records_; //  In tape order
+
+    //  PID to records, in tape order
+    std::map<std::string, std::vector<size_t>, std::less<>> by_pid_;
+
+public:
+    //  The tape must outlive the index
+    explicit record_index_t(const tape_t &tape);
+
+    const std::vector<record_t> &records() const { return records_; }
+    size_t size() const { return records_.size(); }
+    const record_t &operator[](size_t i) const { return records_[i]; }
+
+    //  First record with pid whose label starts at or after tape index from, nullptr if none
+    const record_t *find(std::string_view pid, size_t from = 0) const;
+
+    //  First record whose label starts at or after tape index from, nullptr if none
+    const record_t *next(size_t from) const;
+
+    tape_location_t location(const record_t &record) const { return tape_.location(record.index); }
+
+    //  The data bytes (at most kDataSize, fewer if the record is short)
+    std::vector<uint8_t> data(const record_t &record) const;
+
+    //  The data of all the records with pid, in tape order
+    std::vector<uint8_t> extract(std::string_view pid) const;
+
+    //  PIDs, in the order they first appear on the tape
+    std::vector<std::string> pids() const;
+
+    //  The records of pid into image, later ones overwriting earlier ones
+    //  Short records leave the end of their half page as it was (zero)
+    void assemble(std::string_view pid, image_t &image) const;
+
+    //  One line per record
+    std::string listing() const;
+};
+
+void test_record_index_t();
@@ -0,0 +1,260 @@
+#include "sampler.hpp"
+#include "cpu.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <stdexcept>
+
+sampler_t::sampler_t(const cpu_t &cpu, const memory_t &memory, scheduler_t &scheduler, size_t capacity)
+    : cpu_(cpu), memory_(memory), scheduler_(scheduler)
+{
+    size_t size = 1;
+    while (size < capacity)
+        size <<= 1;
+    samples_.resize(size);
+    mask_ = size - 1;
+}
+
+void sampler_t::start(eMode mode, uint64_t interval, uint64_t now)
+{
+    stop();
+    if (mode == kOff || interval == 0)
+        return;
+    mode_ = mode;
+    interval_ = interval;
+    if (mode == kHostTime)
+    {
+        deadline_ = std::chrono::steady_clock::now() + std::chrono::microseconds(interval);
+        scheduler_.post(now + kHostPollCycles, this, 0, true);
+    }
+    else
+        scheduler_.post(now + interval, this, 0, true);
+}
+
+void sampler_t::stop()
+{
+    mode_ = kOff;
+    scheduler_.cancel(this);
+}
+
+void sampler_t::record(uint64_t cycle)
+{
+    auto pc = cpu_.pc();
+    auto iw = memory_.get_instruction(pc);
+    auto &sample = samples_[written_++ & mask_];
+    sample.cycle = cycle;
+    sample.pc = pc.linear();
+    sample.sp = cpu_.stack_level();
+    sample.iwl = iw.iwl();
+    sample.iwr = iw.iwr();
+}
+
+void sampler_t::on_event(uint64_t cycle, uint32_t tag)
+{
+    if (mode_ == kGuestCycles)
+    {
+        record(cycle);
+        scheduler_.post(cycle + interval_, this, 0, true);
+        return;
+    }
+
+    auto now = std::chrono::steady_clock::now();
+    if (now >= deadline_)
+    {
+        record(cycle);
+        deadline_ += std::chrono::microseconds(interval_);
+        if (deadline_ < now) //  Far behind (host stalled): do not burst
+            deadline_ = now + std::chrono::microseconds(interval_);
+    }
+    scheduler_.post(cycle + kHostPollCycles, this, 0, true);
+}
+
+std::vector<sample_t> sampler_t::snapshot() const
+{
+    auto begin = written_ > capacity() ? written_ - capacity() : 0;
+    std::vector<sample_t> result;
+    result.reserve(written_ - begin);
+    for (auto i = begin; i != written_; i++)
+        result.push_back(samples_[i & mask_]);
+    return result;
+}
+
+void sampler_t::save(const std::string &path) const
+{
+    auto samples = snapshot();
+
+    sample_file_header_t header{};
+    memcpy(header.magic, "ICLSAMPL", 8);
+    header.version = kVersion;
+    header.record_size = sizeof(sample_t);
+    header.count = samples.size();
+    header.dropped = dropped();
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)samples.data(), samples.size() * sizeof(sample_t));
+    if (!file)
+        throw std::runtime_error("Cannot write sample file: " + path);
+}
+
+std::vector<sample_t> sampler_t::load(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Cannot open sample file: " + path);
+
+    sample_file_header_t header;
+    if (!file.read((char *)&header, sizeof(header)) || memcmp(header.magic, "ICLSAMPL", 8) != 0)
+        throw std::runtime_error("Not a sample file: " + path);
+    if (header.version != kVersion || header.record_size != sizeof(sample_t))
+        throw std::runtime_error("Unsupported sample file version: " + path);
+
+    //  Not more than the file holds, whatever the header says
+    auto start = file.tellg();
+    file.seekg(0, std::ios::end);
+    auto available = (uint64_t)(file.tellg() - start) / sizeof(sample_t);
+    file.seekg(start);
+    if (header.count > available)
+        throw std::runtime_error("Truncated sample file: " + path);
+
+    std::vector<sample_t> samples(header.count);
+    if (!file.read((char *)samples.data(), samples.size() * sizeof(sample_t)))
+        throw std::runtime_error("Truncated sample file: " + path);
+    return samples;
+}
+
+std::vector<sampler_t::bucket_t> sampler_t::histogram(const std::vector<sample_t> &samples)
+{
+    //  Key: sp and pc
+    std::map<uint32_t, bucket_t> buckets;
+    for (auto &sample : samples)
+    {
+        auto &bucket = buckets[(uint32_t)sample.sp << 16 | sample.pc];
+        if (bucket.count == 0)
+            bucket = {sample.pc, sample.sp, sample.iwl, sample.iwr, 0};
+        bucket.count++;
+    }
+
+    std::vector<bucket_t> result;
+    for (auto &[key, bucket] : buckets)
+        result.push_back(bucket);
+    std::stable_sort(result.begin(), result.end(), [](const bucket_t &a, const bucket_t &b)
+                     { return a.count > b.count; });
+    return result;
+}
+
+std::string sampler_t::report(const std::vector<sample_t> &samples, size_t top)
+{
+    auto buckets = histogram(samples);
+    if (buckets.size() > top)
+        buckets.resize(top);
+
+    std::string text;
+    char line[disassembler_t::kMaxLineLength + 40];
+    disassembler_t disassembler;
+
+    snprintf(line, sizeof(line), "%zu samples\n\n     samples      %%  sp  instruction\n", samples.size());
+    text += line;
+    for (auto &bucket : buckets)
+    {
+        int length = snprintf(line, sizeof(line), "%12llu %6.2f %3d  ",
+                              (unsigned long long)bucket.count, 100.0 * bucket.count / samples.size(), bucket.sp);
+        length += disassembler.listing_line(addrs_t(bucket.pc), iw_t(bucket.iwl, bucket.iwr), line + length);
+        text.append(line, length);
+    }
+    return text;
+}
+
+//  The polling program of test_cpu_t, sampled every interval cycles
+static std::vector<sample_t> run_sampled(cpu_t::eCore core, bool idle_skip, uint64_t interval, uint64_t &cycles)
+{
+    memory_t memory;
+    load_polling_program(memory);
+
+    io_t io;
+    cpu_t cpu(memory, io);
+    cpu.set_core(core);
+    cpu.set_idle_skip(idle_skip);
+    cpu.reset();
+    sampler_t sampler(cpu, memory, io.scheduler(), 1 << 20);
+    sampler.start(sampler_t::kGuestCycles, interval, cpu.cycles());
+    run_polling_program(cpu);
+    cycles = cpu.cycles();
+    assert(sampler.dropped() == 0);
+    return sampler.snapshot();
+}
+
+void test_sampler_t()
+{
+    uint64_t reference_cycles;
+    auto reference = run_sampled(cpu_t::kCoreSwitch, false, 1000, reference_cycles);
+    assert(reference.size() == reference_cycles / 1000);
+
+    //  Nearly all the time in the polling loop (CPX, IOC, BRL)
+    auto buckets = sampler_t::histogram(reference);
+    assert(buckets.size() >= 3);
+    uint64_t polling = 0;
+    for (size_t i = 0; i != 3; i++)
+    {
+        auto pc = buckets[i].pc;
+        assert(pc == addrs_t("P01-002").linear() || pc == addrs_t("P01-004").linear() || pc == addrs_t("P01-010").linear());
+        assert(buckets[i].sp == 0);
+        polling += buckets[i].count;
+    }
+    assert(polling > reference.size() * 99 / 100);
+
+    //  Sampling events are at fixed cycles: the same samples for every core, with or without idle skip
+    for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreThreaded, cpu_t::kCoreJIT})
+    {
+        uint64_t cycles;
+        auto samples = run_sampled(core, true, 1000, cycles);
+        assert(cycles == reference_cycles);
+        assert(samples.size() == reference.size());
+        assert(memcmp(samples.data(), reference.data(), samples.size() * sizeof(sample_t)) == 0);
+    }
+
+    //  Round trip through a file
+    auto path = test_path("samples");
+    memory_t memory;
+    io_t io;
+    cpu_t cpu(memory, io);
+    sampler_t sampler(cpu, memory, io.scheduler(), 4);
+    sampler.start(sampler_t::kGuestCycles, 10, 0);
+    io.scheduler().run_until(100);
+    assert(sampler.written() == 10 && sampler.dropped() == 6);
+    sampler.save(path);
+    auto loaded = sampler_t::load(path);
+    assert(loaded.size() == 4 && loaded[0].cycle == 70 && loaded[3].cycle == 100);
+
+    //  A count that the file does not hold
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        uint64_t count = 1ull << 60;
+        file.seekp(offsetof(sample_file_header_t, count));
+        file.write((const char *)&count, sizeof(count));
+    }
+    bool thrown = false;
+    try
+    {
+        sampler_t::load(path);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    std::remove(path.c_str());
+
+    //  Sampling alone is nothing to wait for
+    assert(io.scheduler().device_pending());
+    io.tape_reader(1).stop(100);
+    assert(!io.scheduler().empty() && !io.scheduler().device_pending());
+    sampler.stop();
+    assert(io.scheduler().empty());
+
+    assert(sampler_t::report(reference).find("P01-004: 170-207") != std::string::npos);
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <chrono>
+
+#include "scheduler.hpp"
+
+class cpu_t;
+class memory_t;
+
+/*
+    Sampling profiler.
+
+    Records the guest pc, its instruction and the IAW stack level at a
+    regular interval, into a preallocated ring buffer. The interval is
+    either a number of guest cycles, or a host period (checked every
+    kHostPollCycles guest cycles).
+
+    Sampling is a background scheduler event: the cores already compare
+    the clock with the next event between instructions, and translated
+    blocks already exit before one, so the fast paths are unchanged. The
+    cost is one event every interval.
+
+    Samples are aggregated offline (histogram(), icl1501-trace --samples).
+
+    File format: sample_file_header_t, then the samples, oldest first.
+*/
+
+struct sample_t
+{
+    uint64_t cycle;   // guest time of the sample
+    uint16_t pc;      // linear address of the next instruction
+    uint8_t sp;       // IAW stack level
+    uint8_t iwl;      // instruction at pc
+    uint8_t iwr;
+    uint8_t reserved[3];
+};
+
+static_assert(sizeof(sample_t) == 16);
+
+struct sample_file_header_t
+{
+    char magic[8];    // "ICLSAMPL"
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+    uint64_t dropped; // older samples overwritten in the ring
+};
+
+class sampler_t : public event_handler_t
+{
+public:
+    typedef enum
+    {
+        kOff,
+        kGuestCycles, // every interval guest cycles
+        kHostTime,    // every interval host microseconds
+    } eMode;
+
+    static const uint32_t kVersion = 1;
+    static const uint64_t kHostPollCycles = 1000;
+
+private:
+    const cpu_t &cpu_;
+    const memory_t &memory_;
+    scheduler_t &scheduler_;
+
+    std::vector<sample_t> samples_;
+    uint64_t mask_;
+    uint64_t written_ = 0;
+
+    eMode mode_ = kOff;
+    uint64_t interval_ = 0;
+    std::chrono::steady_clock::time_point deadline_;
+
+    void record(uint64_t cycle);
+
+public:
+    //  capacity is rounded up to a power of two
+    sampler_t(const cpu_t &cpu, const memory_t &memory, scheduler_t &scheduler, size_t capacity = 65536);
+    ~sampler_t() { scheduler_.cancel(this); }
+
+    sampler_t(const sampler_t &) = delete;
+    sampler_t &operator=(const sampler_t &) = delete;
+
+    //  now is the current guest cycle (cpu_t::cycles())
+    void start(eMode mode, uint64_t interval, uint64_t now);
+    void stop();
+
+    eMode mode() const { return mode_; }
+    size_t capacity() const { return samples_.size(); }
+    uint64_t written() const { return written_; }
+    uint64_t dropped() const { return written_ > capacity() ? written_ - capacity() : 0; }
+    void clear() { written_ = 0; }
+
+    //  Oldest first
+    std::vector<sample_t> snapshot() const;
+
+    void on_event(uint64_t cycle, uint32_t tag) override;
+
+    //  Throws std::runtime_error if the file cannot be written
+    void save(const std::string &path) const;
+
+    //  Throws std::runtime_error if the file cannot be read or is not a sample file
+    static std::vector<sample_t> load(const std::string &path);
+
+    struct bucket_t
+    {
+        uint16_t pc;
+        uint8_t sp;
+        uint8_t iwl;
+        uint8_t iwr;
+        uint64_t count;
+    };
+
+    //  Samples per (pc, stack level), most frequent first
+    static std::vector<bucket_t> histogram(const std::vector<sample_t> &samples);
+
+    //  histogram() with percentages and disassembly
+    static std::string report(const std::vector<sample_t> &samples, size_t top = 50);
+};
+
+void test_sampler_t();
@@ -0,0 +1,80 @@
+#include "scheduler.hpp"
+#include "cpu.hpp"
+
+#include <cassert>
+
+namespace
+{
+    //  Logs its events, and when the CPU saw them
+    class logger_t : public event_handler_t
+    {
+    public:
+        scheduler_t &scheduler;
+        const cpu_t *cpu = nullptr;
+        uint64_t period = 0;
+        std::vector<std::pair<uint64_t, uint32_t>> log;
+
+        logger_t(scheduler_t &s) : scheduler(s) {}
+
+        void on_event(uint64_t cycle, uint32_t tag) override
+        {
+            log.push_back({cpu ? cpu->cycles() : cycle, tag});
+            if (period)
+                scheduler.post(cycle + period, this, tag + 1);
+        }
+    };
+}
+
+void test_scheduler_t()
+{
+    {
+        scheduler_t scheduler;
+        logger_t logger(scheduler);
+        assert(scheduler.next_cycle() == scheduler_t::kNever);
+
+        //  Ordered by cycle, then by posting order
+        scheduler.post(30, &logger, 3);
+        scheduler.post(10, &logger, 1);
+        scheduler.post(20, &logger, 2);
+        scheduler.post(10, &logger, 11);
+        scheduler.post(40, &logger, 4);
+        assert(scheduler.next_cycle() == 10);
+
+        scheduler.run_until(9);
+        assert(logger.log.empty());
+
+        scheduler.cancel(&logger, 3);
+        scheduler.run_until(35);
+        assert((logger.log == std::vector<std::pair<uint64_t, uint32_t>>{{10, 1}, {10, 11}, {20, 2}}));
+        assert(scheduler.next_cycle() == 40);
+
+        scheduler.cancel(&logger);
+        assert(scheduler.empty());
+        assert(scheduler.next_cycle() == scheduler_t::kNever);
+    }
+
+    //  All cores see events at the same instruction
+    std::vector<std::pair<uint64_t, uint32_t>> reference;
+    for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreThreaded, cpu_t::kCoreJIT})
+    {
+        memory_t memory;
+        io_t io;
+        //  R#2 counts up to 250, in a loop
+        memory.copy(addrs_t("P01-000"), vector_from_octal_pairs("202-000 203-005 232-022 342-372 111-005"));
+        cpu_t cpu(memory, io);
+        cpu.set_core(core);
+        cpu.reset();
+
+        logger_t logger(io.scheduler());
+        logger.cpu = &cpu;
+        logger.period = 37;
+        io.scheduler().post(5, &logger, 0);
+        cpu.run(600);
+        io.scheduler().cancel(&logger);
+
+        assert(logger.log.size() > 50);
+        if (core == cpu_t::kCoreSwitch)
+            reference = logger.log;
+        assert(logger.log == reference);
+    }
+}
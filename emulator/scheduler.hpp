@@ -0,0 +1,126 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <algorithm>
+#include <limits>
+
+/*
+    Device timing.
+
+    Devices post events at a future guest cycle (see clock.hpp), and are
+    called back when the CPU reaches it. The CPU only compares its cycle
+    counter with next_cycle() between instructions: devices are never polled.
+
+    When the CPU has to wait for a device (blocking IOC), it jumps directly
+    to the next event. Background events (the sampling profiler...) are
+    not something to wait for: device_pending() ignores them.
+*/
+
+//  Interface for devices that receive scheduled events
+class event_handler_t
+{
+public:
+    virtual ~event_handler_t() = default;
+
+    //  Called once the CPU reached (or passed) the event cycle
+    //  tag is whatever the device passed to post()
+    virtual void on_event(uint64_t cycle, uint32_t tag) = 0;
+};
+
+class scheduler_t
+{
+public:
+    static const uint64_t kNever = std::numeric_limits<uint64_t>::max();
+
+private:
+    struct event_t
+    {
+        uint64_t cycle;
+        uint64_t sequence; //  Events at the same cycle run in posting order
+        event_handler_t *handler;
+        uint32_t tag;
+        bool background;
+
+        //  std heaps are max-heaps
+        bool operator<(const event_t &other) const
+        {
+            if (cycle != other.cycle)
+                return cycle > other.cycle;
+            return sequence > other.sequence;
+        }
+    };
+
+    std::vector<event_t> events_; //  Heap, earliest on front
+    uint64_t next_cycle_ = kNever;
+    uint64_t sequence_ = 0;
+    uint64_t dispatched_ = 0;
+    size_t background_ = 0; //  Pending background events
+
+    void update_next()
+    {
+        next_cycle_ = events_.empty() ? kNever : events_.front().cycle;
+    }
+
+public:
+    //  The only thing the CPU looks at between instructions
+    uint64_t next_cycle() const { return next_cycle_; }
+    const uint64_t *next_cycle_ptr() const { return &next_cycle_; }
+
+    bool empty() const { return events_.empty(); }
+    bool device_pending() const { return events_.size() != background_; }
+    size_t size() const { return events_.size(); }
+    uint64_t dispatched() const { return dispatched_; }
+
+    void post(uint64_t cycle, event_handler_t *handler, uint32_t tag = 0, bool background = false)
+    {
+        events_.push_back({cycle, sequence_++, handler, tag, background});
+        background_ += background;
+        std::push_heap(events_.begin(), events_.end());
+        update_next();
+    }
+
+    //  Removes the pending events of handler with this tag
+    void cancel(event_handler_t *handler, uint32_t tag)
+    {
+        auto end = std::remove_if(events_.begin(), events_.end(), [&](const event_t &e)
+                                  { return e.handler == handler && e.tag == tag; });
+        if (end == events_.end())
+            return;
+        events_.erase(end, events_.end());
+        background_ = std::count_if(events_.begin(), events_.end(), [](const event_t &e) { return e.background; });
+        std::make_heap(events_.begin(), events_.end());
+        update_next();
+    }
+
+    //  Removes all pending events of handler
+    void cancel(event_handler_t *handler)
+    {
+        auto end = std::remove_if(events_.begin(), events_.end(), [&](const event_t &e)
+                                  { return e.handler == handler; });
+        if (end == events_.end())
+            return;
+        events_.erase(end, events_.end());
+        background_ = std::count_if(events_.begin(), events_.end(), [](const event_t &e) { return e.background; });
+        std::make_heap(events_.begin(), events_.end());
+        update_next();
+    }
+
+    //  Calls the handlers of all events due at cycle, in order
+    //  Handlers may post new events, which run too if already due
+    void run_until(uint64_t cycle)
+    {
+        while (next_cycle_ <= cycle)
+        {
+            std::pop_heap(events_.begin(), events_.end());
+            event_t event = events_.back();
+            events_.pop_back();
+            background_ -= event.background;
+            update_next();
+            dispatched_++;
+            event.handler->on_event(event.cycle, event.tag);
+        }
+    }
+};
+
+void test_scheduler_t();
@@ -0,0 +1,88 @@
+#include "snapshot.hpp"
+
+#include <cstring>
+
+snapshot_t::snapshot_t(const memory_t &memory, const cpu_t &cpu, const io_t &io, const snapshot_t *parent)
+    : cpu_(cpu.state()), io_(io.state())
+{
+    for (size_t page = 0; page != memory_t::kPages; page++)
+    {
+        auto bytes = memory.page(page);
+        if (parent && memcmp(parent->pages_[page]->data(), bytes, memory_t::kPageSize) == 0)
+            pages_[page] = parent->pages_[page];
+        else
+        {
+            auto copy = std::make_shared<page_t>();
+            memcpy(copy->data(), bytes, memory_t::kPageSize);
+            pages_[page] = std::move(copy);
+        }
+    }
+}
+
+void snapshot_t::restore(memory_t &memory, cpu_t &cpu, io_t &io) const
+{
+    for (size_t page = 0; page != memory_t::kPages; page++)
+        memory.write_page(page, pages_[page]->data());
+    cpu.restore(cpu_);
+    io.restore(io_);
+}
+
+size_t snapshot_t::shared_pages(const snapshot_t &other) const
+{
+    size_t count = 0;
+    for (size_t page = 0; page != memory_t::kPages; page++)
+        count += pages_[page] == other.pages_[page];
+    return count;
+}
+
+void test_snapshot_t()
+{
+    memory_t memory;
+    load_polling_program(memory);
+    io_t io;
+    cpu_t cpu(memory, io);
+    cpu.reset();
+
+    //  Two characters read, waiting for the third
+    while (memory[addrs_t(0, 031)] == 0)
+        cpu.run(1000);
+    assert(memory[addrs_t(0, 032)] == 0);
+    snapshot_t boot(memory, cpu, io);
+    assert(boot[addrs_t(0, 031).linear()] == 2);
+
+    run_polling_program(cpu);
+    auto cycles = cpu.cycles();
+    snapshot_t reference(memory, cpu, io, &boot);
+    assert(reference.shared_pages(boot) == memory_t::kPages - 1); //  Only page 0 changed
+    assert(memory[addrs_t(0, 034)] == 5);
+
+    //  Again from the snapshot, with each core
+    for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreThreaded, cpu_t::kCoreJIT})
+    {
+        boot.restore(memory, cpu, io);
+        assert(memory[addrs_t(0, 032)] == 0);
+        assert(cpu.cycles() == boot.cpu().cycles);
+        cpu.set_core(core);
+        run_polling_program(cpu);
+        assert(cpu.cycles() == cycles);
+        snapshot_t child(memory, cpu, io, &boot);
+        assert(child.shared_pages(boot) == memory_t::kPages - 1);
+        for (size_t i = 0; i != 16384; i++)
+            assert(child[i] == reference[i]);
+        assert(io.accumulator() == reference.io().accumulator);
+    }
+
+    //  Into another machine with the same tape
+    memory_t other_memory;
+    io_t other_io;
+    cpu_t other_cpu(other_memory, other_io);
+    boot.restore(other_memory, other_cpu, other_io);
+    run_polling_program(other_cpu);
+    assert(other_cpu.cycles() == cycles);
+    for (size_t i = 0; i != 16384; i++)
+        assert(other_memory[i] == reference[i]);
+
+    //  Copies share everything
+    snapshot_t fork = boot;
+    assert(fork.shared_pages(boot) == memory_t::kPages);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+#include <cstdint>
+#include <array>
+#include <memory>
+
+#include "memory.hpp"
+#include "cpu.hpp"
+#include "io.hpp"
+
+/*
+    Machine snapshots.
+
+    A snapshot holds the 16KB of memory, the CPU registers that are not in
+    memory (sp, compare, guest clock) and the device state (accumulator,
+    tape index, tape readers). Taking or restoring one costs a few
+    microseconds.
+
+    Memory is kept as 64 shared, immutable pages of 256 bytes. A snapshot
+    taken with a parent only allocates the pages that differ from it, and
+    a copy of a snapshot shares all of them. To fan out experiments from a
+    booted machine: take a snapshot once, then for each run restore it,
+    run, and take the result with the first snapshot as parent. Each result
+    only costs the pages the run changed.
+
+    Background events (sampler_t) are not part of the machine: restoring
+    leaves them as they are. Tapes are not copied: a snapshot is restored
+    with the same tapes mounted.
+*/
+
+class snapshot_t
+{
+public:
+    typedef std::array<uint8_t, memory_t::kPageSize> page_t;
+
+private:
+    std::array<std::shared_ptr<const page_t>, memory_t::kPages> pages_;
+    cpu_t::state_t cpu_;
+    io_t::state_t io_;
+
+public:
+    //  Pages equal to the parent's are shared with it
+    snapshot_t(const memory_t &memory, const cpu_t &cpu, const io_t &io, const snapshot_t *parent = nullptr);
+
+    //  Only the pages that differ are written, so observers (decode cache,
+    //  translated code) only drop what changed
+    void restore(memory_t &memory, cpu_t &cpu, io_t &io) const;
+
+    const page_t &page(uint8_t page) const { return *pages_[page]; }
+    uint8_t operator[](uint16_t linear) const { return (*pages_[linear / memory_t::kPageSize])[linear % memory_t::kPageSize]; }
+
+    const cpu_t::state_t &cpu() const { return cpu_; }
+    const io_t::state_t &io() const { return io_; }
+
+    //  Number of pages (physically) shared with other
+    size_t shared_pages(const snapshot_t &other) const;
+};
+
+void test_snapshot_t();
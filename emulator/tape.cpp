@@ -1 +1,500 @@
 #include "tape.hpp"
+
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+tape_t::~tape_t()
+{
+    if (map_)
+        munmap(map_, map_size_);
+}
+
+void tape_t::append_cell(uint32_t at, uint8_t value)
+{
+    if (mapped())
+        throw std::runtime_error("Cannot write to a mapped tape");
+    bool new_run = size_ == 0;
+    if (size_ != 0)
+    {
+        auto next = location_cell(size_ - 1) + kCellsPerByte;
+        if (at < next)
+            throw std::runtime_error("Tape byte at " + tape_location_t((double)at / BPI).as_string() + " overlaps the previous one");
+        new_run = at != next;
+    }
+    if (new_run)
+        owned_runs_.push_back({at, (uint32_t)size_});
+    owned_bytes_.push_back(value);
+
+    update_arrays();
+    end_ = std::max(end_, location_cell(size_ - 1) + kCellsPerByte);
+}
+
+void tape_t::own()
+{
+    if (!mapped())
+        return;
+    owned_runs_.assign(runs_, runs_ + run_count_);
+    owned_bytes_.assign(bytes_, bytes_ + size_);
+    munmap(map_, map_size_);
+    map_ = nullptr;
+    map_size_ = 0;
+    update_arrays();
+}
+
+void tape_t::write(const tape_extent_t &extent)
+{
+    own();
+    auto count = extent.bytes.size();
+
+    //  Bytes overlapping the erased cells: [low, high)
+    auto low = seek_cell(extent.begin >= kCellsPerByte ? extent.begin - kCellsPerByte + 1 : 0);
+    auto high = seek_cell(extent.end);
+
+    if (low == size_)
+    {
+        for (size_t i = 0; i != count; i++)
+            append_cell(extent.first + i * kCellsPerByte, extent.bytes[i]);
+    }
+    else if (high - low == count && count != 0 && extent.begin == extent.first &&
+             extent.end == extent.first + count * kCellsPerByte && location_cell(low) == extent.first &&
+             location_cell(high - 1) == extent.first + (count - 1) * kCellsPerByte)
+    {
+        std::copy(extent.bytes.begin(), extent.bytes.end(), owned_bytes_.begin() + low);
+    }
+    else
+    {
+        std::vector<run_t> runs;
+        std::vector<uint8_t> bytes;
+        runs.reserve(run_count_ + 2);
+        bytes.reserve(size_ - (high - low) + count);
+        uint32_t next = 0;
+        auto add = [&](uint32_t cell, uint8_t value)
+        {
+            if (bytes.empty() || cell != next)
+                runs.push_back({cell, (uint32_t)bytes.size()});
+            bytes.push_back(value);
+            next = cell + kCellsPerByte;
+        };
+        auto add_range = [&](size_t from, size_t to)
+        {
+            if (from >= to)
+                return;
+            size_t r = &run_of(from) - runs_;
+            for (size_t i = from; i != to; i++)
+            {
+                while (i >= run_end(r))
+                    r++;
+                add(runs_[r].cell + (uint32_t)(i - runs_[r].index) * kCellsPerByte, bytes_[i]);
+            }
+        };
+        add_range(0, low);
+        for (size_t i = 0; i != count; i++)
+            add(extent.first + i * kCellsPerByte, extent.bytes[i]);
+        add_range(high, size_);
+        owned_runs_ = std::move(runs);
+        owned_bytes_ = std::move(bytes);
+        update_arrays();
+        if (size_)
+            end_ = std::max(end_, location_cell(size_ - 1) + kCellsPerByte);
+    }
+
+    if (journal_)
+        journal_->append(extent);
+}
+
+void tape_t::open_journal(const std::string &path)
+{
+    journal_.reset();
+    size_t length;
+    auto extents = tape_journal_t::read(path, &length);
+    for (auto &extent : extents)
+        write(extent);
+    journal_ = std::make_unique<tape_journal_t>(path, extents.size(), length);
+}
+
+void tape_t::compact(const std::string &path)
+{
+    auto temporary = path + ".compact";
+    save(temporary);
+    if (rename(temporary.c_str(), path.c_str()) != 0)
+    {
+        remove(temporary.c_str());
+        throw std::runtime_error("Cannot write tape image: " + path);
+    }
+    if (journal_)
+        journal_->clear();
+}
+
+void tape_t::save(const std::string &path) const
+{
+    tape_image_header_t header{};
+    memcpy(header.magic, "ICLTAPE", 8);
+    header.version = kVersion;
+    header.runs = run_count_;
+    header.size = size_;
+    header.end = end_;
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)runs_, run_count_ * sizeof(run_t));
+    file.write((const char *)bytes_, size_);
+    if (!file)
+        throw std::runtime_error("Cannot write tape image: " + path);
+}
+
+//  The whole file, read-only, nullptr if empty. Throws std::runtime_error if it cannot be mapped
+static void *map_file(const std::string &path, size_t &size)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        throw std::runtime_error("Cannot open tape: " + path);
+    struct stat st;
+    if (fstat(fd, &st) != 0)
+    {
+        close(fd);
+        throw std::runtime_error("Cannot open tape: " + path);
+    }
+    size = st.st_size;
+    if (size == 0)
+    {
+        close(fd);
+        return nullptr;
+    }
+    void *map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED)
+        throw std::runtime_error("Cannot map tape: " + path);
+    return map;
+}
+
+static bool is_image(const void *map, size_t size)
+{
+    return size >= sizeof(tape_image_header_t) && memcmp(map, "ICLTAPE", 8) == 0;
+}
+
+std::unique_ptr<tape_t> tape_t::map(const std::string &path)
+{
+    size_t size;
+    void *map = map_file(path, size);
+    if (!map)
+        throw std::runtime_error("Not a tape image: " + path);
+
+    auto tape = std::make_unique<tape_t>();
+    tape->map_ = map;
+    tape->map_size_ = size;
+
+    auto header = (const tape_image_header_t *)map;
+    if (!is_image(map, size))
+        throw std::runtime_error("Not a tape image: " + path);
+    if (header->version != kVersion)
+        throw std::runtime_error("Unsupported tape image version: " + path);
+    auto available = size - sizeof(*header);
+    if (header->runs > available / sizeof(run_t) || header->size != available - header->runs * sizeof(run_t) ||
+        (header->size != 0) != (header->runs != 0))
+        throw std::runtime_error("Truncated tape image: " + path);
+
+    //  Runs from the first byte on, in order, without overlap
+    auto runs = (const run_t *)(header + 1);
+    for (uint32_t r = 0; r != header->runs; r++)
+    {
+        bool valid = r == 0 ? runs[r].index == 0
+                            : runs[r].index > runs[r - 1].index && runs[r].index < header->size &&
+                                  runs[r].cell >= runs[r - 1].cell + (uint64_t)(runs[r].index - runs[r - 1].index) * kCellsPerByte;
+        if (!valid)
+            throw std::runtime_error("Invalid tape image runs: " + path);
+    }
+
+    tape->runs_ = runs;
+    tape->run_count_ = header->runs;
+    tape->bytes_ = (const uint8_t *)(tape->runs_ + header->runs);
+    tape->size_ = header->size;
+    tape->end_ = header->end;
+    return tape;
+}
+
+bool tape_t::operator==(const tape_t &other) const
+{
+    return size_ == other.size_ && run_count_ == other.run_count_ && end_ == other.end_ &&
+           std::equal(runs_, runs_ + run_count_, other.runs_, [](const run_t &a, const run_t &b)
+                      { return a.cell == b.cell && a.index == b.index; }) &&
+           std::equal(bytes_, bytes_ + size_, other.bytes_);
+}
+
+//  Reads the text format: one "inches: octal" byte per line, # comments
+//  Inches are converted to cells in integers, so the result does not depend on rounding
+class tape_parser_t
+{
+    const char *p_;
+    const char *end_;
+    size_t line_ = 1;
+
+    [[noreturn]] void fail(const char *what) const
+    {
+        throw std::runtime_error("Tape line " + std::to_string(line_) + ": " + what);
+    }
+
+    void skip_blanks()
+    {
+        while (p_ != end_ && (*p_ == ' ' || *p_ == '\t' || *p_ == '\r'))
+            p_++;
+    }
+
+    //  Digits, at most max of them. Returns the count
+    int digits(uint64_t &value, int base, int max)
+    {
+        int count = 0;
+        value = 0;
+        while (p_ != end_ && *p_ >= '0' && *p_ < '0' + base)
+        {
+            if (++count > max)
+                fail("number too long");
+            value = value * base + (*p_++ - '0');
+        }
+        return count;
+    }
+
+    uint32_t location()
+    {
+        uint64_t inches, fraction = 0;
+        if (!digits(inches, 10, 5))
+            fail("expected a location in inches");
+        int decimals = 0;
+        if (p_ != end_ && *p_ == '.')
+        {
+            p_++;
+            decimals = digits(fraction, 10, 9);
+        }
+        uint64_t scale = 1;
+        for (int i = 0; i != decimals; i++)
+            scale *= 10;
+        //  Nearest cell
+        auto cells = inches * BPI + (fraction * BPI * 2 + scale) / (scale * 2);
+        if (cells > UINT32_MAX)
+            fail("location out of range");
+        return (uint32_t)cells;
+    }
+
+public:
+    tape_parser_t(std::string_view text) : p_(text.data()), end_(text.data() + text.size()) {}
+
+    void parse(tape_t &tape)
+    {
+        while (p_ != end_)
+        {
+            skip_blanks();
+            if (p_ != end_ && *p_ != '#' && *p_ != '\n')
+            {
+                auto cell = location();
+                skip_blanks();
+                if (p_ == end_ || *p_ != ':')
+                    fail("expected ':'");
+                p_++;
+                skip_blanks();
+                uint64_t value;
+                if (!digits(value, 8, 3) || value > 0377)
+                    fail("expected an octal byte");
+                skip_blanks();
+                if (p_ != end_ && *p_ != '#' && *p_ != '\n')
+                    fail("unexpected characters after the byte");
+                try
+                {
+                    tape.append_cell(cell, value);
+                }
+                catch (const std::runtime_error &e)
+                {
+                    fail(e.what());
+                }
+            }
+            auto eol = (const char *)memchr(p_, '\n', end_ - p_);
+            p_ = eol ? eol + 1 : end_;
+            line_++;
+        }
+    }
+};
+
+std::unique_ptr<tape_t> tape_t::parse(std::string_view text)
+{
+    auto tape = std::make_unique<tape_t>();
+    tape->owned_bytes_.reserve(text.size() / 15); //  "0030.0000: 100\n"
+    tape_parser_t(text).parse(*tape);
+    return tape;
+}
+
+std::unique_ptr<tape_t> tape_t::load(const std::string &path)
+{
+    size_t size;
+    void *map = map_file(path, size);
+    if (is_image(map, size))
+    {
+        munmap(map, size);
+        return tape_t::map(path);
+    }
+    try
+    {
+        auto tape = parse(std::string_view((const char *)map, size));
+        if (map)
+            munmap(map, size);
+        return tape;
+    }
+    catch (const std::runtime_error &e)
+    {
+        if (map)
+            munmap(map, size);
+        throw std::runtime_error(path + ": " + e.what());
+    }
+}
+
+void test_tape_t()
+{
+    //  The contiguous constructor: one run after the 3s leader
+    tape_t tape({1, 2, 3});
+    assert(tape.size() == 3 && tape.runs() == 1);
+    assert(tape.location(0) == tape_location_t(30.0));
+    assert(tape.location(2) == tape_location_t(30.010));
+    assert(tape.end() == tape_location_t(1200.0));
+
+    //  Gaps start new runs
+    tape_t gaps;
+    gaps.append(tape_location_t(30.0), 0100);
+    gaps.append(tape_location_t(30.005), 030);
+    gaps.append(tape_location_t(40.0), 1);
+    gaps.append(tape_location_t(40.005), 2);
+    gaps.append(tape_location_t(40.010), 3);
+    assert(gaps.size() == 5 && gaps.runs() == 2);
+    assert(gaps.location_cell(3) == 40 * BPI + 8);
+    bool thrown = false;
+    try
+    {
+        gaps.append(tape_location_t(40.012), 4);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    //  Seeking
+    assert(gaps.seek(tape_location_t(0.0)) == 0);
+    assert(gaps.seek(tape_location_t(30.0)) == 0);
+    assert(gaps.seek(tape_location_t(30.001)) == 1);
+    assert(gaps.seek(tape_location_t(30.006)) == 2); //  In the gap
+    assert(gaps.seek(tape_location_t(4.0, tape_location_t::time{})) == 2);
+    assert(gaps.seek(tape_location_t(40.010)) == 4);
+    assert(gaps.seek(tape_location_t(40.011)) == 5);
+
+    //  Through an image
+    auto path = test_path("tape");
+    gaps.save(path);
+    auto mapped = tape_t::map(path);
+    assert(mapped->mapped() && mapped->size() == 5 && mapped->runs() == 2);
+    for (size_t i = 0; i != gaps.size(); i++)
+        assert((*mapped)[i] == gaps[i] && mapped->location(i) == gaps.location(i));
+    assert(mapped->seek(tape_location_t(30.006)) == 2);
+    thrown = false;
+    try
+    {
+        mapped->append(tape_location_t(50.0), 0);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    //  Runs that do not start at the first byte, or that overlap
+    mapped.reset();
+    auto runs = sizeof(tape_image_header_t);
+    for (auto [offset, value] : {std::pair<size_t, uint32_t>{runs + 4, 5}, {runs + 8, 30 * BPI + 8}})
+    {
+        gaps.save(path);
+        std::fstream file(path, std::ios::in | std::ios::out | std::ios::binary);
+        file.seekp(offset);
+        file.write((const char *)&value, sizeof(value));
+        file.close();
+        thrown = false;
+        try
+        {
+            tape_t::map(path);
+        }
+        catch (const std::runtime_error &)
+        {
+            thrown = true;
+        }
+        assert(thrown);
+    }
+
+    //  A full 100 ft tape, after the leader, in one run
+    tape_t full(std::vector<uint8_t>((1200 - 30) * 200, 0252));
+    full.save(path);
+    mapped = tape_t::map(path);
+    assert(mapped->size() == full.size() && mapped->runs() == 1);
+    assert(mapped->seek(tape_location_t(600.0)) == (600 - 30) * 200);
+    assert(mapped->location_cell(mapped->size() - 1) == 1200 * BPI - tape_t::kCellsPerByte);
+    remove(path.c_str());
+
+    thrown = false;
+    try
+    {
+        tape_t::map(path);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    //  The text format
+    auto text = tape_t::parse("# This tape contains an infinite loop if loaded into P00-030\n"
+                              "0030.0000: 100\n"
+                              "\n"
+                              "  0030.0050 :030   # comment\r\n"
+                              "0040: 1\n"
+                              "40.005: 377");
+    assert(text->size() == 4 && text->runs() == 2);
+    assert((*text)[0] == 0100 && (*text)[1] == 030 && (*text)[3] == 0377);
+    assert(text->location_cell(1) == 30 * BPI + 8 && text->location_cell(2) == 40 * BPI);
+    assert(!(*text == gaps));
+    auto bad = [](const char *text, const std::string &error)
+    {
+        try
+        {
+            tape_t::parse(text);
+        }
+        catch (const std::runtime_error &e)
+        {
+            return std::string(e.what()) == error;
+        }
+        return false;
+    };
+    assert(bad("30.0: 1\n30.0: 2\n", "Tape line 2: Tape byte at 30.0000i|3.00000s overlaps the previous one"));
+    assert(bad("\n30.0 1\n", "Tape line 2: expected ':'"));
+    assert(bad("30.0: 400\n", "Tape line 1: expected an octal byte"));
+    assert(bad("30.0: 1 2\n", "Tape line 1: unexpected characters after the byte"));
+    assert(bad("x\n", "Tape line 1: expected a location in inches"));
+
+    //  Same tape from the text and from its image
+    std::string listing;
+    for (size_t i = 0; i < full.size(); i += 7)
+    {
+        char line[32];
+        snprintf(line, sizeof(line), "%09.4f: %03o\n", full.location(i).inches(), (unsigned)(i & 0377));
+        listing += line;
+    }
+    auto parsed = tape_t::parse(listing);
+    assert(parsed->runs() == parsed->size());
+    parsed->save(path);
+    auto image = tape_t::load(path);
+    assert(image->mapped() && *image == *parsed);
+    FILE *f = fopen(path.c_str(), "w");
+    fwrite(listing.data(), 1, listing.size(), f);
+    fclose(f);
+    auto loaded = tape_t::load(path);
+    assert(!loaded->mapped() && *loaded == *parsed);
+    remove(path.c_str());
+}
@@ -5,11 +5,16 @@
 #include <cassert>
 #include <string>
 #include <stdio.h>
+#include <cmath>
+#include <memory>
+#include <algorithm>
+#include <string_view>
 
 #include "utils.hpp"
+#include "tape_journal.hpp"
 
 const int BPI = 1600; // 1600 bits per inch
-const double IPS = 10.0; // 10 inches per second
+constexpr double IPS = 10.0; // 10 inches per second
 
 class tape_location_t
 {
@@ -83,42 +88,206 @@ public:
 /**
  * This represent a physical tape.
  * It doesn't move, it just contains data.
- * #### : it probably needs to contain the length of the tape
+ *
+ * Positions are kept as bit cells from the start of the tape (1600 per
+ * inch, 8 per byte). Bytes that follow each other without a gap form a
+ * run, which only stores the cell of its first byte: a tape is an array
+ * of runs plus the byte values. location() and seek() are binary
+ * searches on the runs.
+ *
+ * A tape either owns its arrays, or maps them from an image file (see
+ * save() and map()). Mapping reads nothing: pages are loaded by the OS as
+ * bytes are read.
+ *
+ * Image file: tape_image_header_t, the runs, then the bytes.
+ *
+ * Tapes are also read from the text format of TapeFormat.md (see parse()).
+ *
+ * The machine writes extents (see tape_journal.hpp) with write(). A mapped
+ * tape is copied into owned arrays by its first write; the file is left
+ * as it is, and the extents go to the journal if one is open.
  */
+struct tape_image_header_t
+{
+    char magic[8];    // "ICLTAPE\0"
+    uint32_t version;
+    uint32_t runs;
+    uint64_t size;    // bytes
+    uint32_t end;     // length of the tape, in cells
+    uint32_t reserved;
+};
+
 class tape_t
 {
-    //  Very simple version 0
-    std::vector<tape_byte_t> data_;
+public:
+    static const uint32_t kVersion = 1;
+    static const uint32_t kCellsPerByte = 8;
+
+    struct run_t
+    {
+        uint32_t cell;  // of the first byte
+        uint32_t index; // of the first byte
+    };
+
+private:
+    //  Owned arrays, empty when mapped
+    std::vector<run_t> owned_runs_;
+    std::vector<uint8_t> owned_bytes_;
+
+    void *map_ = nullptr;
+    size_t map_size_ = 0;
+
+    const run_t *runs_ = nullptr;
+    size_t run_count_ = 0;
+    const uint8_t *bytes_ = nullptr;
+    size_t size_ = 0;
+
+    uint32_t end_ = 1200 * BPI; //  100 feet default
+
+    std::unique_ptr<tape_journal_t> journal_;
+
+    //  Mapped arrays to owned ones
+    void own();
 
-    tape_location_t end_ = {1200};  //  100 feet default
+    void update_arrays()
+    {
+        runs_ = owned_runs_.data();
+        run_count_ = owned_runs_.size();
+        bytes_ = owned_bytes_.data();
+        size_ = owned_bytes_.size();
+    }
+
+    //  Run containing index
+    const run_t &run_of(size_t index) const
+    {
+        auto run = std::upper_bound(runs_, runs_ + run_count_, index, [](size_t i, const run_t &r) { return i < r.index; });
+        return *(run - 1);
+    }
 
 public:
+    //  Contiguous data, after a 3s leader
     tape_t(const std::vector<uint8_t> &data = {})
     {
         tape_location_t loc = { 3, tape_location_t::time{} };
         for (const auto &byte : data)
         {
-            data_.emplace_back(tape_byte_t{loc, byte});
+            append(loc, byte);
             loc = loc + tape_location_t::one_byte();
         }
     }
 
+    ~tape_t();
+
+    tape_t(const tape_t &) = delete;
+    tape_t &operator=(const tape_t &) = delete;
+
+    //  Nearest cell
+    static uint32_t cell(tape_location_t location) { return (uint32_t)std::llround(location.inches() * BPI); }
+
+    //  Adds a byte at location (rounded to the nearest cell), after the last one
+    //  Throws std::runtime_error if it overlaps it, or if the tape is mapped
+    void append(tape_location_t location, uint8_t value) { append_cell(cell(location), value); }
+    void append_cell(uint32_t cell, uint8_t value);
+
+    //  The text format, in one pass over text
+    //  Throws std::runtime_error with the line number on a syntax error
+    static std::unique_ptr<tape_t> parse(std::string_view text);
+
+    //  An image (mapped) or a text file (parsed), told apart by the magic
+    //  Throws std::runtime_error if the file cannot be read or is neither
+    static std::unique_ptr<tape_t> load(const std::string &path);
+
+    //  Throws std::runtime_error if the file cannot be written
+    void save(const std::string &path) const;
+
+    //  Throws std::runtime_error if the file cannot be mapped or is not a tape image
+    static std::unique_ptr<tape_t> map(const std::string &path);
+
+    bool mapped() const { return map_ != nullptr; }
+
+    //  Erases the bytes that overlap [extent.begin, extent.end), then writes
+    //  extent.bytes, journaled if a journal is open
+    //  Appending after the last byte, or overwriting bytes in place, costs
+    //  the extent; anything else rebuilds the arrays
+    //  Throws std::runtime_error if the extent cannot be journaled
+    void write(const tape_extent_t &extent);
+
+    //  Replays the journal file at path, if any, then journals the writes to it
+    //  Throws std::runtime_error if the file is not a journal
+    void open_journal(const std::string &path);
+
+    //  Extents in the journal
+    bool journaled() const { return journal_ && journal_->extents() != 0; }
+
+    //  Saves the tape as an image at path (through a temporary file, as
+    //  path may be the mapped one) and removes the journal
+    //  Throws std::runtime_error if the image cannot be written
+    void compact(const std::string &path);
+
+    //  Same bytes at the same places, same length
+    bool operator==(const tape_t &other) const;
+
     size_t size() const
     {
-        return data_.size();
+        return size_;
     }
 
+    size_t runs() const { return run_count_; }
+
+    //  Bytes between two gaps: [run(r).index, run_end(r))
+    const run_t &run(size_t r) const { return runs_[r]; }
+    size_t run_end(size_t r) const { return r + 1 == run_count_ ? size_ : runs_[r + 1].index; }
+
+    tape_location_t end() const { return tape_location_t((double)end_ / BPI); }
+
     uint8_t operator[](size_t index) const
     {
-        assert(index < data_.size());
-        return data_[index].value();
+        assert(index < size_);
+        return bytes_[index];
+    }
+
+    uint32_t location_cell(size_t index) const
+    {
+        assert(index < size_);
+        auto &run = run_of(index);
+        return run.cell + (uint32_t)(index - run.index) * kCellsPerByte;
+    }
+
+    tape_location_t location(size_t index) const
+    {
+        return tape_location_t((double)location_cell(index) / BPI);
+    }
+
+    //  Index of the first byte at or after cell, size() if none
+    size_t seek_cell(uint32_t cell) const
+    {
+        auto run = std::upper_bound(runs_, runs_ + run_count_, cell, [](uint32_t c, const run_t &r) { return c < r.cell; });
+        if (run == runs_)
+            return 0;
+        --run;
+        auto offset = (cell - run->cell + kCellsPerByte - 1) / kCellsPerByte;
+        return std::min((size_t)(run->index + offset), run_end(run - runs_));
+    }
+
+    //  Index of the first byte at or after location, size() if none
+    size_t seek(tape_location_t location) const
+    {
+        auto target = location.inches() * BPI;
+        auto run = std::upper_bound(runs_, runs_ + run_count_, target, [](double t, const run_t &r) { return t < r.cell; });
+        if (run == runs_)
+            return 0;
+        --run;
+        auto offset = (size_t)std::ceil((target - run->cell) / kCellsPerByte);
+        return std::min(run->index + offset, run_end(run - runs_));
     }
 
     void dump() const
     {
-        for (const auto &byte : data_)
+        for (size_t i = 0; i != size_; i++)
         {
-            printf("%s\n", byte.as_string().c_str());
+            printf("%s\n", tape_byte_t(location(i), bytes_[i]).as_string().c_str());
         }
     }
 };
+
+void test_tape_t();
@@ -0,0 +1,108 @@
+//  icl1501-tape: converts a text tape (TapeFormat.md) to an image that mounts with one mmap
+//  usage: icl1501-tape TEXT IMAGE
+//         icl1501-tape --dump TAPE               prints a text or image tape in the text format
+//         icl1501-tape --index TAPE              lists the records (see record_index.hpp)
+//         icl1501-tape --extract TAPE PID FILE   writes the data of the records of program PID
+//         icl1501-tape --compact TAPE            makes TAPE an image with the writes of its journal
+//         icl1501-tape --wav TAPE FILE [RATE]    renders TAPE, to its end, as a capture (see tape_encoder.hpp)
+//
+//  The journal of TAPE (TAPE.journal, see tape_journal.hpp) is applied before dumping, indexing or extracting
+
+#include "tape.hpp"
+#include "record_index.hpp"
+#include "tape_encoder.hpp"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+int main(int argc, char **argv)
+{
+    std::string mode = argc >= 2 ? argv[1] : "";
+    bool dump = argc == 3 && mode == "--dump";
+    bool index = argc == 3 && mode == "--index";
+    bool extract = argc == 5 && mode == "--extract";
+    bool compact = argc == 3 && mode == "--compact";
+    bool wav = (argc == 4 || argc == 5) && mode == "--wav";
+    if (!(dump || index || extract || compact || wav || (argc == 3 && mode.substr(0, 2) != "--")))
+    {
+        fprintf(stderr, "usage: %s TEXT IMAGE\n       %s --dump TAPE\n       %s --index TAPE\n       %s --extract TAPE PID FILE\n       %s --compact TAPE\n       %s --wav TAPE FILE [RATE]\n",
+                argv[0], argv[0], argv[0], argv[0], argv[0], argv[0]);
+        return 2;
+    }
+
+    //  With its journal
+    auto load = [](const char *path)
+    {
+        auto tape = tape_t::load(path);
+        tape->open_journal(tape_journal_t::path_of(path));
+        return tape;
+    };
+
+    try
+    {
+        if (compact)
+        {
+            auto tape = load(argv[2]);
+            auto journaled = tape->journaled();
+            if (journaled)
+                tape->compact(argv[2]);
+            printf("%s: %zu bytes, %zu runs%s\n", argv[2], tape->size(), tape->runs(), journaled ? "" : ", no journal");
+            return 0;
+        }
+
+        if (dump)
+        {
+            auto tape = load(argv[2]);
+            for (size_t i = 0; i != tape->size(); i++)
+                printf("%09.4f: %03o\n", tape->location(i).inches(), (*tape)[i]);
+            return 0;
+        }
+
+        if (index)
+        {
+            auto tape = load(argv[2]);
+            printf("%s", record_index_t(*tape).listing().c_str());
+            return 0;
+        }
+
+        if (extract)
+        {
+            auto tape = load(argv[2]);
+            auto data = record_index_t(*tape).extract(argv[3]);
+            if (data.empty())
+                throw std::runtime_error(std::string("No record for ") + argv[3]);
+            FILE *file = fopen(argv[4], "wb");
+            if (!file || fwrite(data.data(), 1, data.size(), file) != data.size() || fclose(file) != 0)
+                throw std::runtime_error(std::string("Cannot write ") + argv[4]);
+            printf("%s: %zu bytes\n", argv[4], data.size());
+            return 0;
+        }
+
+        if (wav)
+        {
+            auto tape = load(argv[2]);
+            tape_encoder_t::options_t options;
+            options.whole = true;
+            if (argc == 5 && (options.sample_rate = atoi(argv[4])) == 0)
+                throw std::runtime_error(std::string("Bad sample rate ") + argv[4]);
+            auto start = std::chrono::steady_clock::now();
+            tape_encoder_t::save(*tape, argv[3], options);
+            auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            auto length = tape_encoder_t(*tape, options).count() / (double)options.sample_rate;
+            printf("%s: %.1f s at %u Hz, written in %.3f s\n", argv[3], length, options.sample_rate, seconds);
+            return 0;
+        }
+
+        auto tape = tape_t::load(argv[1]);
+        tape->save(argv[2]);
+        printf("%s: %zu bytes, %zu runs\n", argv[2], tape->size(), tape->runs());
+    }
+    catch (const std::runtime_error &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,73 @@
+//  icl1501-decode: decodes an audio capture of a tape into a tape image
+//  usage: icl1501-decode [-j THREADS] [--kernel scalar|sse2|avx2] [--ips SPEED] CAPTURE.wav TAPE
+//
+//  The capture is decoded as tape_decoder.hpp describes, SPEED being the
+//  speed of the tape while it was captured (10 ips by default). TAPE is
+//  written as an image (see TapeFormat.md)
+
+#include "tape.hpp"
+#include "tape_decoder.hpp"
+#include "wav.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+#include <thread>
+
+static int usage(const char *name)
+{
+    fprintf(stderr, "usage: %s [-j THREADS] [--kernel scalar|sse2|avx2] [--ips SPEED] CAPTURE.wav TAPE\n", name);
+    return 2;
+}
+
+int main(int argc, char **argv)
+{
+    tape_decoder_t::options_t options;
+    options.threads = std::max(1u, std::thread::hardware_concurrency());
+    int arg = 1;
+    for (; arg + 1 < argc && argv[arg][0] == '-'; arg += 2)
+    {
+        std::string option = argv[arg], value = argv[arg + 1];
+        if (option == "-j")
+            options.threads = std::max(1, atoi(value.c_str()));
+        else if (option == "--ips" && atof(value.c_str()) > 0)
+            options.ips = atof(value.c_str());
+        else if (option == "--kernel" && value == "scalar")
+            options.kernel = tape_decoder_t::kKernelScalar;
+        else if (option == "--kernel" && value == "sse2")
+            options.kernel = tape_decoder_t::kKernelSSE2;
+        else if (option == "--kernel" && value == "avx2")
+            options.kernel = tape_decoder_t::kKernelAVX2;
+        else
+            return usage(argv[0]);
+    }
+    if (argc - arg != 2)
+        return usage(argv[0]);
+
+    try
+    {
+        auto wav = wav_t::load(argv[arg]);
+        tape_decoder_t::stats_t stats;
+        auto start = std::chrono::steady_clock::now();
+        auto tape = tape_decoder_t::decode(wav.samples.data(), wav.samples.size(), wav.sample_rate, options, &stats);
+        auto seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        tape->save(argv[arg + 1]);
+        printf("%.1f s of capture at %u Hz: %zu runs, %zu bytes", (double)wav.samples.size() / wav.sample_rate,
+               wav.sample_rate, stats.runs, stats.bytes);
+        if (stats.dropped_bits)
+            printf(", %zu bits dropped", stats.dropped_bits);
+        if (stats.moved_runs)
+            printf(", %zu runs moved", stats.moved_runs);
+        printf("\ndecoded in %.3f s with %s, %u threads, %zu chunks\n", seconds, tape_decoder_t::name(options.kernel),
+               options.threads, stats.chunks);
+    }
+    catch (const std::runtime_error &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,571 @@
+#include "tape_decoder.hpp"
+#include "tape_encoder.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cmath>
+#include <stdexcept>
+#include <thread>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define ICL1501_X86 1
+#endif
+
+//  The filtered sample, times 2 + 2 smooth: smooth (x[i - 1] + x[i + 1]) + 2 x[i], repeating the ends
+//  The kernels compute it in the same order, so they slice the same bits
+static inline float filtered(const float *x, size_t count, float smooth, size_t i)
+{
+    float before = x[i ? i - 1 : 0];
+    float after = x[i + 1 < count ? i + 1 : count - 1];
+    return (before + after) * smooth + (x[i] + x[i]);
+}
+
+static void slice_word(const float *x, size_t count, float smooth, float threshold, size_t w, uint64_t *above, uint64_t *below)
+{
+    uint64_t a = 0, b = 0;
+    auto base = w * 64;
+    for (size_t k = 0; k != 64 && base + k < count; k++)
+    {
+        auto y = filtered(x, count, smooth, base + k);
+        a |= (uint64_t)(y > threshold) << k;
+        b |= (uint64_t)(y < -threshold) << k;
+    }
+    above[w] = a;
+    below[w] = b;
+}
+
+//  Words that have their neighbour samples on both sides
+static bool inner_word(size_t w, size_t count)
+{
+    return w != 0 && w * 64 + 64 < count;
+}
+
+static float peak_scalar(const float *x, size_t count, size_t from = 0)
+{
+    float peak = 0;
+    for (size_t i = from; i != count; i++)
+        peak = std::max(peak, std::abs(x[i]));
+    return peak;
+}
+
+#ifdef ICL1501_X86
+__attribute__((target("sse2"))) static void slice_sse2(const float *x, size_t count, float smooth, float threshold,
+                                                        size_t first, size_t last, uint64_t *above, uint64_t *below)
+{
+    auto weight = _mm_set1_ps(smooth);
+    auto high = _mm_set1_ps(threshold);
+    auto low = _mm_set1_ps(-threshold);
+    for (size_t w = first; w != last; w++)
+    {
+        if (!inner_word(w, count))
+        {
+            slice_word(x, count, smooth, threshold, w, above, below);
+            continue;
+        }
+        uint64_t a = 0, b = 0;
+        for (int k = 0; k != 64; k += 4)
+        {
+            auto p = x + w * 64 + k;
+            auto v = _mm_loadu_ps(p);
+            auto y = _mm_add_ps(_mm_mul_ps(_mm_add_ps(_mm_loadu_ps(p - 1), _mm_loadu_ps(p + 1)), weight), _mm_add_ps(v, v));
+            a |= (uint64_t)_mm_movemask_ps(_mm_cmpgt_ps(y, high)) << k;
+            b |= (uint64_t)_mm_movemask_ps(_mm_cmplt_ps(y, low)) << k;
+        }
+        above[w] = a;
+        below[w] = b;
+    }
+}
+
+__attribute__((target("avx2"))) static void slice_avx2(const float *x, size_t count, float smooth, float threshold,
+                                                        size_t first, size_t last, uint64_t *above, uint64_t *below)
+{
+    auto weight = _mm256_set1_ps(smooth);
+    auto high = _mm256_set1_ps(threshold);
+    auto low = _mm256_set1_ps(-threshold);
+    for (size_t w = first; w != last; w++)
+    {
+        if (!inner_word(w, count))
+        {
+            slice_word(x, count, smooth, threshold, w, above, below);
+            continue;
+        }
+        uint64_t a = 0, b = 0;
+        for (int k = 0; k != 64; k += 8)
+        {
+            auto p = x + w * 64 + k;
+            auto v = _mm256_loadu_ps(p);
+            auto y = _mm256_add_ps(_mm256_mul_ps(_mm256_add_ps(_mm256_loadu_ps(p - 1), _mm256_loadu_ps(p + 1)), weight),
+                                   _mm256_add_ps(v, v));
+            a |= (uint64_t)_mm256_movemask_ps(_mm256_cmp_ps(y, high, _CMP_GT_OQ)) << k;
+            b |= (uint64_t)_mm256_movemask_ps(_mm256_cmp_ps(y, low, _CMP_LT_OQ)) << k;
+        }
+        above[w] = a;
+        below[w] = b;
+    }
+}
+
+__attribute__((target("sse2"))) static float peak_sse2(const float *x, size_t count)
+{
+    auto sign = _mm_set1_ps(-0.0f);
+    auto peak = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+        peak = _mm_max_ps(peak, _mm_andnot_ps(sign, _mm_loadu_ps(x + i)));
+    float lanes[4];
+    _mm_storeu_ps(lanes, peak);
+    return std::max({lanes[0], lanes[1], lanes[2], lanes[3], peak_scalar(x, count, i)});
+}
+
+__attribute__((target("avx2"))) static float peak_avx2(const float *x, size_t count)
+{
+    auto sign = _mm256_set1_ps(-0.0f);
+    auto peak = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+        peak = _mm256_max_ps(peak, _mm256_andnot_ps(sign, _mm256_loadu_ps(x + i)));
+    float lanes[8];
+    _mm256_storeu_ps(lanes, peak);
+    return std::max({lanes[0], lanes[1], lanes[2], lanes[3], lanes[4], lanes[5], lanes[6], lanes[7],
+                     peak_scalar(x, count, i)});
+}
+#endif
+
+bool tape_decoder_t::supported(eKernel kernel)
+{
+    switch (kernel)
+    {
+    case kKernelScalar:
+        return true;
+#ifdef ICL1501_X86
+    case kKernelSSE2:
+        return __builtin_cpu_supports("sse2");
+    case kKernelAVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+tape_decoder_t::eKernel tape_decoder_t::best_kernel()
+{
+    if (supported(kKernelAVX2))
+        return kKernelAVX2;
+    if (supported(kKernelSSE2))
+        return kKernelSSE2;
+    return kKernelScalar;
+}
+
+const char *tape_decoder_t::name(eKernel kernel)
+{
+    switch (kernel)
+    {
+    case kKernelSSE2:
+        return "sse2";
+    case kKernelAVX2:
+        return "avx2";
+    default:
+        return "scalar";
+    }
+}
+
+void tape_decoder_t::slice(eKernel kernel, const float *samples, size_t count, bool smooth, float threshold,
+                           size_t first, size_t last, uint64_t *above, uint64_t *below)
+{
+    threshold *= smooth ? 4 : 2; //  As filtered() is
+    switch (kernel)
+    {
+#ifdef ICL1501_X86
+    case kKernelSSE2:
+        slice_sse2(samples, count, smooth, threshold, first, last, above, below);
+        return;
+    case kKernelAVX2:
+        slice_avx2(samples, count, smooth, threshold, first, last, above, below);
+        return;
+#endif
+    default:
+        for (size_t w = first; w != last; w++)
+            slice_word(samples, count, smooth, threshold, w, above, below);
+    }
+}
+
+float tape_decoder_t::peak(eKernel kernel, const float *samples, size_t count)
+{
+    switch (kernel)
+    {
+#ifdef ICL1501_X86
+    case kKernelSSE2:
+        return peak_sse2(samples, count);
+    case kKernelAVX2:
+        return peak_avx2(samples, count);
+#endif
+    default:
+        return peak_scalar(samples, count);
+    }
+}
+
+struct decoded_run_t
+{
+    double start; //  Sample
+    std::vector<uint8_t> bytes;
+};
+
+//  The runs of the samples [begin, end) of a capture, sliced, which starts and ends in silence
+class chunk_decoder_t
+{
+    const float *x_;
+    size_t count_;
+    const uint64_t *above_;
+    const uint64_t *below_;
+    double cell_;  //  Nominal samples per cell
+    float smooth_;
+    float level_;  //  Peak, scaled as filtered()
+    size_t gap_;   //  Samples without signal that end a run
+
+    struct edge_t
+    {
+        double position;
+        bool rising;
+    };
+    std::vector<edge_t> edges_;
+    double start_ = 0;
+
+    static constexpr double kPhaseGain = 0.5;
+    static constexpr double kPeriodGain = 0.05;
+
+    float y(size_t i) const { return filtered(x_, count_, smooth_, i); }
+
+    //  The last zero crossing in (from, to]
+    double crossing(size_t from, size_t to) const
+    {
+        for (size_t j = to; j > from; j--)
+        {
+            auto y0 = y(j - 1), y1 = y(j);
+            if ((y0 < 0) != (y1 < 0))
+                return j - 1 + y0 / (y0 - y1);
+        }
+        return (from + to) / 2.0;
+    }
+
+    //  Where the signal leaving silence at i reaches half the level
+    double step(size_t i) const
+    {
+        auto half = level_ / 2;
+        for (size_t j = std::max<size_t>(i, 1); j < count_ && j < i + 4; j++)
+        {
+            auto y0 = std::abs(y(j - 1)), y1 = std::abs(y(j));
+            if (y1 >= half)
+                return y0 >= half ? j - 1.0 : j - 1 + (half - y0) / (y1 - y0);
+        }
+        return i;
+    }
+
+    //  Bits from the mid-cell transitions, as long as the clock finds them
+    void finish()
+    {
+        double period = cell_;
+        double mid = start_ + period / 2;
+        std::vector<uint8_t> bytes;
+        unsigned value = 0;
+        int bits = 0;
+        size_t e = 0;
+        for (;;)
+        {
+            while (e != edges_.size() && edges_[e].position < mid - period / 4)
+                e++;
+            if (e == edges_.size() || edges_[e].position > mid + period / 4)
+                break;
+            auto &edge = edges_[e++];
+            auto error = edge.position - mid;
+            period = std::clamp(period + error * kPeriodGain, cell_ * 0.75, cell_ * 1.25);
+            mid += error * kPhaseGain + period;
+            value = value << 1 | edge.rising;
+            if (++bits == 8)
+            {
+                bytes.push_back(value);
+                value = 0;
+                bits = 0;
+            }
+        }
+        dropped_bits += bits;
+        if (!bytes.empty())
+            runs.push_back({start_, std::move(bytes)});
+    }
+
+public:
+    std::vector<decoded_run_t> runs;
+    size_t dropped_bits = 0;
+
+    chunk_decoder_t(const float *x, size_t count, const uint64_t *above, const uint64_t *below,
+                    double cell, bool smooth, float level)
+        : x_(x), count_(count), above_(above), below_(below), cell_(cell), smooth_(smooth),
+          level_(level * (smooth ? 4 : 2)),
+          gap_((size_t)std::ceil(cell * tape_decoder_t::kGapCells))
+    {
+    }
+
+    void decode(size_t begin, size_t end)
+    {
+        int sign = 0;      //  Of the last strong sample, 0 in silence
+        size_t last = 0;   //  Last strong sample
+        uint64_t carry_above = 0, carry_below = 0;
+        for (size_t w = begin / 64; w * 64 < end; w++)
+        {
+            auto range = ~0ull;
+            if (w * 64 < begin)
+                range &= ~0ull << (begin - w * 64);
+            if (end - w * 64 < 64)
+                range &= ~0ull >> (64 - (end - w * 64));
+            auto a = above_[w] & range, b = below_[w] & range;
+            auto strong = a | b;
+            if (!strong)
+            {
+                carry_above = carry_below = 0;
+                continue;
+            }
+
+            //  Where the signal goes above or below the threshold
+            auto starts = (a & ~(a << 1 | carry_above)) | (b & ~(b << 1 | carry_below));
+            carry_above = a >> 63;
+            carry_below = b >> 63;
+            while (starts)
+            {
+                int k = __builtin_ctzll(starts);
+                starts &= starts - 1;
+                size_t i = w * 64 + k;
+                int s = (a >> k & 1) ? 1 : -1;
+                auto earlier = strong & ((1ull << k) - 1);
+                size_t previous = earlier ? w * 64 + 63 - __builtin_clzll(earlier) : last;
+                if (sign && i - previous > gap_)
+                {
+                    finish();
+                    sign = 0;
+                }
+                if (!sign)
+                {
+                    start_ = step(i);
+                    edges_.clear();
+                }
+                else if (s != sign)
+                    edges_.push_back({crossing(previous, i), s > 0});
+                sign = s;
+            }
+            last = w * 64 + 63 - __builtin_clzll(strong);
+        }
+        if (sign)
+            finish();
+    }
+};
+
+//  The middle of the first silence after sample that is long enough to end a run on each side, or count
+static size_t silence_after(size_t sample, size_t count, const uint64_t *above, const uint64_t *below, size_t gap)
+{
+    size_t quiet = sample; //  Start of the current silence
+    for (size_t i = sample; i < count;)
+    {
+        auto k = i % 64;
+        auto strong = (above[i / 64] | below[i / 64]) >> k;
+        if (!strong)
+        {
+            i += 64 - k;
+            continue;
+        }
+        auto j = i + __builtin_ctzll(strong);
+        if (j >= count)
+            break;
+        if (j - quiet >= 2 * gap + 2)
+            return quiet + gap + 1;
+        quiet = j + 1;
+        i = j + 1;
+    }
+    return count - quiet >= 2 * gap + 2 ? quiet + gap + 1 : count;
+}
+
+std::unique_ptr<tape_t> tape_decoder_t::decode(const float *samples, size_t count, uint32_t sample_rate,
+                                               const options_t &options, stats_t *stats)
+{
+    if (!supported(options.kernel))
+        throw std::runtime_error(std::string("The ") + name(options.kernel) + " kernel is not supported by this CPU");
+    auto tape = std::make_unique<tape_t>();
+    stats_t local;
+    if (!stats)
+        stats = &local;
+    *stats = {};
+    if (count == 0)
+        return tape;
+
+    auto threads = std::max(1u, options.threads);
+    auto cell = sample_rate / (options.ips * BPI);
+    auto level = peak(options.kernel, samples, count);
+    auto threshold = level * (float)options.threshold;
+    bool smooth = cell >= kSmoothCells;
+
+    //  Sliced in parallel, by words
+    auto words = (count + 63) / 64;
+    std::vector<uint64_t> above(words), below(words);
+    auto parallel = [&](size_t tasks, auto &&task)
+    {
+        std::atomic<size_t> next{0};
+        auto worker = [&]()
+        {
+            for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < tasks;)
+                task(i);
+        };
+        std::vector<std::thread> pool;
+        for (unsigned i = 1; i < std::min<size_t>(threads, tasks); i++)
+            pool.emplace_back(worker);
+        worker();
+        for (auto &thread : pool)
+            thread.join();
+    };
+    auto slices = threads * 4;
+    parallel(slices, [&](size_t i)
+             { slice(options.kernel, samples, count, smooth, threshold, words * i / slices, words * (i + 1) / slices,
+                     above.data(), below.data()); });
+
+    //  Chunks cut in silences
+    auto gap = (size_t)std::ceil(cell * kGapCells);
+    std::vector<size_t> bounds{0};
+    auto chunks = threads == 1 ? 1 : threads * 4;
+    for (size_t i = 1; i < chunks && bounds.back() != count; i++)
+    {
+        auto bound = silence_after(std::max(count * i / chunks, bounds.back()), count, above.data(), below.data(), gap);
+        if (bound != bounds.back())
+            bounds.push_back(bound);
+    }
+    if (bounds.back() != count)
+        bounds.push_back(count);
+
+    std::vector<chunk_decoder_t> decoders;
+    for (size_t i = 0; i + 1 != bounds.size(); i++)
+        decoders.emplace_back(samples, count, above.data(), below.data(), cell, smooth, level);
+    parallel(decoders.size(), [&](size_t i)
+             { decoders[i].decode(bounds[i], bounds[i + 1]); });
+
+    //  Runs in order, at the nearest cell, after the previous one
+    stats->chunks = decoders.size();
+    uint32_t next = 0;
+    for (auto &decoder : decoders)
+    {
+        stats->dropped_bits += decoder.dropped_bits;
+        for (auto &run : decoder.runs)
+        {
+            auto first = (uint32_t)std::llround(run.start / cell);
+            if (first < next)
+            {
+                first = next;
+                stats->moved_runs++;
+            }
+            for (size_t i = 0; i != run.bytes.size(); i++)
+                tape->append_cell(first + i * tape_t::kCellsPerByte, run.bytes[i]);
+            next = first + run.bytes.size() * tape_t::kCellsPerByte;
+            stats->runs++;
+            stats->bytes += run.bytes.size();
+        }
+    }
+    return tape;
+}
+
+//  The capture of a tape read at ips, with a speed that varies by flutter, and noise
+static std::vector<float> render(const tape_t &tape, uint32_t sample_rate, double ips, double flutter, float noise)
+{
+    tape_encoder_t::options_t options;
+    options.sample_rate = sample_rate;
+    options.ips = ips;
+    options.flutter = flutter;
+    tape_encoder_t encoder(tape, options);
+    std::vector<float> samples(encoder.count());
+    encoder.render(samples.data(), samples.size());
+    uint32_t seed = 1;
+    for (auto &sample : samples)
+    {
+        seed = seed * 1103515245 + 12345;
+        sample += noise * ((seed >> 16 & 0x7fff) / 16384.0f - 1);
+    }
+    return samples;
+}
+
+void test_tape_decoder_t()
+{
+    std::vector<tape_decoder_t::eKernel> kernels;
+    for (auto kernel : {tape_decoder_t::kKernelScalar, tape_decoder_t::kKernelSSE2, tape_decoder_t::kKernelAVX2})
+        if (tape_decoder_t::supported(kernel))
+            kernels.push_back(kernel);
+    assert(tape_decoder_t::supported(tape_decoder_t::best_kernel()));
+
+    //  The kernels slice the same bits, to the odd end
+    std::vector<float> noise(1001);
+    uint32_t seed = 7;
+    for (auto &sample : noise)
+    {
+        seed = seed * 1103515245 + 12345;
+        sample = (seed >> 16 & 0x7fff) / 16384.0f - 1;
+    }
+    auto words = (noise.size() + 63) / 64;
+    auto peak = tape_decoder_t::peak(tape_decoder_t::kKernelScalar, noise.data(), noise.size());
+    for (bool smooth : {false, true})
+    {
+        std::vector<uint64_t> above(words), below(words);
+        tape_decoder_t::slice(tape_decoder_t::kKernelScalar, noise.data(), noise.size(), smooth, 0.25f, 0, words,
+                              above.data(), below.data());
+        for (auto kernel : kernels)
+        {
+            std::vector<uint64_t> a(words), b(words);
+            tape_decoder_t::slice(kernel, noise.data(), noise.size(), smooth, 0.25f, 0, words, a.data(), b.data());
+            assert(a == above && b == below);
+            assert(tape_decoder_t::peak(kernel, noise.data(), noise.size()) == peak);
+        }
+        assert(above[0] && below[0] && !(above[words - 1] >> (noise.size() % 64)));
+    }
+
+    //  Three runs: short, with a short gap, and long
+    tape_t tape;
+    uint32_t cell = 30 * BPI;
+    for (uint8_t value : {0, 0377, 0125, 0252, 1, 2, 3})
+        tape.append_cell(cell, value), cell += tape_t::kCellsPerByte;
+    cell = (uint32_t)(30.5 * BPI);
+    for (uint8_t value : {'H', 'E', 'L', 'L', 'O'})
+        tape.append_cell(cell, value), cell += tape_t::kCellsPerByte;
+    cell += 3 * tape_t::kCellsPerByte;
+    for (int i = 0; i != 200; i++)
+        tape.append_cell(cell, (uint8_t)(i * 37)), cell += tape_t::kCellsPerByte;
+    assert(tape.runs() == 3);
+
+    auto samples = render(tape, 96000, IPS, 0, 0.1f);
+    tape_decoder_t::options_t options;
+    tape_decoder_t::stats_t stats;
+    for (auto kernel : kernels)
+        for (unsigned threads : {1, 3})
+        {
+            options.kernel = kernel;
+            options.threads = threads;
+            auto decoded = tape_decoder_t::decode(samples.data(), samples.size(), 96000, options, &stats);
+            assert(*decoded == tape);
+            assert(stats.runs == 3 && stats.bytes == tape.size() && !stats.dropped_bits && !stats.moved_runs);
+            assert(threads == 1 ? stats.chunks == 1 : stats.chunks > 1);
+        }
+
+    //  At the speed of the capture, or the nominal one 0.3% off, or through flutter
+    options = {};
+    options.ips = 9.9;
+    samples = render(tape, 96000, 9.9, 0, 0.1f);
+    assert(*tape_decoder_t::decode(samples.data(), samples.size(), 96000, options) == tape);
+    for (auto [ips, flutter] : {std::pair{10.03, 0.0}, std::pair{IPS, 0.003}})
+    {
+        samples = render(tape, 96000, ips, flutter, 0.1f);
+        auto decoded = tape_decoder_t::decode(samples.data(), samples.size(), 96000);
+        assert(decoded->size() == tape.size() && decoded->runs() == 3);
+        for (size_t i = 0; i != tape.size(); i++)
+            assert((*decoded)[i] == tape[i]);
+    }
+
+    //  Without the low-pass at 48 kHz
+    samples = render(tape, 48000, IPS, 0, 0.05f);
+    assert(*tape_decoder_t::decode(samples.data(), samples.size(), 48000) == tape);
+
+    //  Silence
+    std::vector<float> quiet(1000);
+    assert(tape_decoder_t::decode(quiet.data(), quiet.size(), 96000)->size() == 0);
+}
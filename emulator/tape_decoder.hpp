@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+#include "tape.hpp"
+
+/*
+    Tapes from audio captures of cartridges.
+
+    A capture is the flux level read from the tape: in the data, a square
+    wave of ±level, phase modulated at 1600 BPI. Each bit cell (62.5 µs at
+    10 ips) has a transition in its middle, rising for 1 and falling for 0,
+    and one at its start when the bit is the same as the previous one.
+    Erased tape (the gaps between runs) is silence. Bytes are written most
+    significant bit first, from the start of a run.
+
+    Decoding:
+    - filter and slice: a [1 2 1] low-pass (at kSmoothCells samples per
+      cell or more; at lower rates it would cancel the half cells), then
+      the samples above the threshold and below its opposite, as bitmasks. The kernels are SSE2
+      or AVX2, chosen at run time, with a scalar fallback; they produce the
+      same bits.
+    - edges: the changes between above and below, found from the starts of
+      the runs of bits in the masks, so the scalar code runs per edge
+      rather than per sample. They are placed between samples by linear
+      interpolation of the zero crossing.
+    - clock recovery: a cell clock that starts at the nominal rate, moves
+      its phase half way to each mid-cell transition and follows its
+      period. Edges are found to half a sample at worst, so captures need
+      4 samples per cell or more (64 kHz at 10 ips); at 3 (48 kHz) they
+      decode only if their rate is a whole number of samples per cell.
+    - framing: a run starts when the signal leaves silence, at the start of
+      its first cell. Its location is its time in the capture, from the
+      clip at the nominal speed. Trailing bits that do not make a byte are
+      dropped.
+
+    Long captures are cut in silences into chunks, decoded in parallel.
+    Gaps shorter than kGapCells do not separate runs.
+*/
+
+class tape_decoder_t
+{
+public:
+    typedef enum
+    {
+        kKernelScalar,
+        kKernelSSE2,
+        kKernelAVX2,
+    } eKernel;
+
+    static const int kGapCells = 2;
+    static const int kSmoothCells = 4;
+
+    struct options_t
+    {
+        eKernel kernel = best_kernel();
+        unsigned threads = 1;
+        double ips = IPS;         //  Speed of the tape during the capture
+        double threshold = 0.3;   //  Of the peak level
+    };
+
+    struct stats_t
+    {
+        size_t chunks = 0;
+        size_t runs = 0;
+        size_t bytes = 0;
+        size_t dropped_bits = 0; //  At the end of runs
+        size_t moved_runs = 0;   //  Placed after the previous one, which they overlapped
+    };
+
+    //  The fastest kernel this CPU has
+    static eKernel best_kernel();
+    static const char *name(eKernel kernel);
+    static bool supported(eKernel kernel);
+
+    //  Bit i of above[i / 64] (below[i / 64]) is set if the sample i, filtered if smooth,
+    //  is above threshold (below -threshold), for the words [first, last)
+    static void slice(eKernel kernel, const float *samples, size_t count, bool smooth, float threshold,
+                      size_t first, size_t last, uint64_t *above, uint64_t *below);
+
+    //  Largest absolute value
+    static float peak(eKernel kernel, const float *samples, size_t count);
+
+    //  Throws std::runtime_error if the kernel is not supported
+    static std::unique_ptr<tape_t> decode(const float *samples, size_t count, uint32_t sample_rate,
+                                          const options_t &options, stats_t *stats = nullptr);
+    static std::unique_ptr<tape_t> decode(const float *samples, size_t count, uint32_t sample_rate)
+    {
+        return decode(samples, count, sample_rate, options_t());
+    }
+};
+
+void test_tape_decoder_t();
@@ -0,0 +1,171 @@
+#include "tape_encoder.hpp"
+#include "tape_decoder.hpp"
+#include "wav.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <stdexcept>
+#include <vector>
+
+tape_encoder_t::tape_encoder_t(const tape_t &tape, const options_t &options)
+    : tape_(tape), options_(options), half_samples_(options.sample_rate / (options.ips * BPI * 2))
+{
+    uint64_t last = 0; //  Cell
+    if (tape.size())
+        last = tape.location_cell(tape.size() - 1) + tape_t::kCellsPerByte + kTailCells;
+    if (options.whole)
+        last = std::max<uint64_t>(last, tape_t::cell(tape.end()));
+    count_ = sample_of(2 * last);
+}
+
+double tape_encoder_t::seconds_of(uint64_t half) const
+{
+    //  Solves ips * (t + flutter * (1 - cos(w t)) / w) = inches, from the
+    //  nominal speed; the speed is never far from ips, so a few steps do
+    auto inches = half / (2.0 * BPI);
+    auto w = 2 * M_PI * kFlutterHz;
+    auto t = inches / options_.ips;
+    for (int i = 0; i != 4; i++)
+    {
+        auto error = options_.ips * (t + options_.flutter * (1 - std::cos(w * t)) / w) - inches;
+        t -= error / (options_.ips * (1 + options_.flutter * std::sin(w * t)));
+    }
+    return t;
+}
+
+void tape_encoder_t::next_segment()
+{
+    if (index_ == tape_.size())
+    {
+        value_ = 0;
+        end_ = count_;
+        return;
+    }
+    auto &run = tape_.run(run_);
+    auto half = 2ull * (run.cell + (index_ - run.index) * tape_t::kCellsPerByte) + half_;
+    auto start = sample_of(half);
+    if (sample_ < start) //  Gap
+    {
+        value_ = 0;
+        end_ = start;
+        return;
+    }
+
+    //  Low then high for 1, high then low for 0
+    bool one = tape_[index_] >> (7 - half_ / 2) & 1;
+    value_ = (half_ & 1) == one ? options_.level : -options_.level;
+    end_ = sample_of(half + 1);
+    if (++half_ == 2 * tape_t::kCellsPerByte)
+    {
+        half_ = 0;
+        if (++index_ == tape_.run_end(run_))
+            run_++;
+    }
+}
+
+size_t tape_encoder_t::render(float *samples, size_t max)
+{
+    size_t done = 0;
+    while (done != max && sample_ != count_)
+    {
+        if (sample_ == end_)
+        {
+            next_segment();
+            continue;
+        }
+        auto n = (size_t)std::min<uint64_t>(end_ - sample_, max - done);
+        std::fill_n(samples + done, n, value_);
+        done += n;
+        sample_ += n;
+    }
+    return done;
+}
+
+void tape_encoder_t::save(const tape_t &tape, const std::string &path, const options_t &options)
+{
+    tape_encoder_t encoder(tape, options);
+    FILE *file = fopen(path.c_str(), "wb");
+    if (!file)
+        throw std::runtime_error("Cannot write WAV file: " + path);
+    auto header = wav_t::header(options.sample_rate, encoder.count());
+    bool ok = fwrite(header.data(), 1, header.size(), file) == header.size();
+    std::vector<float> samples(std::max<size_t>(options.chunk, 1));
+    std::vector<uint8_t> pcm(samples.size() * 2);
+    for (size_t n; ok && (n = encoder.render(samples.data(), samples.size()));)
+    {
+        for (size_t i = 0; i != n; i++)
+        {
+            auto value = (uint16_t)wav_t::to_int16(samples[i]);
+            pcm[2 * i] = value & 0xff;
+            pcm[2 * i + 1] = value >> 8;
+        }
+        ok = fwrite(pcm.data(), 2, n, file) == n;
+    }
+    if (fclose(file) != 0 || !ok)
+        throw std::runtime_error("Cannot write WAV file: " + path);
+}
+
+void test_tape_encoder_t()
+{
+    tape_t tape;
+    uint32_t cell = 30 * BPI;
+    for (uint8_t value : {0, 0377, 0125, 1})
+        tape.append_cell(cell, value), cell += tape_t::kCellsPerByte;
+    cell = 31 * BPI + 3;
+    for (int i = 0; i != 300; i++)
+        tape.append_cell(cell, (uint8_t)(i * 37)), cell += tape_t::kCellsPerByte;
+
+    //  Silence, then 0: high, low...
+    tape_encoder_t::options_t options;
+    tape_encoder_t encoder(tape, options);
+    assert(encoder.count() == (cell + tape_encoder_t::kTailCells) * 6ull); //  6 samples per cell
+    std::vector<float> samples(encoder.count() + 10);
+    assert(encoder.render(samples.data(), samples.size()) == encoder.count());
+    assert(encoder.render(samples.data(), samples.size()) == 0);
+    auto first = (size_t)(30 * 96000 / IPS); //  Exactly on the start of a cell
+    assert(samples[first - 1] == 0 && samples[first] == 0.8f && samples[first + 2] == 0.8f && samples[first + 3] == -0.8f);
+    assert(samples[encoder.count() - 1] == 0);
+
+    //  The same in chunks
+    for (size_t chunk : {1, 7, 1000})
+    {
+        tape_encoder_t chunked(tape, options);
+        std::vector<float> rendered(chunk);
+        size_t offset = 0;
+        for (size_t n; (n = chunked.render(rendered.data(), chunk)); offset += n)
+            assert(std::equal(rendered.begin(), rendered.begin() + n, samples.begin() + offset));
+        assert(offset == encoder.count());
+    }
+
+    //  Round trips through a WAV file, at several rates and speeds
+    auto path = test_path("encoder.wav");
+    for (uint32_t rate : {96000, 192000})
+        for (double ips : {IPS, 9.9})
+        {
+            options.sample_rate = rate;
+            options.ips = ips;
+            options.chunk = 4096;
+            tape_encoder_t::save(tape, path, options);
+            auto wav = wav_t::load(path);
+            assert(wav.sample_rate == rate && wav.samples.size() == tape_encoder_t(tape, options).count());
+            tape_decoder_t::options_t decoding;
+            decoding.ips = ips;
+            assert(*tape_decoder_t::decode(wav.samples.data(), wav.samples.size(), rate, decoding) == tape);
+        }
+    remove(path.c_str());
+
+    //  The whole tape
+    options = {};
+    options.whole = true;
+    assert(tape_encoder_t(tape, options).count() == (uint64_t)(1200 * 96000 / IPS));
+
+    //  Flutter: ahead of the nominal speed, back in step every 1 / kFlutterHz
+    options.flutter = 0.003;
+    auto whole = tape_encoder_t(tape, options).count();
+    assert(whole + 1 >= (uint64_t)(1200 * 96000 / IPS) && whole <= (uint64_t)(1200 * 96000 / IPS));
+    options.whole = false;
+    assert(tape_encoder_t(tape, options).count() < tape_encoder_t(tape).count());
+    tape_t empty;
+    assert(tape_encoder_t(empty).count() == 0);
+}
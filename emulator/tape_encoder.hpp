@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cmath>
+#include <cstdint>
+#include <string>
+
+#include "tape.hpp"
+
+/*
+    Audio captures of tapes, the inverse of tape_decoder.hpp.
+
+    The signal is the flux level as the decoder reads it: silence from the
+    clip to the first run and in the gaps, and in the runs a square wave of
+    ±level with a transition in the middle of each bit cell (rising for 1)
+    and at the start of a cell that repeats the previous bit. Sample k is
+    the level at k / sample_rate seconds from the clip, at ips.
+
+    The encoder walks the half cells of the bytes in order and fills the
+    samples of each with its level, so it costs about a store per sample.
+    render() can be called for any number of samples at a time, which
+    bounds the memory of a capture to its chunk; save() streams a WAV file
+    this way.
+
+    With flutter, the speed varies as ips * (1 + flutter * sin(2π kFlutterHz t))
+    like a capstan out of round, and the start of each half cell is found
+    from the tape position by Newton's method.
+*/
+
+class tape_encoder_t
+{
+public:
+    struct options_t
+    {
+        uint32_t sample_rate = 96000;
+        double ips = IPS;
+        float level = 0.8f;
+        double flutter = 0;     //  Speed variation at kFlutterHz, as a fraction of ips
+        bool whole = false;     //  To the end of the tape, rather than just after the last byte
+        size_t chunk = 65536;   //  Samples per write in save()
+    };
+
+    static const uint32_t kTailCells = 16; //  Silence after the last byte
+    static constexpr double kFlutterHz = 3;
+
+private:
+    const tape_t &tape_;
+    options_t options_;
+    double half_samples_;   //  Samples per half cell
+    uint64_t count_;
+    uint64_t sample_ = 0;   //  Next one
+    uint64_t end_ = 0;      //  Of the current segment
+    float value_ = 0;       //  Of the current segment
+    size_t run_ = 0;        //  Next half cell to render
+    size_t index_ = 0;
+    unsigned half_ = 0;     //  Of the byte
+
+    //  First sample at or after the start of a half cell
+    uint64_t sample_of(uint64_t half) const
+    {
+        if (options_.flutter == 0)
+            return (uint64_t)std::ceil(half * half_samples_);
+        return (uint64_t)std::ceil(seconds_of(half) * options_.sample_rate);
+    }
+
+    //  Seconds from the clip to the start of a half cell, with flutter
+    double seconds_of(uint64_t half) const;
+
+    void next_segment();
+
+public:
+    tape_encoder_t(const tape_t &tape, const options_t &options);
+    explicit tape_encoder_t(const tape_t &tape) : tape_encoder_t(tape, options_t()) {}
+
+    //  Samples in the capture
+    uint64_t count() const { return count_; }
+
+    //  The next samples, at most max; 0 at the end
+    size_t render(float *samples, size_t max);
+
+    //  As a 16-bit mono WAV file
+    //  Throws std::runtime_error if the file cannot be written
+    static void save(const tape_t &tape, const std::string &path, const options_t &options);
+    static void save(const tape_t &tape, const std::string &path) { save(tape, path, options_t()); }
+};
+
+void test_tape_encoder_t();
@@ -0,0 +1,198 @@
+#include "tape_journal.hpp"
+#include "tape.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+static const char kMagic[8] = "ICLJRNL";
+
+tape_journal_t::~tape_journal_t()
+{
+    if (file_)
+        fclose(file_);
+}
+
+static void put_le32(std::vector<uint8_t> &data, uint32_t value)
+{
+    for (int i = 0; i != 4; i++)
+        data.push_back(value >> (8 * i));
+}
+
+static uint32_t get_le32(const uint8_t *p)
+{
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+void tape_journal_t::append(const tape_extent_t &extent)
+{
+    std::vector<uint8_t> data;
+    if (!file_)
+    {
+        //  Without a torn extent or header, which would swallow the start of this one
+        std::error_code error;
+        if (std::filesystem::exists(path_, error) && std::filesystem::file_size(path_, error) > length_)
+            std::filesystem::resize_file(path_, length_, error);
+        if (error)
+            throw std::runtime_error("Cannot write tape journal: " + path_);
+        file_ = fopen(path_.c_str(), "ab");
+        if (!file_)
+            throw std::runtime_error("Cannot write tape journal: " + path_);
+        if (ftell(file_) == 0)
+        {
+            data.insert(data.end(), kMagic, kMagic + 8);
+            put_le32(data, kVersion);
+        }
+    }
+    put_le32(data, extent.begin);
+    put_le32(data, extent.end);
+    put_le32(data, extent.first);
+    put_le32(data, extent.bytes.size());
+    data.insert(data.end(), extent.bytes.begin(), extent.bytes.end());
+    if (fwrite(data.data(), 1, data.size(), file_) != data.size() || fflush(file_) != 0)
+        throw std::runtime_error("Cannot write tape journal: " + path_);
+    extents_++;
+    length_ += data.size();
+}
+
+void tape_journal_t::clear()
+{
+    if (file_)
+        fclose(file_);
+    file_ = nullptr;
+    remove(path_.c_str());
+    extents_ = 0;
+    length_ = 0;
+}
+
+std::vector<tape_extent_t> tape_journal_t::read(const std::string &path, size_t *length)
+{
+    std::vector<tape_extent_t> extents;
+    if (length)
+        *length = 0;
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        return extents;
+    std::vector<uint8_t> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    if (data.size() < 12 && (data.empty() || memcmp(data.data(), kMagic, std::min<size_t>(data.size(), 8)) == 0))
+        return extents; //  Torn header: nothing journaled yet
+    if (data.size() < 12 || memcmp(data.data(), kMagic, 8) != 0)
+        throw std::runtime_error("Not a tape journal: " + path);
+    if (get_le32(data.data() + 8) != kVersion)
+        throw std::runtime_error("Unsupported tape journal version: " + path);
+
+    size_t offset = 12;
+    while (data.size() - offset >= 16)
+    {
+        auto p = data.data() + offset;
+        auto count = get_le32(p + 12);
+        if (data.size() - offset - 16 < count)
+            break; //  Torn
+        tape_extent_t extent{get_le32(p), get_le32(p + 4), get_le32(p + 8), std::vector<uint8_t>(p + 16, p + 16 + count)};
+        extents.push_back(std::move(extent));
+        offset += 16 + count;
+    }
+    if (length)
+        *length = offset;
+    return extents;
+}
+
+void test_tape_journal_t()
+{
+    auto path = test_path("journal.tape");
+    auto journal_path = tape_journal_t::path_of(path);
+    remove(journal_path.c_str());
+    const uint32_t b = tape_t::kCellsPerByte;
+
+    //  Base image: 1 2 3 4 at 30 inches, 5 6 at 40 inches
+    tape_t base;
+    for (int i = 0; i != 4; i++)
+        base.append_cell(30 * BPI + i * b, i + 1);
+    base.append_cell(40 * BPI, 5);
+    base.append_cell(40 * BPI + b, 6);
+    base.save(path);
+
+    auto tape = tape_t::map(path);
+    tape->open_journal(journal_path);
+    assert(tape->mapped() && !tape->journaled());
+
+    //  In place: 2 3 become 012 013, the tape is now owned
+    tape->write({30 * BPI + b, 30 * BPI + 3 * b, 30 * BPI + b, {012, 013}});
+    assert(!tape->mapped() && tape->size() == 6 && tape->runs() == 2);
+    assert((*tape)[1] == 012 && (*tape)[2] == 013 && (*tape)[3] == 4);
+
+    //  Appended after the last byte, with a gap
+    tape->write({50 * BPI, 50 * BPI + 2 * b, 50 * BPI, {020, 021}});
+    assert(tape->size() == 8 && tape->runs() == 3 && tape->location_cell(7) == 50 * BPI + b);
+
+    //  Not aligned: overlaps 4 (and 5 from the erase), a new run between
+    tape->write({30 * BPI + 3 * b + 4, 40 * BPI + 1, 30 * BPI + 3 * b + 4, {030}});
+    assert(tape->size() == 7 && tape->runs() == 4);
+    assert((*tape)[3] == 030 && tape->location_cell(3) == 30 * BPI + 3 * b + 4);
+    assert((*tape)[4] == 6 && tape->location_cell(4) == 40 * BPI + b);
+
+    //  Erase only
+    tape->write({0, 31 * BPI, 0, {}});
+    assert(tape->size() == 3 && (*tape)[0] == 6);
+    assert(tape->journaled());
+
+    //  The file is untouched, the journal replays on top of it
+    auto reference = tape_t::map(path);
+    assert(reference->size() == 6 && (*reference)[1] == 2);
+    auto extents = tape_journal_t::read(journal_path);
+    assert(extents.size() == 4 && extents[1].bytes == std::vector<uint8_t>({020, 021}));
+    reference->open_journal(journal_path);
+    assert(*reference == *tape && reference->journaled());
+
+    //  A torn extent is ignored
+    FILE *f = fopen(journal_path.c_str(), "ab");
+    fwrite("\0\0\0\0\0\0\0\0\0\0\0\0\5\0\0\0\1\2", 1, 18, f);
+    fclose(f);
+    assert(tape_journal_t::read(journal_path).size() == 4);
+
+    //  Then cut before the next write: 022 replaces 020
+    tape.reset();
+    tape = tape_t::map(path);
+    tape->open_journal(journal_path);
+    tape->write({50 * BPI, 50 * BPI + b, 50 * BPI, {022}});
+    assert(tape->size() == 3 && (*tape)[1] == 022);
+    reference = tape_t::map(path);
+    reference->open_journal(journal_path);
+    assert(*reference == *tape && tape_journal_t::read(journal_path).size() == 5);
+
+    //  Compaction: the same tape from the new image alone
+    tape->compact(path);
+    assert(!tape->journaled() && tape_journal_t::read(journal_path).empty());
+    auto compacted = tape_t::load(path);
+    assert(compacted->mapped() && *compacted == *tape);
+
+    bool thrown = false;
+    f = fopen(journal_path.c_str(), "wb");
+    fputs("not a journal", f);
+    fclose(f);
+    try
+    {
+        tape_journal_t::read(journal_path);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    //  A torn header is an empty journal, written again with the next extent
+    f = fopen(journal_path.c_str(), "wb");
+    fwrite(kMagic, 1, 5, f);
+    fclose(f);
+    assert(tape_journal_t::read(journal_path).empty());
+    tape = tape_t::map(path);
+    tape->open_journal(journal_path);
+    tape->write({50 * BPI, 50 * BPI + b, 50 * BPI, {022}});
+    assert(tape_journal_t::read(journal_path).size() == 1);
+    remove(journal_path.c_str());
+    remove(path.c_str());
+}
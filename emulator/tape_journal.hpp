@@ -0,0 +1,75 @@
+#pragma once
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+/*
+    What the machine writes to a tape, kept apart from the tape file.
+
+    A tape file (text or image) is never rewritten as the machine writes:
+    writes go to a journal next to it (PATH.journal), append-only. An entry
+    is an extent: a range of cells that is erased, then bytes written one
+    after the other from a cell in that range. Mounting the tape replays
+    its journal on top of the file (see tape_t::open_journal()); compaction
+    saves the result as a new image and removes the journal.
+
+    The journal file is only created by the first write, and each extent
+    is flushed when appended: a run that stops keeps what it wrote.
+
+    File format: "ICLJRNL\0", version (4 bytes), then the extents: begin,
+    end, first cell (4 bytes each), byte count (4 bytes), the bytes. A torn
+    last extent (the host stopped while appending it) is ignored, and cut
+    from the file before the next append.
+*/
+
+struct tape_extent_t
+{
+    uint32_t begin = 0; //  Erased cells: [begin, end)
+    uint32_t end = 0;
+    uint32_t first = 0; //  Cell of bytes[0], the others follow without a gap
+    std::vector<uint8_t> bytes;
+
+    bool operator==(const tape_extent_t &) const = default;
+};
+
+class tape_journal_t
+{
+    std::string path_;
+    FILE *file_ = nullptr; //  nullptr until the first append()
+    size_t extents_ = 0;
+    size_t length_ = 0;    //  Of the file, up to the last whole extent
+
+public:
+    static const uint32_t kVersion = 1;
+
+    //  The journal of the tape file at path
+    static std::string path_of(const std::string &tape_path) { return tape_path + ".journal"; }
+
+    //  Appends after the extents already in the file, length bytes (see read())
+    explicit tape_journal_t(const std::string &path, size_t extents = 0, size_t length = 0)
+        : path_(path), extents_(extents), length_(length) {}
+    ~tape_journal_t();
+
+    tape_journal_t(const tape_journal_t &) = delete;
+    tape_journal_t &operator=(const tape_journal_t &) = delete;
+
+    const std::string &path() const { return path_; }
+
+    //  Extents in the file
+    size_t extents() const { return extents_; }
+
+    //  Throws std::runtime_error if the file cannot be written
+    void append(const tape_extent_t &extent);
+
+    //  Removes the file, once compacted into the tape
+    void clear();
+
+    //  The extents of a journal file, none if there is no file
+    //  length receives the bytes of the file up to the last whole extent
+    //  Throws std::runtime_error if the file is not a journal
+    static std::vector<tape_extent_t> read(const std::string &path, size_t *length = nullptr);
+};
+
+void test_tape_journal_t();
@@ -0,0 +1,172 @@
+#include "tape_library.hpp"
+
+#include <cassert>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+tape_library_t::~tape_library_t()
+{
+    for (int deck = 0; deck != kDecks; deck++)
+    {
+        try
+        {
+            unmount(deck);
+        }
+        catch (const std::runtime_error &e)
+        {
+            //  The journal is still there
+            fprintf(stderr, "%s\n", e.what());
+        }
+    }
+}
+
+void tape_library_t::unmount(int deck)
+{
+    if (compact_on_release_)
+        compact(deck);
+    decks_[deck].tape.reset();
+}
+
+void tape_library_t::assign(int deck, const std::string &path)
+{
+    unmount(deck);
+    decks_[deck].path = path;
+}
+
+void tape_library_t::insert(int deck, std::unique_ptr<tape_t> tape)
+{
+    unmount(deck);
+    decks_[deck].tape = std::move(tape);
+    decks_[deck].path.clear();
+}
+
+void tape_library_t::eject(int deck)
+{
+    unmount(deck);
+    decks_[deck].path.clear();
+}
+
+void tape_library_t::release(int deck)
+{
+    unmount(deck);
+}
+
+tape_t *tape_library_t::mount(int deck)
+{
+    auto &d = decks_[deck];
+    if (!d.tape && !d.path.empty())
+    {
+        auto tape = tape_t::load(d.path);
+        tape->open_journal(tape_journal_t::path_of(d.path));
+        d.tape = std::move(tape);
+        loads_++;
+    }
+    return d.tape.get();
+}
+
+void tape_library_t::compact(int deck)
+{
+    auto &d = decks_[deck];
+    if (d.tape && !d.path.empty() && d.tape->journaled())
+        d.tape->compact(d.path);
+}
+
+void tape_library_t::configure(std::string_view text, const std::string &directory)
+{
+    size_t line = 0;
+    while (!text.empty())
+    {
+        line++;
+        auto eol = text.find('\n');
+        auto content = text.substr(0, eol);
+        text = eol == std::string_view::npos ? std::string_view() : text.substr(eol + 1);
+
+        content = content.substr(0, content.find('#'));
+        auto begin = content.find_first_not_of(" \t\r");
+        if (begin == std::string_view::npos)
+            continue;
+        content = content.substr(begin, content.find_last_not_of(" \t\r") + 1 - begin);
+
+        auto blank = content.find_first_of(" \t");
+        if (content[0] < '1' || content[0] > '0' + kDecks || blank != 1)
+            throw std::runtime_error("Tape library line " + std::to_string(line) + ": expected a deck from 1 to " +
+                                     std::to_string(kDecks) + " and a path");
+        auto path = std::filesystem::path(std::string(content.substr(content.find_first_not_of(" \t", blank))));
+        if (path.is_relative() && !directory.empty())
+            path = std::filesystem::path(directory) / path;
+        assign(content[0] - '1', path.string());
+    }
+}
+
+void tape_library_t::load_config(const std::string &path)
+{
+    std::ifstream file(path);
+    if (!file)
+        throw std::runtime_error("Cannot open tape library: " + path);
+    std::stringstream text;
+    text << file.rdbuf();
+    configure(text.str(), std::filesystem::path(path).parent_path().string());
+}
+
+void test_tape_library_t()
+{
+    auto directory = std::filesystem::path(test_path("library"));
+    std::filesystem::create_directories(directory);
+    tape_t({1, 2, 3}).save((directory / "a.tape").string());
+    FILE *f = fopen((directory / "b.txt").c_str(), "w");
+    fputs("0030.0000: 100\n", f);
+    fclose(f);
+    f = fopen((directory / "decks").c_str(), "w");
+    fputs("# Test decks\n1 a.tape\n\n  4\tb.txt  # comment\n8 missing.tape\n", f);
+    fclose(f);
+
+    tape_library_t library;
+    library.load_config((directory / "decks").string());
+    assert(library.present(0) && library.present(3) && library.present(7) && !library.present(1));
+    assert(!library.mounted(0) && library.loads() == 0);
+    assert(library.path(3) == (directory / "b.txt").string());
+
+    //  Loaded when first used, once
+    auto a = library.mount(0);
+    assert(a && a->mapped() && a->size() == 3 && library.mounted(0));
+    assert(library.mount(0) == a && library.loads() == 1);
+    assert(library.mount(3)->size() == 1 && library.loads() == 2);
+    assert(!library.mount(1));
+
+    //  Released, and loaded again
+    library.release(0);
+    assert(!library.mounted(0) && library.present(0));
+    assert(library.mount(0)->size() == 3 && library.loads() == 3);
+    library.eject(3);
+    assert(!library.present(3) && !library.mount(3));
+
+    bool thrown = false;
+    try
+    {
+        library.mount(7);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    library.insert(7, std::make_unique<tape_t>(std::vector<uint8_t>{4}));
+    assert(library.mounted(7) && library.path(7).empty());
+
+    thrown = false;
+    try
+    {
+        library.configure("1 a.tape\n9 b.tape\n");
+    }
+    catch (const std::runtime_error &e)
+    {
+        thrown = std::string(e.what()) == "Tape library line 2: expected a deck from 1 to 8 and a path";
+    }
+    assert(thrown);
+
+    std::filesystem::remove_all(directory);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <memory>
+
+#include "tape.hpp"
+
+/*
+    The cartridges in the tape decks.
+
+    The machine has two built-in decks, and up to three Model 1533 dual
+    drives: eight decks in four pairs (numbered from 0 here, 1 to 8 in the
+    manual). Each deck holds a tape given directly, or the path of a tape
+    file (text or image, see tape_t::load()), from a configuration:
+
+        # deck path, paths relative to the configuration file
+        1 boot.tape
+        3 /archive/payroll.txt
+
+    Files are only opened when the deck is first used (mount()), images
+    are mapped rather than read, and ejecting a deck releases its tape. A
+    job that configures eight decks only pays for the tapes it touches.
+
+    What the machine writes to a tape file goes to its journal (see
+    tape_journal.hpp), replayed when the file is mounted again. compact()
+    makes the file an image with the writes, on demand, or when the tape
+    is released if set_compact_on_release().
+*/
+
+class tape_library_t
+{
+public:
+    static const int kDecks = 8;
+
+private:
+    struct deck_t
+    {
+        std::string path;            //  Empty if the tape was given directly
+        std::unique_ptr<tape_t> tape; //  nullptr until mounted
+    };
+
+    deck_t decks_[kDecks];
+    size_t loads_ = 0;
+    bool compact_on_release_ = false;
+
+    //  Compacts if set to, before the tape goes
+    void unmount(int deck);
+
+public:
+    tape_library_t() = default;
+    ~tape_library_t();
+
+    tape_library_t(const tape_library_t &) = delete;
+    tape_library_t &operator=(const tape_library_t &) = delete;
+
+    //  A tape file, opened later. Replaces the cartridge in the deck
+    void assign(int deck, const std::string &path);
+
+    //  A tape already in memory. Replaces the cartridge in the deck
+    void insert(int deck, std::unique_ptr<tape_t> tape);
+
+    //  Removes the cartridge, releasing its tape
+    void eject(int deck);
+
+    //  Reverts to the file, releasing the tape until it is mounted again
+    //  (for tapes given directly, same as eject())
+    void release(int deck);
+
+    //  A cartridge is in the deck (mounted or not)
+    bool present(int deck) const { return decks_[deck].tape || !decks_[deck].path.empty(); }
+    bool mounted(int deck) const { return decks_[deck].tape != nullptr; }
+    const std::string &path(int deck) const { return decks_[deck].path; }
+
+    //  The tape in the deck, loaded if needed with its journal; nullptr if the deck is empty
+    //  Throws std::runtime_error if the file or its journal cannot be loaded
+    tape_t *mount(int deck);
+
+    //  Tape files opened so far
+    size_t loads() const { return loads_; }
+
+    //  Writes the file of the deck as an image with what was written to the
+    //  tape, and removes the journal. Nothing to do if nothing was written
+    //  Throws std::runtime_error if the image cannot be written
+    void compact(int deck);
+
+    //  Compact when a tape is released, ejected or replaced, and at the end
+    void set_compact_on_release(bool compact) { compact_on_release_ = compact; }
+
+    //  Throws std::runtime_error with the line number on a syntax error
+    void configure(std::string_view text, const std::string &directory = "");
+
+    //  Throws std::runtime_error if the file cannot be read
+    void load_config(const std::string &path);
+};
+
+void test_tape_library_t();
@@ -1 +1,160 @@
+#include "tape.hpp"
 #include "tape_reader.hpp"
+
+#include <cassert>
+
+void test_tape_reader_t()
+{
+    //  30ms ramp to 10 ips covers 0.15 inches
+    tape_motion_t motion{0, 0.0, 0.0, tape_motion_t::kSlow};
+    assert(std::abs(motion.distance(0.030) - 0.15) < 1e-9);
+    assert(std::abs(motion.crossing(0.15) - 0.030) < 1e-9);
+    assert(std::abs(motion.crossing(30.0) - 3.015) < 1e-9);
+    assert(std::abs(motion.distance(motion.crossing(0.05)) - 0.05) < 1e-9);
+    assert(motion.crossing(-1.0) == tape_motion_t::kNever);
+
+    //  Reversing at slow speed: 0.15 inches further before turning around, back at the start after 60ms
+    auto back = motion.command(1000000, -tape_motion_t::kSlow);
+    assert(std::abs(back.inches - 9.85) < 1e-9 && back.velocity == tape_motion_t::kSlow);
+    assert(std::abs(back.departure() - 10.0) < 1e-9);
+    assert(back.crossing(10.5) == tape_motion_t::kNever);
+    assert(std::abs(back.crossing(9.85) - 0.060) < 1e-9);
+    assert(std::abs(back.crossing(5.0) - (0.060 + 4.85 / 10)) < 1e-9);
+
+    //  Fast to slow: 2.25 inches to slow down
+    tape_motion_t fast{0, 100.0, tape_motion_t::kFast, tape_motion_t::kSlow};
+    assert(std::abs(fast.distance(fast.ramp_seconds()) - 2.25) < 1e-9);
+    assert(std::abs(fast.distance(fast.crossing(101.0) ) - 1.0) < 1e-9);
+
+    scheduler_t scheduler;
+    tape_t tape({1, 2, 3});
+    tape_reader_t reader(&tape, scheduler);
+
+    uint8_t value;
+    assert(reader.transfer(value) && value == 0377); //  Stopped
+    assert(scheduler.empty());
+
+    //  First character after the leader
+    reader.start(0);
+    scheduler.run_until(3014000);
+    assert(!reader.transfer(value));
+    scheduler.run_until(3015000);
+    assert(reader.transfer(value) && value == 1);
+    assert(!reader.transfer(value));
+
+    //  Not transferred in time: the character is lost
+    scheduler.run_until(3016000);
+    assert(reader.overrun());
+    assert(reader.transfer(value) && value == 3);
+
+    //  Runaway after 5s without data
+    assert(reader.moving());
+    scheduler.run_until(3016000 + tape_reader_t::kRunawayCycles);
+    assert(!reader.moving());
+    assert(reader.runaway());
+    assert(scheduler.empty());
+
+    //  One character per inch from 30 to 1000 inches
+    tape_t spaced;
+    for (int i = 0; i <= 970; i++)
+        spaced.append(tape_location_t(30.0 + i), i);
+    tape_reader_t transport(&spaced, scheduler);
+
+    //  Reading back, from the last character read: 3, 2, 1, 0, then the clip stops the tape
+    uint64_t now = 0;
+    transport.start(now);
+    auto fourth = tape_motion_t::cycles(3.315);
+    scheduler.run_until(fourth);
+    assert(transport.transfer(value) && value == 3);
+    now = fourth + 50000; //  0.5 inch further
+    transport.reverse(false, now);
+    for (int i = 3; i >= 0; i--)
+    {
+        while (!transport.transfer(value))
+            scheduler.run_until(scheduler.next_cycle());
+        assert(value == i && transport.velocity(scheduler.next_cycle()) < 0);
+    }
+    assert(!transport.runaway() && transport.moving());
+    scheduler.run_until(scheduler.next_cycle());
+    assert(!transport.moving() && transport.location(scheduler.next_cycle()).inches() == 0.0);
+    assert(scheduler.empty() && !transport.runaway());
+
+    //  Fast forward, not reading: one event, at the end of the tape
+    tape_reader_t fast_forward(&spaced, scheduler);
+    fast_forward.forward(true, 0);
+    auto end = tape_motion_t::cycles(0.120 + (1200.0 - 2.4) / 40);
+    assert(scheduler.next_cycle() == end);
+    scheduler.run_until(end);
+    assert(!fast_forward.moving() && fast_forward.location(end + 1000000).inches() == 1200.0);
+    assert(scheduler.empty());
+
+    //  Rewind: one event, at the clip, even in read mode
+    fast_forward.read(end);
+    fast_forward.rewind(end);
+    assert(fast_forward.rewinding() && scheduler.next_cycle() == 2 * end);
+    scheduler.run_until(2 * end);
+    assert(!fast_forward.moving() && !fast_forward.rewinding() && fast_forward.location(2 * end).inches() == 0.0);
+
+    //  Fast forward in read mode, then slow: reading from where the head is,
+    //  found without going through the characters on the way
+    now = 2 * end;
+    fast_forward.forward(true, now);
+    now += tape_motion_t::cycles(0.120 + (500.5 - 2.4) / 40);
+    assert(std::abs(fast_forward.location(now).inches() - 500.5) < 1e-6);
+    fast_forward.forward(false, now);
+    while (!fast_forward.transfer(value))
+        scheduler.run_until(scheduler.next_cycle());
+    assert(value == (501 - 30) % 256);
+
+    //  Past the last character at fast speed: runaway after 50ms
+    fast_forward.forward(true, scheduler.next_cycle());
+    auto last = scheduler.next_cycle();
+    scheduler.run_until(last);
+    assert(fast_forward.runaway() && !fast_forward.moving());
+    assert(std::abs(fast_forward.location(last).inches() - (1000.0 + 2.0)) < 1e-3);
+
+    //  Writing: each character right after the previous one, the first where the head is
+    tape_t blank;
+    tape_reader_t writer(&blank, scheduler);
+    now = last;
+    writer.write_mode(now);
+    writer.forward(false, now);
+    now += 3000000; //  29.85 inches
+    for (uint8_t v : {1, 2, 3})
+        while (!writer.write(v, now))
+        {
+            now = scheduler.next_cycle();
+            scheduler.run_until(now);
+        }
+    assert(blank.size() == 0); //  Until the next command
+    now += 100000;              //  An inch later: after a gap
+    assert(writer.write(4, now));
+    writer.stop(now);
+    assert(blank.size() == 4 && blank.runs() == 2);
+    assert(blank.location_cell(0) == 47760 && blank.location_cell(2) == 47760 + 2 * tape_t::kCellsPerByte);
+    assert(blank[2] == 3 && blank[3] == 4);
+
+    //  Read back
+    writer.rewind(now);
+    now = scheduler.next_cycle();
+    scheduler.run_until(now);
+    writer.read(now);
+    writer.forward(false, now);
+    for (uint8_t v : {1, 2, 3, 4})
+    {
+        while (!writer.transfer(value))
+            scheduler.run_until(scheduler.next_cycle());
+        assert(value == v);
+    }
+
+    //  Erasing from the clip while writing: 7 replaces everything up to the head
+    writer.rewind(scheduler.next_cycle());
+    now = scheduler.next_cycle();
+    scheduler.run_until(now);
+    assert(!writer.moving() && writer.location(now).inches() == 0.0);
+    writer.write_mode(now);
+    writer.forward_erase(now);
+    assert(writer.erasing() && writer.write(7, now + 1000000));
+    writer.stop(now + 5000000);
+    assert(blank.size() == 1 && blank[0] == 7 && blank.location_cell(0) == 15760);
+}
@@ -2,9 +2,15 @@
 
 #include <cstdint>
 #include <vector>
-#include <iostream>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+#include <algorithm>
 
 #include "tape.hpp"
+#include "clock.hpp"
+#include "scheduler.hpp"
+#include "input_log.hpp"
 
 /*
     Info:
@@ -22,38 +28,613 @@
     Runaway detection:
         if tape runs but no flux transitions for ~5 s (slow) or 50 ms (fast), logic halts tape
 
-    Need transfer‑byte every 512 µs
+    Need transfer‑byte every 512 µs
         or underrun error?
 */
 
+/**
+ * The motion of the tape past the head since the last command: the
+ * velocity ramps at kAcceleration from its value at the command to the
+ * target, then stays there. Positive velocities move forward.
+ *
+ * Locations and crossing times are closed forms: a fast forward or a
+ * rewind across the whole tape costs the same as one character.
+ */
+struct tape_motion_t
+{
+    static constexpr double kRampSeconds = 0.030; //  From stopped to slow speed
+    static constexpr double kSlow = IPS;
+    static constexpr double kFast = 4 * IPS;
+    static constexpr double kAcceleration = kSlow / kRampSeconds;
+    static constexpr double kNever = std::numeric_limits<double>::infinity();
+
+    uint64_t cycle = 0;    //  Of the command
+    double inches = 0.0;   //  Location then
+    double velocity = 0.0; //  Inches per second then
+    double target = 0.0;   //  Inches per second, reached at the end of the ramp
+
+    static double seconds(uint64_t cycles) { return (double)cycles / guest_clock_t::kCyclesPerSecond; }
+
+    //  First cycle at or after seconds (with a nanosecond of slack for rounding)
+    static uint64_t cycles(double seconds) { return (uint64_t)std::ceil(seconds * guest_clock_t::kCyclesPerSecond - 1e-3); }
+
+    double acceleration() const { return target > velocity ? kAcceleration : -kAcceleration; }
+    double ramp_seconds() const { return std::abs(target - velocity) / kAcceleration; }
+
+    //  Seconds before the tape moves in the direction of target (0 unless turning around)
+    double turn_seconds() const { return velocity * target < 0 ? std::abs(velocity) / kAcceleration : 0.0; }
+
+    //  Signed inches covered seconds after the command
+    double distance(double seconds) const
+    {
+        auto ramp = std::min(seconds, ramp_seconds());
+        return velocity * ramp + acceleration() * ramp * ramp / 2 + target * (seconds - ramp);
+    }
+
+    double velocity_at(double seconds) const
+    {
+        return seconds >= ramp_seconds() ? target : velocity + acceleration() * seconds;
+    }
+
+    double location(uint64_t now) const { return inches + distance(seconds(now - cycle)); }
+
+    //  This motion at now, commanded towards another target
+    tape_motion_t command(uint64_t now, double new_target) const
+    {
+        auto s = seconds(now - cycle);
+        return {now, inches + distance(s), velocity_at(s), new_target};
+    }
+
+    //  Where the tape starts moving in the direction of target
+    double departure() const { return inches + distance(turn_seconds()); }
+
+    //  Seconds after the command when the head reaches location, moving in
+    //  the direction of target. kNever if it does not (stopping, or behind)
+    double crossing(double location) const
+    {
+        if (target == 0 || (location - departure()) * target < 0)
+            return kNever;
+        auto ramp = ramp_seconds();
+        auto reached = inches + distance(ramp);
+        if ((location - reached) * target >= 0)
+            return ramp + (location - reached) / target;
+
+        //  During the ramp: acceleration * t² / 2 + velocity * t = location - inches
+        //  The first root once moving the right way
+        auto a = acceleration();
+        auto root = std::sqrt(std::max(0.0, velocity * velocity + 2 * a * (location - inches)));
+        auto t1 = (-velocity - root) / a;
+        auto t2 = (-velocity + root) / a;
+        auto turn = turn_seconds() - 1e-12;
+        if (t1 > t2)
+            std::swap(t1, t2);
+        return t1 >= turn ? t1 : t2;
+    }
+};
+
 /**
  * This represent a physical tape reader/writer
+ *
+ * The transport follows the function codes: forward or reverse at slow
+ * (10 ips) or fast (40 ips) speed, stop, and rewind (fast reverse until
+ * the clip comes home). The motion is a tape_motion_t: the head location
+ * is known at any cycle without stepping through the tape.
+ *
+ * In read mode, at slow speed, characters reach the head when it crosses
+ * their location, in either direction (in reverse, last first). Each
+ * arrival is a scheduled event that fills the one character buffer. A
+ * character that is not transferred before the next one arrives is lost.
+ * At fast speed, characters pass unread: the next one is found with a
+ * binary search (tape_t::seek()) when the tape is slowed down, so moving
+ * across the whole tape posts no event per character.
+ *
+ * Runaway: reading with no character ahead halts the tape after 5 s at
+ * slow speed, or 50 ms past the last character at fast speed. A rewind
+ * does not run away. The tape stops at once at the clip (reverse) and
+ * at the end of the tape (forward).
+ *
+ * Writing: in write mode, moving forward at slow speed, each transfer
+ * writes a character where the head is, or right after the previous one
+ * if the head has not gone further: the CPU waits until the head passed
+ * it. A character written late starts a new extent, after a gap. Forward
+ * slow erase erases the tape that passes the head until the next command.
+ * The extent is written to the tape (tape_t::write()) at the next
+ * command, so reading always sees it. Snapshots do not undo writes.
+ *
+ * With an input log, the character and runaway events are recorded when
+ * scheduled, or replayed instead of reading the tape (see input_log.hpp).
  */
-class tape_reader_t
+class tape_reader_t : public event_handler_t
 {
-    size_t position_;
+    size_t position_;  //  Characters behind the head
     tape_t *tape_;
+    scheduler_t &scheduler_;
+
+    tape_motion_t motion_;
+    bool read_ = false;      //  Read mode (read F/F)
+    bool rewinding_ = false; //  Until the clip comes home
+    bool write_ = false;     //  Write mode
+    bool erase_ = false;     //  Forward slow erase
+
+    //  Being written, until the next command
+    bool extent_open_ = false;
+    tape_extent_t extent_;
+    bool write_wait_ = false; //  A write waits for the head to pass the previous character
+
+    //  Character buffer
+    bool buffer_full_ = false;
+    uint8_t buffer_ = 0;
+
+    bool overrun_ = false; //  A character was lost
+    bool runaway_ = false; //  Halted after running without data
+
+    input_log_t *log_ = nullptr;
+    int device_ = 0;        //  Stream in the log
+    size_t log_index_ = 0;  //  Next event in the stream
+
+    bool replaying() const { return log_ && log_->replaying(); }
+
+    //  The one event posted at a time
+    bool event_pending_ = false;
+    uint64_t event_cycle_ = 0;
+    uint32_t event_tag_ = 0;
+    uint8_t event_value_ = 0; //  The character, for kEventByte
+
+    void post(uint64_t cycle, uint32_t tag)
+    {
+        scheduler_.post(cycle, this, tag);
+        event_pending_ = true;
+        event_cycle_ = cycle;
+        event_tag_ = tag;
+    }
+
+    void cancel()
+    {
+        scheduler_.cancel(this);
+        event_pending_ = false;
+    }
+
+    enum
+    {
+        kEventByte,
+        kEventRunaway,
+        kEventLimit,      //  Clip or end of tape
+        kEventWriteReady, //  The head passed the last character written
+    };
+
+    bool reading() const
+    {
+        return read_ && std::abs(motion_.target) == tape_motion_t::kSlow;
+    }
+
+    bool writing() const
+    {
+        return write_ && motion_.target == tape_motion_t::kSlow;
+    }
+
+    uint32_t head_cell(uint64_t now) const { return tape_t::cell(location(now)); }
+
+    //  Where the next contiguous character goes
+    uint32_t next_cell() const { return extent_.first + (uint32_t)extent_.bytes.size() * tape_t::kCellsPerByte; }
+
+    void open_extent(uint32_t cell)
+    {
+        extent_open_ = true;
+        extent_ = {cell, cell, cell, {}};
+    }
+
+    //  Writes the extent to the tape, erased up to the head if erasing
+    void commit(uint64_t now)
+    {
+        if (!extent_open_)
+            return;
+        extent_open_ = false;
+        if (erase_)
+            extent_.end = std::max(extent_.end, head_cell(now));
+        if (tape_ && extent_.end > extent_.begin)
+            tape_->write(extent_);
+        extent_ = {};
+    }
+
+    uint64_t arrival(double inches) const
+    {
+        auto seconds = motion_.crossing(inches);
+        if (seconds == tape_motion_t::kNever)
+            return scheduler_t::kNever;
+        return motion_.cycle + tape_motion_t::cycles(seconds);
+    }
+
+    //  In read mode, moving: the next character, or the runaway, from the tape
+    input_log_t::input_t next_event(uint64_t now) const
+    {
+        bool forward = motion_.target > 0;
+        if (reading())
+        {
+            if (forward ? position_ == tape_->size() : position_ == 0)
+                return {now + kRunawayCycles, 0, true};
+            auto index = forward ? position_ : position_ - 1;
+            return {arrival(tape_->location(index).inches()), (*tape_)[index], false};
+        }
+
+        //  Fast: after the last character in the direction of motion
+        uint64_t last = scheduler_t::kNever;
+        if (tape_->size())
+            last = arrival(tape_->location(forward ? tape_->size() - 1 : 0).inches());
+        return {(last == scheduler_t::kNever ? now : std::max(now, last)) + kFastRunawayCycles, 0, true};
+    }
+
+    //  Posts the earliest of the next character or runaway (or the head
+    //  ready for a write), and of the clip or end of tape
+    void schedule(uint64_t now)
+    {
+        cancel();
+        if (motion_.target == 0)
+            return;
+        auto limit = arrival(motion_.target > 0 ? end().inches() : 0.0);
+        if (write_wait_)
+        {
+            auto ready = arrival((double)next_cell() / BPI);
+            if (ready <= limit)
+            {
+                post(ready, kEventWriteReady);
+                return;
+            }
+        }
+
+        input_log_t::input_t input;
+        bool has_event = read_ && !rewinding_;
+        if (has_event)
+        {
+            if (replaying())
+                input = log_->at(device_, log_index_++);
+            else
+            {
+                input = next_event(now);
+                if (log_)
+                    log_->record(device_, log_index_++, input);
+            }
+        }
+
+        if (has_event && input.cycle <= limit)
+        {
+            event_value_ = input.value;
+            post(input.cycle, input.runaway ? kEventRunaway : kEventByte);
+        }
+        else if (limit != scheduler_t::kNever)
+            post(limit, kEventLimit);
+    }
+
+    //  Characters behind the head once it moves in the direction of the motion
+    //  Unchanged while reading on in the same direction: all crossings were read
+    void resync()
+    {
+        if (tape_)
+            position_ = tape_->seek(tape_location_t(motion_.departure()));
+    }
+
+    //  New target speed at now (negative in reverse), read mode and erase
+    //  Ends the extent being written
+    void drive(double target, bool read, bool erase, uint64_t now)
+    {
+        if (!(tape_ || replaying()))
+            return;
+        commit(now);
+        write_wait_ = false;
+        bool same = reading() && read && std::abs(target) == tape_motion_t::kSlow && motion_.target == target;
+        motion_ = motion_.command(now, target);
+        clamp();
+        read_ = read;
+        erase_ = erase && target > 0;
+        if (erase_)
+            open_extent(tape_t::cell(tape_location_t(motion_.departure())));
+        if (!same)
+            resync();
+        schedule(now);
+    }
+
+    //  The clip and the end of the tape stop the tape
+    void clamp()
+    {
+        auto end = this->end().inches();
+        if (motion_.inches < 0 || motion_.inches > end)
+        {
+            motion_.inches = std::clamp(motion_.inches, 0.0, end);
+            motion_.velocity = 0;
+        }
+    }
 
 public:
-    tape_reader_t(tape_t *tape)
-        : position_(0), tape_(tape)
+    static const uint64_t kRunawayCycles = 5 * guest_clock_t::kCyclesPerSecond;
+    static const uint64_t kFastRunawayCycles = guest_clock_t::kCyclesPerSecond / 20;
+
+    tape_reader_t(tape_t *tape, scheduler_t &scheduler)
+        : position_(0), tape_(tape), scheduler_(scheduler)
+    {
+    }
+
+    tape_reader_t(const tape_reader_t &) = delete;
+    tape_reader_t &operator=(const tape_reader_t &) = delete;
+
+    ~tape_reader_t()
+    {
+        scheduler_.cancel(this);
+        try
+        {
+            commit(motion_.cycle);
+        }
+        catch (const std::runtime_error &e)
+        {
+            //  The journal cannot be written: the extent is lost
+            fprintf(stderr, "%s\n", e.what());
+        }
+    }
+
+    //  Where the head is
+    tape_location_t location(uint64_t now) const
+    {
+        return tape_location_t(std::clamp(motion_.location(now), 0.0, end().inches()));
+    }
+
+    //  Inches per second, negative in reverse
+    double velocity(uint64_t now) const
+    {
+        return motion_.velocity_at(tape_motion_t::seconds(now - motion_.cycle));
+    }
+
+    //  The end of the tape (of a default tape if none is mounted)
+    tape_location_t end() const
+    {
+        static const tape_t none;
+        return (tape_ ? tape_ : &none)->end();
+    }
+
+    const tape_t *tape() const { return tape_; }
+
+    //  Another tape, or none, from its start
+    //  If moving, the head continues from the start of the new tape
+    void mount(tape_t *tape, uint64_t now)
+    {
+        commit(now);
+        erase_ = write_wait_ = false;
+        cancel();
+        tape_ = tape;
+        position_ = 0;
+        buffer_full_ = false;
+        overrun_ = false;
+        motion_ = motion_.command(now, motion_.target);
+        motion_.inches = 0;
+        if (motion_.target == 0)
+            return;
+        if (tape_ || replaying())
+            schedule(now);
+        else
+            motion_ = {now, 0.0, 0.0, 0.0};
+    }
+
+    //  Writes the extent being written to the tape, before the tape goes
+    void flush(uint64_t now)
+    {
+        commit(now);
+        erase_ = false;
+    }
+
+    //  Records to log, or replays from it, as stream device. nullptr for the tape alone
+    //  A pending event is scheduled again, through the log
+    void set_input_log(input_log_t *log, int device, uint64_t now)
+    {
+        log_ = log;
+        device_ = device;
+        log_index_ = 0;
+        if (event_pending_)
+            schedule(now);
+    }
+
+    bool moving() const { return motion_.target != 0; }
+    bool rewinding() const { return rewinding_; }
+    bool read_mode() const { return read_; }
+    bool write_mode() const { return write_; }
+    bool erasing() const { return erase_; }
+    bool overrun() const { return overrun_; }
+    bool runaway() const { return runaway_; }
+    void clear_errors() { overrun_ = runaway_ = false; }
+
+    //  The function codes
+    void forward(bool fast, uint64_t now)
     {
-        if (tape)
+        rewinding_ = false;
+        runaway_ = false;
+        drive(fast ? tape_motion_t::kFast : tape_motion_t::kSlow, read_, false, now);
+    }
+
+    void forward_erase(uint64_t now)
+    {
+        rewinding_ = false;
+        runaway_ = false;
+        drive(tape_motion_t::kSlow, read_, true, now);
+    }
+
+    void reverse(bool fast, uint64_t now)
+    {
+        rewinding_ = false;
+        runaway_ = false;
+        drive(fast ? -tape_motion_t::kFast : -tape_motion_t::kSlow, read_, false, now);
+    }
+
+    //  Fast reverse to the clip, which stops the tape
+    void rewind(uint64_t now)
+    {
+        runaway_ = false;
+        rewinding_ = true;
+        drive(-tape_motion_t::kFast, read_, false, now);
+    }
+
+    void stop(uint64_t now)
+    {
+        rewinding_ = false;
+        if (moving())
+            drive(0.0, read_, false, now);
+    }
+
+    //  Read and write modes exclude each other
+    void read(uint64_t now)
+    {
+        if (read_ && !write_)
+            return;
+        write_ = false;
+        drive(motion_.target, true, erase_, now);
+    }
+
+    void write_mode(uint64_t now)
+    {
+        if (write_)
+            return;
+        write_ = true;
+        drive(motion_.target, false, erase_, now);
+    }
+
+    //  The LOAD key: read mode, forward at slow speed
+    void start(uint64_t now)
+    {
+        read_ = true;
+        write_ = false;
+        if (!reading())
+            forward(false, now);
+    }
+
+    //  Transfer-byte: false if the character is not there yet (the CPU has to wait)
+    //  With no character coming (stopped, or past the end of the data), reads 0377 without waiting
+    bool transfer(uint8_t &value)
+    {
+        if (buffer_full_)
+        {
+            value = buffer_;
+            buffer_full_ = false;
+            return true;
+        }
+        if (!(event_pending_ && event_tag_ == kEventByte))
         {
-            std::cout << "Mounted tape:\n";
-            tape->dump();
+            value = 0xff;
+            return true;
         }
+        return false;
     }
 
-    bool has_next() const
+    //  Write-transfer: false if the head has not passed the previous character yet (the CPU has to wait)
+    //  Nothing is written unless moving forward at slow speed in write mode
+    bool write(uint8_t value, uint64_t now)
     {
-        return position_ < tape_->size();
+        if (!writing())
+            return true;
+        auto head = head_cell(now);
+        if (extent_open_ && !extent_.bytes.empty())
+        {
+            if (head < next_cell())
+            {
+                if (!write_wait_)
+                {
+                    write_wait_ = true;
+                    schedule(now);
+                }
+                return false;
+            }
+            if (head >= next_cell() + tape_t::kCellsPerByte)
+            {
+                //  Late: after a gap
+                commit(now);
+                open_extent(head);
+            }
+        }
+        else if (extent_open_)
+            extent_.first = head; //  Erasing, the first character
+        else
+            open_extent(head);
+        extent_.bytes.push_back(value);
+        extent_.end = std::max(extent_.end, next_cell());
+        return true;
     }
 
-    uint8_t next()
+    //  Everything that changes while reading (the tape itself is not included)
+    struct state_t
+    {
+        size_t position;
+        tape_motion_t motion;
+        bool read;
+        bool rewinding;
+        bool write;
+        bool erase;
+        bool extent_open;
+        tape_extent_t extent;
+        bool write_wait;
+        bool buffer_full;
+        uint8_t buffer;
+        bool overrun;
+        bool runaway;
+        size_t log_index;
+        bool event_pending;
+        uint64_t event_cycle;
+        uint32_t event_tag;
+        uint8_t event_value;
+    };
+
+    state_t state() const
     {
-        if (!has_next())
-            return 0xff;
-        return (*tape_)[position_++];
+        return {position_, motion_, read_, rewinding_, write_, erase_, extent_open_, extent_, write_wait_, buffer_full_, buffer_, overrun_, runaway_,
+                log_index_, event_pending_, event_cycle_, event_tag_, event_value_};
+    }
+
+    //  Back to a state() of this reader, or of one with the same tape
+    void restore(const state_t &state)
+    {
+        cancel();
+        position_ = state.position;
+        motion_ = state.motion;
+        read_ = state.read;
+        rewinding_ = state.rewinding;
+        write_ = state.write;
+        erase_ = state.erase;
+        extent_open_ = state.extent_open;
+        extent_ = state.extent;
+        write_wait_ = state.write_wait;
+        buffer_full_ = state.buffer_full;
+        buffer_ = state.buffer;
+        overrun_ = state.overrun;
+        runaway_ = state.runaway;
+        log_index_ = state.log_index;
+        event_value_ = state.event_value;
+        if (state.event_pending)
+            post(state.event_cycle, state.event_tag);
+    }
+
+    void on_event(uint64_t cycle, uint32_t tag) override
+    {
+        event_pending_ = false;
+        switch (tag)
+        {
+        case kEventByte:
+            if (buffer_full_)
+                overrun_ = true;
+            buffer_ = event_value_;
+            buffer_full_ = true;
+            if (tape_)
+                position_ += motion_.target > 0 ? 1 : -1;
+            schedule(cycle);
+            break;
+        case kEventRunaway:
+            stop(cycle);
+            runaway_ = true;
+            break;
+        case kEventWriteReady:
+            write_wait_ = false;
+            schedule(cycle);
+            break;
+        case kEventLimit:
+            commit(cycle);
+            erase_ = write_wait_ = false;
+            rewinding_ = false;
+            motion_ = {cycle, motion_.target > 0 ? end().inches() : 0.0, 0.0, 0.0};
+            break;
+        }
     }
 };
+
+void test_tape_reader_t();
@@ -0,0 +1,251 @@
+#include "time_travel.hpp"
+
+#include <exception>
+#include <stdexcept>
+
+time_travel_t::time_travel_t(memory_t &memory, cpu_t &cpu, io_t &io, uint64_t interval, size_t capacity)
+    : memory_(memory), cpu_(cpu), io_(io), interval_(std::max<uint64_t>(interval, 1)), capacity_(std::max<size_t>(capacity, 1))
+{
+    checkpoint();
+}
+
+void time_travel_t::checkpoint()
+{
+    if (!checkpoints_.empty() && checkpoints_.back().position >= position_)
+        return; //  Went back, the checkpoints ahead are still valid
+    const snapshot_t *parent = checkpoints_.empty() ? nullptr : &checkpoints_.back().snapshot;
+    checkpoints_.push_back({position_, snapshot_t(memory_, cpu_, io_, parent)});
+    if (checkpoints_.size() > capacity_)
+        checkpoints_.pop_front();
+}
+
+void time_travel_t::restore_before(uint64_t position, bool force)
+{
+    if (position < oldest())
+        throw std::runtime_error("Position " + std::to_string(position) + " is before the oldest checkpoint");
+    auto it = checkpoints_.end();
+    do
+        --it;
+    while (it->position > position);
+
+    //  Already between the checkpoint and position: nothing to restore
+    if (!force && position_ >= it->position && position_ <= position)
+        return;
+    it->snapshot.restore(memory_, cpu_, io_);
+    position_ = it->position;
+}
+
+void time_travel_t::replay(uint64_t count)
+{
+    while (count != 0)
+    {
+        uint64_t executed;
+        cpu_.run(count, executed);
+        position_ += executed;
+        count -= executed;
+    }
+}
+
+void time_travel_t::run(uint64_t count)
+{
+    while (count != 0)
+    {
+        auto boundary = (position_ / interval_ + 1) * interval_;
+        auto chunk = std::min(count, boundary - position_);
+        auto start = position_;
+        uint64_t executed;
+        try
+        {
+            cpu_.run(chunk, executed);
+        }
+        catch (const std::runtime_error &)
+        {
+            //  Executed up to the failure, but run() does not say how many: find it again
+            auto error = std::current_exception();
+            restore_before(start, true);
+            replay(start - position_);
+            while (position_ != start + chunk)
+            {
+                cpu_.run(1, executed);
+                position_ += executed;
+            }
+            std::rethrow_exception(error);
+        }
+        position_ += executed;
+        count -= executed;
+        if (position_ % interval_ == 0)
+            checkpoint();
+        if (executed != chunk) //  Stop requested
+            return;
+    }
+}
+
+void time_travel_t::go_to(uint64_t position)
+{
+    restore_before(position);
+    replay(position - position_);
+}
+
+void time_travel_t::step_back(uint64_t count)
+{
+    go_to(count > position_ ? 0 : position_ - count);
+}
+
+void time_travel_t::go_to_cycle(uint64_t cycle)
+{
+    auto it = checkpoints_.end();
+    do
+    {
+        if (it == checkpoints_.begin())
+            throw std::runtime_error("Cycle " + std::to_string(cycle) + " is before the oldest checkpoint");
+        --it;
+    } while (it->snapshot.cpu().cycles > cycle);
+
+    go_to(it->position);
+    while (cpu_.cycles() < cycle)
+        run(1);
+}
+
+bool time_travel_t::run_back_to_write(uint16_t linear)
+{
+    struct watcher_t : public memory_observer_t
+    {
+        uint16_t linear;
+        bool hit = false;
+        void will_write(uint16_t written) override { hit |= written == linear; }
+    } watcher;
+    watcher.linear = linear;
+
+    //  The reference core stores the IAW after each instruction, and its stores notify observers
+    auto core = cpu_.core();
+    cpu_.set_core(cpu_t::kCoreSwitch);
+    memory_.add_observer(&watcher);
+    memory_.set_extra_watched_pages(1ull << (linear / memory_t::kPageSize));
+
+    auto end = position_;
+    uint64_t found = 0;
+    bool hit = false;
+    for (auto it = checkpoints_.rbegin(); it != checkpoints_.rend() && !hit; ++it)
+    {
+        if (it->position >= end)
+            continue;
+        auto segment_end = it == checkpoints_.rbegin() ? end : std::min(end, std::prev(it)->position);
+        it->snapshot.restore(memory_, cpu_, io_);
+        position_ = it->position;
+        while (position_ != segment_end)
+        {
+            uint64_t executed;
+            watcher.hit = false;
+            cpu_.run(1, executed);
+            position_ += executed;
+            if (watcher.hit)
+            {
+                found = position_;
+                hit = true;
+            }
+        }
+    }
+
+    memory_.remove_observer(&watcher);
+    memory_.set_extra_watched_pages(0);
+    cpu_.set_core(core);
+    go_to(hit ? found : end);
+    return hit;
+}
+
+//  Runs the polling program of test_cpu_t for count instructions, in a new machine
+struct test_machine_t
+{
+    memory_t memory;
+    io_t io;
+    cpu_t cpu{memory, io};
+
+    explicit test_machine_t(uint64_t count)
+    {
+        load_polling_program(memory);
+        cpu.reset();
+        while (count != 0)
+        {
+            uint64_t executed;
+            cpu.run(count, executed);
+            count -= executed;
+        }
+    }
+
+    bool same(const memory_t &other_memory, const cpu_t &other_cpu) const
+    {
+        for (size_t i = 0; i != 16384; i++)
+            if (memory[i] != other_memory[i])
+                return false;
+        return cpu.cycles() == other_cpu.cycles();
+    }
+};
+
+void test_time_travel_t()
+{
+    test_machine_t machine(0);
+    time_travel_t travel(machine.memory, machine.cpu, machine.io, 10000, 1000);
+
+    uint64_t failure = 0;
+    try
+    {
+        travel.run(100000000);
+        assert(false);
+    }
+    catch (const std::runtime_error &e)
+    {
+        assert(std::string(e.what()) == "Unimplemented instruction: TLX 0");
+        failure = travel.position();
+    }
+    assert(travel.checkpoints() == failure / 10000 + 1);
+    assert(machine.same(test_machine_t(failure).memory, test_machine_t(failure).cpu));
+
+    //  Back, and forward again
+    travel.step_back();
+    assert(machine.same(test_machine_t(failure - 1).memory, test_machine_t(failure - 1).cpu));
+    travel.go_to(failure / 2);
+    assert(machine.same(test_machine_t(failure / 2).memory, test_machine_t(failure / 2).cpu));
+    travel.go_to(failure);
+    assert(machine.same(test_machine_t(failure).memory, test_machine_t(failure).cpu));
+
+    //  The STA that stored the 4th character
+    assert(travel.run_back_to_write(addrs_t(0, 033).linear()));
+    assert(machine.memory[addrs_t(0, 033)] == 4);
+    auto write = travel.position();
+    travel.step_back();
+    assert(machine.memory[addrs_t(0, 033)] == 0);
+    assert(machine.memory[addrs_t(0, 032)] == 3);
+    assert(!travel.run_back_to_write(addrs_t(0, 0177).linear()));
+    assert(travel.position() == write - 1);
+
+    //  Read but never written: R#2 by the CPX, R#3 by the idle loop detection
+    assert(!travel.run_back_to_write(addrs_t(0, 2).linear()));
+    assert(!travel.run_back_to_write(addrs_t(0, 3).linear()));
+    assert(travel.position() == write - 1);
+
+    //  The tape leader takes 3 s
+    travel.go_to_cycle(3 * guest_clock_t::kCyclesPerSecond);
+    assert(machine.cpu.cycles() >= 3 * guest_clock_t::kCyclesPerSecond);
+    assert(machine.memory[addrs_t(0, 030)] == 0);
+    travel.step_back();
+    assert(machine.cpu.cycles() < 3 * guest_clock_t::kCyclesPerSecond);
+
+    travel.go_to(0);
+    assert(machine.cpu.cycles() == 0);
+
+    //  A bounded ring: the oldest checkpoints are dropped
+    test_machine_t small(0);
+    time_travel_t bounded(small.memory, small.cpu, small.io, 1000, 4);
+    bounded.run(10000);
+    assert(bounded.checkpoints() == 4 && bounded.oldest() == 7000);
+    bool thrown = false;
+    try
+    {
+        bounded.go_to(6999);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+
+#include "snapshot.hpp"
+
+/*
+    Reverse execution.
+
+    Runs the machine while taking a checkpoint (snapshot_t) every interval
+    instructions. Each checkpoint has the previous one as parent, so it
+    only holds the memory pages written since. The newest capacity ones
+    are kept.
+
+    Execution is deterministic: the devices are restored with the
+    checkpoint, and tapes replay the same characters at the same cycles.
+    Going back to a position is restoring the checkpoint before it and
+    running forward, which costs at most interval instructions whatever
+    the length of the run.
+
+    Positions count instructions since the time_travel_t was created,
+    including those skipped in idle loops.
+*/
+
+class time_travel_t
+{
+    struct checkpoint_t
+    {
+        uint64_t position;
+        snapshot_t snapshot;
+    };
+
+    memory_t &memory_;
+    cpu_t &cpu_;
+    io_t &io_;
+
+    uint64_t interval_;
+    size_t capacity_;
+    std::deque<checkpoint_t> checkpoints_; //  Oldest first
+    uint64_t position_ = 0;
+
+    void checkpoint();
+
+    //  Newest checkpoint at or before position, restored
+    //  Unless forced, not if the machine is already between them
+    void restore_before(uint64_t position, bool force = false);
+
+    //  Runs count instructions exactly, no checkpoints
+    void replay(uint64_t count);
+
+public:
+    time_travel_t(memory_t &memory, cpu_t &cpu, io_t &io, uint64_t interval = 100000, size_t capacity = 64);
+
+    //  Runs count instructions, taking checkpoints on the way
+    //  If the CPU stops on an error, position() is the failing instruction
+    //  and the exception is rethrown
+    void run(uint64_t count);
+
+    uint64_t position() const { return position_; }
+    uint64_t oldest() const { return checkpoints_.front().position; }
+    size_t checkpoints() const { return checkpoints_.size(); }
+
+    //  Throw std::runtime_error before the oldest checkpoint
+    void go_to(uint64_t position);
+    void step_back(uint64_t count = 1);
+
+    //  First instruction boundary at or after cycle
+    void go_to_cycle(uint64_t cycle);
+
+    //  Goes back to just after the last instruction that wrote the byte at
+    //  linear (the IAW of an instruction is a write too)
+    //  false, and unchanged position, if there is none since the oldest checkpoint
+    bool run_back_to_write(uint16_t linear);
+};
+
+void test_time_travel_t();
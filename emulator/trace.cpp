@@ -0,0 +1,146 @@
+#include "trace.hpp"
+#include "cpu.hpp"
+
+#include <cstddef>
+#include <cstring>
+#include <cstdio>
+#include <fstream>
+#include <stdexcept>
+
+std::vector<trace_record_t> trace_buffer_t::snapshot() const
+{
+    auto end = written();
+    auto begin = end > capacity() ? end - capacity() : 0;
+
+    std::vector<trace_record_t> result;
+    result.reserve(end - begin);
+    for (auto i = begin; i != end; i++)
+        result.push_back(records_[i & mask_]);
+
+    //  The writer ran meanwhile: drop what it overwrote, and the slot it may be writing
+    auto after = written();
+    if (after != end)
+    {
+        auto first_valid = after + 1 > capacity() ? after + 1 - capacity() : 0;
+        if (first_valid > begin)
+            result.erase(result.begin(), result.begin() + std::min<uint64_t>(first_valid - begin, result.size()));
+    }
+    return result;
+}
+
+void trace_buffer_t::save(const std::string &path) const
+{
+    auto records = snapshot();
+
+    trace_file_header_t header;
+    memcpy(header.magic, "ICLTRACE", 8);
+    header.version = kVersion;
+    header.record_size = sizeof(trace_record_t);
+    header.count = records.size();
+
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char *)&header, sizeof(header));
+    file.write((const char *)records.data(), records.size() * sizeof(trace_record_t));
+    if (!file)
+        throw std::runtime_error("Cannot write trace file: " + path);
+}
+
+std::vector<trace_record_t> trace_buffer_t::load(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Cannot open trace file: " + path);
+
+    trace_file_header_t header;
+    if (!file.read((char *)&header, sizeof(header)) || memcmp(header.magic, "ICLTRACE", 8) != 0)
+        throw std::runtime_error("Not a trace file: " + path);
+    if (header.version != kVersion || header.record_size != sizeof(trace_record_t))
+        throw std::runtime_error("Unsupported trace file version: " + path);
+
+    //  Not more than the file holds, whatever the header says
+    auto start = file.tellg();
+    file.seekg(0, std::ios::end);
+    auto available = (uint64_t)(file.tellg() - start) / sizeof(trace_record_t);
+    file.seekg(start);
+    if (header.count > available)
+        throw std::runtime_error("Truncated trace file: " + path);
+
+    std::vector<trace_record_t> records(header.count);
+    if (!file.read((char *)records.data(), records.size() * sizeof(trace_record_t)))
+        throw std::runtime_error("Truncated trace file: " + path);
+    return records;
+}
+
+void test_trace_buffer_t()
+{
+    //  Ring: only the last capacity() records are kept, oldest first
+    trace_buffer_t buffer(5);
+    assert(buffer.capacity() == 8);
+    for (uint64_t i = 0; i != 20; i++)
+        buffer.push(trace_record_t{i, 0, 0, 0, 0, 0, 0, 0});
+    auto records = buffer.snapshot();
+    assert(records.size() == 8);
+    for (size_t i = 0; i != records.size(); i++)
+        assert(records[i].cycle == 12 + i);
+
+    //  The bootstrap, traced by the switch and threaded cores
+    std::vector<trace_record_t> traces[2];
+    for (auto core : {cpu_t::kCoreSwitch, cpu_t::kCoreThreaded})
+    {
+        memory_t memory;
+        io_t io;
+        memory.copy(
+            addrs_t("P01-000"),
+            vector_from_octal_pairs("201-030 170-007 231-002 341-230 111-003 170-016 170-005 100-030"));
+        trace_buffer_t trace;
+        cpu_t cpu(memory, io);
+        cpu.set_core(core);
+        cpu.set_trace(&trace);
+        cpu.reset();
+        cpu.run(9);
+        traces[core == cpu_t::kCoreThreaded] = trace.snapshot();
+    }
+    assert(traces[0].size() == 9);
+    assert(memcmp(traces[0].data(), traces[1].data(), 9 * sizeof(trace_record_t)) == 0);
+
+    auto &ldx = traces[0][0];
+    assert(ldx.cycle == 0 && ldx.pc == addrs_t("P01-000").linear());
+    assert(ldx.iwl == 0201 && ldx.iwr == 030);
+    assert(ldx.reg == 1 && ldx.reg_value == 030);
+
+    auto &sta = traces[0][2]; //  STA R#1+ after the first character
+    assert(sta.accumulator == 1);
+    assert(sta.reg == 1 && sta.reg_value == 031);
+
+    auto &cpx = traces[0][3];
+    assert(cpx.reg == 0 && cpx.compare == cpu_t::kLow);
+
+    //  Round trip through a file
+    trace_buffer_t trace;
+    for (auto &record : traces[0])
+        trace.push(record);
+    auto path = test_path("trace");
+    trace.save(path);
+    auto loaded = trace_buffer_t::load(path);
+    assert(loaded.size() == 9);
+    assert(memcmp(loaded.data(), traces[0].data(), 9 * sizeof(trace_record_t)) == 0);
+
+    //  A count that the file does not hold
+    {
+        std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+        uint64_t count = 1ull << 60;
+        file.seekp(offsetof(trace_file_header_t, count));
+        file.write((const char *)&count, sizeof(count));
+    }
+    bool thrown = false;
+    try
+    {
+        trace_buffer_t::load(path);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    std::remove(path.c_str());
+}
@@ -0,0 +1,95 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <atomic>
+#include <cassert>
+
+/*
+    Execution trace.
+
+    When enabled (cpu_t::set_trace()), each executed instruction appends a
+    fixed-size binary record to a ring buffer. Formatting is left to the
+    offline decoder (icl1501-trace), so tracing costs a few stores per
+    instruction. When disabled, it costs nothing in the threaded core and a
+    predictable branch in the others.
+
+    File format: trace_file_header_t, then the records, oldest first.
+*/
+
+struct trace_record_t
+{
+    uint64_t cycle;       // guest time when the instruction started
+    uint16_t pc;          // linear address of the instruction
+    uint8_t iwl;
+    uint8_t iwr;
+    uint8_t accumulator;  // after execution
+    uint8_t reg;          // index register written by the instruction, 0 if none
+    uint8_t reg_value;    // its value after execution
+    uint8_t compare;      // cpu_t::eCompareResult after execution
+};
+
+static_assert(sizeof(trace_record_t) == 16);
+
+struct trace_file_header_t
+{
+    char magic[8];        // "ICLTRACE"
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t count;
+};
+
+/**
+ * Keeps the last capacity() records.
+ * One writer (the CPU thread). snapshot() and save() can run in another
+ * thread, best-effort: the copy races with the writer, so records it
+ * overwrote meanwhile are dropped, with the slot it may be writing.
+ */
+class trace_buffer_t
+{
+    std::vector<trace_record_t> records_;
+    uint64_t mask_;
+    std::atomic<uint64_t> written_{0};
+
+public:
+    static const uint32_t kVersion = 1;
+
+    //  capacity is rounded up to a power of two
+    explicit trace_buffer_t(size_t capacity = 65536)
+    {
+        size_t size = 1;
+        while (size < capacity)
+            size <<= 1;
+        records_.resize(size);
+        mask_ = size - 1;
+    }
+
+    trace_buffer_t(const trace_buffer_t &) = delete;
+    trace_buffer_t &operator=(const trace_buffer_t &) = delete;
+
+    size_t capacity() const { return records_.size(); }
+
+    //  Records pushed since creation (or clear())
+    uint64_t written() const { return written_.load(std::memory_order_acquire); }
+
+    void push(const trace_record_t &record)
+    {
+        auto written = written_.load(std::memory_order_relaxed);
+        records_[written & mask_] = record;
+        written_.store(written + 1, std::memory_order_release);
+    }
+
+    void clear() { written_.store(0, std::memory_order_release); }
+
+    //  Oldest first
+    std::vector<trace_record_t> snapshot() const;
+
+    //  Throws std::runtime_error if the file cannot be written
+    void save(const std::string &path) const;
+
+    //  Throws std::runtime_error if the file cannot be read or is not a trace
+    static std::vector<trace_record_t> load(const std::string &path);
+};
+
+void test_trace_buffer_t();
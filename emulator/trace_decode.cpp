@@ -0,0 +1,77 @@
+//  icl1501-trace: prints a trace file saved by the emulator
+//  usage: icl1501-trace FILE [LAST]
+//         icl1501-trace --samples FILE [TOP]   histogram of a sample file
+
+#include "trace.hpp"
+#include "sampler.hpp"
+#include "addrs.hpp"
+#include "iw.hpp"
+#include "disassembler.hpp"
+#include "utils.hpp"
+
+#include <cstdio>
+#include <cstdlib>
+#include <stdexcept>
+
+int main(int argc, char **argv)
+{
+    if (argc >= 3 && argc <= 4 && std::string(argv[1]) == "--samples")
+    {
+        try
+        {
+            auto samples = sampler_t::load(argv[2]);
+            size_t top = argc == 4 ? strtoul(argv[3], nullptr, 10) : 50;
+            printf("%s", sampler_t::report(samples, top).c_str());
+        }
+        catch (const std::runtime_error &e)
+        {
+            fprintf(stderr, "%s\n", e.what());
+            return 1;
+        }
+        return 0;
+    }
+
+    if (argc < 2 || argc > 3)
+    {
+        fprintf(stderr, "usage: %s FILE [LAST]\n       %s --samples FILE [TOP]\n", argv[0], argv[0]);
+        return 2;
+    }
+
+    try
+    {
+        auto records = trace_buffer_t::load(argv[1]);
+        size_t first = 0;
+        if (argc == 3)
+        {
+            size_t last = strtoul(argv[2], nullptr, 10);
+            if (last < records.size())
+                first = records.size() - last;
+        }
+
+        disassembler_t disassembler;
+        static const char *compare_str[] = {"L", "E", "H"};
+        std::string line;
+        for (size_t i = first; i != records.size(); i++)
+        {
+            auto &r = records[i];
+            iw_t iw(r.iwl, r.iwr);
+            line = disassembler.disassemble(iw);
+            printf("%12llu %s: %s  %-24s ACC:%s CMP:%s",
+                   (unsigned long long)r.cycle,
+                   addrs_t(r.pc).as_string().c_str(),
+                   iw.as_octal().c_str(),
+                   line.c_str(),
+                   to_octal(r.accumulator).c_str(),
+                   r.compare < 3 ? compare_str[r.compare] : "?");
+            if (r.reg)
+                printf(" R#%d=%s", r.reg, to_octal(r.reg_value).c_str());
+            printf("\n");
+        }
+    }
+    catch (const std::runtime_error &e)
+    {
+        fprintf(stderr, "%s\n", e.what());
+        return 1;
+    }
+    return 0;
+}
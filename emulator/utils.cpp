@@ -8,6 +8,14 @@
 #include <vector>
 #include <string>
 #include <stdint.h>
+#include <filesystem>
+#include <unistd.h>
+
+std::string test_path(std::string_view name)
+{
+	auto file = "icl1501-test-" + std::to_string(getpid()) + "-" + std::string(name);
+	return (std::filesystem::temp_directory_path() / file).string();
+}
 
 std::string to_octal(uint8_t value, int w )
 {
@@ -2,7 +2,11 @@
 #include <vector>
 #include <string_view>
 #include <cstdint>
+#include <string>
 
 std::string to_octal(uint8_t value, int w = 3);
 std::vector<uint8_t> vector_from_hex(std::string_view hex_str);
 std::vector<uint8_t> vector_from_octal_pairs(std::string_view octal_pairs);
+
+//  A file for a test, in the temporary directory, unique to the process
+std::string test_path(std::string_view name);
@@ -0,0 +1,144 @@
+#include "wav.hpp"
+#include "utils.hpp"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <stdexcept>
+
+static uint32_t get_le(const uint8_t *p, int bytes)
+{
+    uint32_t value = 0;
+    for (int i = 0; i != bytes; i++)
+        value |= (uint32_t)p[i] << (8 * i);
+    return value;
+}
+
+static void put_le(std::vector<uint8_t> &data, uint32_t value, int bytes)
+{
+    for (int i = 0; i != bytes; i++)
+        data.push_back(value >> (8 * i));
+}
+
+wav_t wav_t::load(const std::string &path)
+{
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+        throw std::runtime_error("Cannot open WAV file: " + path);
+    std::vector<uint8_t> data{std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>()};
+    if (data.size() < 12 || memcmp(data.data(), "RIFF", 4) != 0 || memcmp(data.data() + 8, "WAVE", 4) != 0)
+        throw std::runtime_error("Not a WAV file: " + path);
+
+    wav_t wav;
+    uint32_t format = 0, channels = 0, bits = 0;
+    size_t offset = 12;
+    while (data.size() - offset >= 8)
+    {
+        auto id = data.data() + offset;
+        size_t size = get_le(id + 4, 4);
+        auto body = id + 8;
+        size = std::min(size, data.size() - offset - 8); //  Streamed files may not have patched sizes
+        if (memcmp(id, "fmt ", 4) == 0 && size >= 16)
+        {
+            format = get_le(body, 2);
+            channels = get_le(body + 2, 2);
+            wav.sample_rate = get_le(body + 4, 4);
+            bits = get_le(body + 14, 2);
+            if (format == 0xfffe && size >= 26) //  WAVE_FORMAT_EXTENSIBLE: the subformat
+                format = get_le(body + 24, 2);
+        }
+        else if (memcmp(id, "data", 4) == 0)
+        {
+            if (!channels || !((format == 1 && bits == 16) || (format == 3 && bits == 32)))
+                throw std::runtime_error("Unsupported WAV format (16-bit PCM or 32-bit float expected): " + path);
+            size_t frame = channels * bits / 8;
+            size_t count = size / frame;
+            wav.samples.resize(count);
+            if (format == 1)
+                for (size_t i = 0; i != count; i++)
+                    wav.samples[i] = (int16_t)get_le(body + i * frame, 2) / 32768.0f;
+            else
+                for (size_t i = 0; i != count; i++)
+                    memcpy(&wav.samples[i], body + i * frame, 4);
+            return wav;
+        }
+        offset = std::min(offset + 8 + size + (size & 1), data.size());
+    }
+    throw std::runtime_error("No data in WAV file: " + path);
+}
+
+std::vector<uint8_t> wav_t::header(uint32_t sample_rate, uint64_t count)
+{
+    auto bytes = (uint32_t)std::min<uint64_t>(count * 2, 0xffffffffu - 36);
+    std::vector<uint8_t> data;
+    data.insert(data.end(), {'R', 'I', 'F', 'F'});
+    put_le(data, 36 + bytes, 4);
+    data.insert(data.end(), {'W', 'A', 'V', 'E', 'f', 'm', 't', ' '});
+    put_le(data, 16, 4);
+    put_le(data, 1, 2); //  PCM
+    put_le(data, 1, 2); //  Mono
+    put_le(data, sample_rate, 4);
+    put_le(data, sample_rate * 2, 4);
+    put_le(data, 2, 2);
+    put_le(data, 16, 2);
+    data.insert(data.end(), {'d', 'a', 't', 'a'});
+    put_le(data, bytes, 4);
+    return data;
+}
+
+void wav_t::save(const std::string &path) const
+{
+    auto data = header(sample_rate, samples.size());
+    for (auto sample : samples)
+        put_le(data, (uint16_t)to_int16(sample), 2);
+    std::ofstream file(path, std::ios::binary);
+    file.write((const char *)data.data(), data.size());
+    if (!file)
+        throw std::runtime_error("Cannot write WAV file: " + path);
+}
+
+void test_wav_t()
+{
+    wav_t wav;
+    wav.sample_rate = 96000;
+    for (int i = 0; i != 1001; i++)
+        wav.samples.push_back(std::sin(i * 0.01f) * 1.2f); //  Clipped at the top
+    auto path = test_path("capture.wav");
+    wav.save(path);
+    auto loaded = wav_t::load(path);
+    assert(loaded.sample_rate == 96000 && loaded.samples.size() == 1001);
+    for (size_t i = 0; i != wav.samples.size(); i++)
+        assert(std::abs(loaded.samples[i] - std::clamp(wav.samples[i], -1.0f, 1.0f)) < 1.0f / 16384);
+    remove(path.c_str());
+
+    bool thrown = false;
+    try
+    {
+        wav_t::load(path);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+
+    //  A padded chunk at the end, without its padding byte
+    FILE *f = fopen(path.c_str(), "wb");
+    fwrite("RIFF\x0d\0\0\0WAVELIST\x01\0\0\0\0", 1, 21, f);
+    fclose(f);
+    thrown = false;
+    try
+    {
+        wav_t::load(path);
+    }
+    catch (const std::runtime_error &)
+    {
+        thrown = true;
+    }
+    assert(thrown);
+    remove(path.c_str());
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*
+    WAV files, for audio captures of tapes (see tape_decoder.hpp).
+
+    Reading takes 16-bit integer or 32-bit float PCM, keeping the first
+    channel as floats from -1 to 1. Writing is 16-bit mono PCM; header()
+    lets a writer stream the samples after it.
+*/
+
+class wav_t
+{
+public:
+    uint32_t sample_rate = 0;
+    std::vector<float> samples;
+
+    //  Throws std::runtime_error if the file cannot be read or is not a PCM WAV
+    static wav_t load(const std::string &path);
+
+    //  Throws std::runtime_error if the file cannot be written
+    void save(const std::string &path) const;
+
+    //  The 44 bytes before count 16-bit mono samples
+    static std::vector<uint8_t> header(uint32_t sample_rate, uint64_t count);
+
+    //  Clipped to -1..1
+    static int16_t to_int16(float sample)
+    {
+        if (sample >= 1.0f)
+            return 32767;
+        if (sample <= -1.0f)
+            return -32767;
+        return (int16_t)(sample * 32767.0f + (sample < 0 ? -0.5f : 0.5f));
+    }
+};
+
+void test_wav_t();